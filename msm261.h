@@ -19,14 +19,20 @@
 #include <sound/tlv.h>
 #include <linux/gpio.h>
 #include <linux/regmap.h>
+#include <linux/list.h>
+#include <linux/completion.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/rcupdate.h>
+#include <linux/percpu.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/log2.h>
+
+#include "msm261_dsp.h"
 
 #define DRIVER_NAME     "msm261"
 #define DRIVER_VERSION  "1.0"
-#define NUM_MICS        7
-#define NUM_DATA_LINES  4
-
-#define MSM261_MODE_NORMAL      0
-#define MSM261_MODE_LOW_POWER   1
 
 #define MSM261_STATUS_OFF       0
 #define MSM261_STATUS_ON        1
@@ -35,15 +41,161 @@
 #define MSM261_RETRY_COUNT      3
 #define MSM261_RETRY_DELAY_US   1000
 
-/* Clock frequency definitions */
-#define MSM261_NORMAL_MODE_MIN_CLK   1000000  /* 1.0 MHz */
-#define MSM261_NORMAL_MODE_MAX_CLK   4000000  /* 4.0 MHz */
+/* Режими і діапазони BCLK - у msm261_dsp.h */
+#define MSM261_DEFAULT_BCLK          2048000
+
+/*
+ * Геометрія буфера PCM (параметри модуля або DT, див. msm261_parse_geometry()).
+ * Тривалість буфера - для 48 кГц; scratch обробки обмежено, щоб великі
+ * періоди пакетного запису оброблялися шматками, що лишаються в кеші.
+ */
+#define MSM261_PERIOD_FRAMES_MIN    32
+#define MSM261_PERIOD_FRAMES_MAX    65536
+#define MSM261_BUFFER_MS_DEFAULT    2000
+#define MSM261_BUFFER_MS_MAX        10000
+#define MSM261_SCRATCH_BYTES        32768
+
+/* Межа "Mic Array Gain" (software_gain, лише з вимкненим AGC) */
+#define MSM261_GAIN_MAX             100
+
+/* Простій до runtime suspend після закриття потоку */
+#define MSM261_AUTOSUSPEND_MS       2000
+
+/*
+ * Файл калібрування (request_firmware, типово MSM261_CAL_FIRMWARE або
+ * "firmware-name" з DT), little-endian. Має пріоритет над властивостями DT.
+ */
+#define MSM261_CAL_FIRMWARE     "msm261_cal.bin"
+#define MSM261_CAL_MAGIC        "M261"
+#define MSM261_CAL_VERSION      1
+
+struct msm261_cal_fw_mic {
+    __le16 gain;        /* Q12 */
+    u8 delay;           /* семпли */
+    u8 reserved;
+} __packed;
+
+struct msm261_cal_fw {
+    char magic[4];
+    u8 version;
+    u8 mics;            /* NUM_MICS */
+    u8 reserved[2];
+    struct msm261_cal_fw_mic mic[NUM_MICS];
+} __packed;
 
 struct msm261_mic_status {
     u8 power_state;
     u8 operation_mode;
     bool initialized;
-    bool error;
+    bool error;         /* gpio_error або вердикт монітора */
+    bool gpio_error;    /* перевірка в msm261_power_on(), монітор її не скидає */
+    u8 faults;          /* MSM261_HEALTH_*, блок, що змінив вердикт монітора */
+};
+
+/*
+ * Лічильники гарячого шляху, по одному набору на CPU: запис без блокувань,
+ * debugfs сумує їх при читанні (msm261_debugfs.c).
+ */
+#define MSM261_STATS_BUCKETS    32  /* log2 нс: [2^i, 2^(i+1)), останній - решта */
+
+struct msm261_stats {
+    u64_stats_t periods;
+    u64_stats_t frames;
+    u64_stats_t bytes;
+    u64_stats_t ns;
+    u64_stats_t ns_max;
+    u64_stats_t xruns;
+    /* VAD: періоди споживачів, з них під час мови, і початки мови */
+    u64_stats_t vad_periods;
+    u64_stats_t vad_speech;
+    u64_stats_t vad_onsets;
+    u64_stats_t hist[MSM261_STATS_BUCKETS];
+    struct u64_stats_sync syncp;
+};
+
+/*
+ * Споживачі захоплення: кожен DAI - окремий пристрій PCM зі своїм
+ * покажчиком, xrun-ами і децимацією, а всі разом живляться одним потоком
+ * масиву з однією обробкою. У залізному режимі реєструється лише перший.
+ *
+ * Чому так: лінії даних драйвер бачить лише в симуляторі, який сам їх
+ * синтезує на частоті масиву і сам пише буфер PCM. Тому лише там є кілька
+ * споживачів, потік групи, децимація, неповний вибір мікрофонів і межі
+ * періодів для позначок часу. У залізному режимі буфер заповнює DMA
+ * платформи I2S, слотами підряд на частоті потоку, а драйвер бачить кадри
+ * тільки в copy. Інші місця з msm261->sim посилаються сюди.
+ */
+enum {
+    MSM261_STREAM_MICS,     /* вибрані мікрофони і, якщо всі, промінь */
+    MSM261_STREAM_BEAM,     /* лише канал променя, моно */
+    MSM261_STREAM_AUX,      /* ще один набір мікрофонів, напр. 16 кГц */
+    MSM261_STREAM_GROUP,    /* усі мікрофони всіх масивів групи, лише ведучий */
+    MSM261_STREAMS,
+};
+
+#define MSM261_DAI_NAME         "msm261-pcm"
+#define MSM261_BEAM_DAI_NAME    "msm261-beam"
+#define MSM261_AUX_DAI_NAME     "msm261-pcm-aux"
+#define MSM261_GROUP_DAI_NAME   "msm261-group"
+
+/*
+ * Група масивів зі спільним тактуванням (msm261_group.c): кілька плат, що
+ * видно як один потік захоплення на NUM_MICS * count каналів, масив за
+ * масивом у порядку "msm,array-index". Ведучий (індекс 0) реєструє потік
+ * групи і в таймері збирає кадри всіх масивів; решта своїх карт не має.
+ * Групи живуть до вивантаження модуля, тож таймер ведучого не переживе
+ * свою групу, навіть якщо масиви зникають.
+ */
+#define MSM261_GROUP_MAX            3
+#define MSM261_GROUP_CHANNELS_MAX   (NUM_MICS * MSM261_GROUP_MAX)
+
+enum msm261_array_health {
+    MSM261_ARRAY_MISSING,           /* ще не з'явився або вже видалений */
+    MSM261_ARRAY_OK,
+    MSM261_ARRAY_MIC_ERROR,         /* є мікрофон з помилкою */
+};
+
+struct msm261_group {
+    struct list_head node;
+    u32 id;
+    unsigned int count;
+    struct mutex mutex;             /* join/leave і захоплення групи */
+    spinlock_t lock;                /* arrays[], running, leaving проти таймера ведучого */
+    struct msm261_priv *arrays[MSM261_GROUP_MAX];
+    bool running;                   /* таймер ведучого проходить масиви поза замком */
+    struct completion *leaving;     /* msm261_group_leave() чекає кінця проходу */
+};
+
+struct msm261_stream {
+    struct snd_pcm_substream *substream;
+    int fmt;
+    unsigned int channels;
+    unsigned int first;             /* перший канал спільного кадру */
+    struct msm261_decim decim;
+    /* Обробка в copy, залізний режим */
+    msm261_process_fn process;
+    void *scratch;
+    void *demux;                    /* кадри DMA в порядку каналів, за scratch */
+    size_t scratch_bytes;
+    bool reorder;                   /* слоти DMA не в порядку каналів */
+    /* Заповнення спільним потоком, симулятор */
+    snd_pcm_uframes_t hw_ptr;
+    snd_pcm_uframes_t period_pos;
+    unsigned int stats_frames;      /* кадри неповного періоду */
+    u64 xruns;
+    /*
+     * Остання межа періоду, симулятор: її позиція в кадрах споживача від
+     * старту (лічильник лінії, не згортається з буфером) і коли її кадр було
+     * захоплено; raw_ns == 0 - меж ще не було. Під замком таймера.
+     */
+    u64 frames;
+    u64 period_frames;
+    u64 period_raw_ns;
+    u64 period_mono_ns;
+    /* Частоти, сумісні з уже запущеним потоком масиву, для open */
+    unsigned int rates[MSM261_RATES_MAX];
+    struct snd_pcm_hw_constraint_list rate_list;
+    struct snd_pcm_chmap *chmap;
 };
 
 struct msm261_priv {
@@ -53,14 +205,187 @@ struct msm261_priv {
     int bck_gpio;
     int ws_gpio;
     int data_gpio[NUM_DATA_LINES];
-    bool streaming;
+    unsigned long streaming;        /* біти MSM261_STREAM_*, що захоплюють */
+    unsigned long hw_users;         /* споживачі після hw_params, під hw_lock */
+    unsigned int native_rate;       /* частота масиву спільного потоку */
+    struct msm261_drift drift;      /* BCLK проти CLOCK_MONOTONIC_RAW */
+    /* Група масивів; array_count > 1 - масив входить у групу */
+    u32 group_id;
+    unsigned int array_index;
+    unsigned int array_count;
+    struct msm261_group *group;
     u8 operation_mode;
-    int software_gain;
+    unsigned int bclk;              /* поточна частота, відновлюється після resume */
     struct msm261_mic_status mic_status[NUM_MICS];
-    spinlock_t lock;
+    /* PCM geometry, fixed at probe */
+    struct snd_pcm_hardware pcm_hw;
+    unsigned int period_frames_min;
+    unsigned int period_frames_max;
+    struct msm261_stream streams[MSM261_STREAMS];
+    struct msm261_dsp dsp;
+    struct work_struct doa_work;    /* msm261_doa_update() поза copy і таймером */
+    struct msm261_params __rcu *params;     /* див. msm261_params_begin() */
+    struct mutex params_lock;               /* писачі params */
+    struct snd_kcontrol *vad_kctl;  /* "VAD Speech", сповіщається зі зміною */
+    struct snd_kcontrol *health_kctl;       /* "Mic Fault Mask" */
+    struct snd_kcontrol *group_kctl;        /* "Array Health", лише ведучий */
+    /* Вибір мікрофонів і карта каналів, що його описує */
+    unsigned int mic_mask;
+    struct snd_pcm_chmap_elem chmaps[MSM261_CHANNELS_MAX + 1];
+    /* Measured cost of the copy path, see msm261_stats_copy() */
+    struct msm261_stats __percpu *stats;
+    u64 hw_init_ns;
+    u64 open_ns;
+    u64 open_time;                  /* для затримки старту, 0 після START */
+    u64 start_ns;
+    u64 resume_ns;                  /* останній runtime resume */
+    struct dentry *debugfs;
+    struct mutex hw_lock;           /* послідовності живлення, можуть спати */
+    /* Симульований бекенд замість GPIO (msm261_sim.c) */
+    bool sim;
+    struct msm261_sim *sim_state;
 };
 
 int msm261_hw_init(struct msm261_priv *msm261);
 int msm261_set_i2s_config(struct msm261_priv *msm261, unsigned int bclk, unsigned int rate);
+int msm261_format_to_dsp(snd_pcm_format_t format);
+bool msm261_needs_processing(const struct msm261_params *p, unsigned int channels);
+void msm261_vad_notify(struct msm261_priv *msm261);
+void msm261_health_notify(struct msm261_priv *msm261);
+
+/* Після обробки, з будь-якого контексту: нове вікно DOA - у роботу */
+static inline void msm261_doa_kick(struct msm261_priv *msm261)
+{
+    if (msm261_doa_pending(msm261->dsp.doa))
+        schedule_work(&msm261->doa_work);
+}
+
+/* Одне поле поточного блоку параметрів, для get-обробників і рішень поза обробкою */
+#define msm261_param(msm261, field)                                 \
+({                                                                  \
+    typeof(((struct msm261_params *)0)->field) __val;               \
+                                                                    \
+    rcu_read_lock();                                                \
+    __val = rcu_dereference((msm261)->params)->field;               \
+    rcu_read_unlock();                                              \
+    __val;                                                          \
+})
+
+/* Споживач підпотоку - за номером нашого DAI у зв'язку */
+static inline struct msm261_stream *msm261_stream_of(struct msm261_priv *msm261,
+                                                     struct snd_pcm_substream *substream)
+{
+    struct snd_soc_pcm_runtime *rtd = substream->private_data;
+
+    return &msm261->streams[snd_soc_rtd_to_codec(rtd, 0)->id];
+}
+
+/* VAD слухає промінь, якщо він є в кадрі, інакше перший канал */
+static inline unsigned int msm261_vad_channel(unsigned int channels)
+{
+    return channels == MSM261_CHANNELS_MAX ? MSM261_BEAM_CHANNEL : 0;
+}
+
+int msm261_debugfs_init(struct msm261_priv *msm261);
+
+int msm261_group_parse(struct msm261_priv *msm261, struct device_node *np);
+int msm261_group_join(struct msm261_priv *msm261);
+void msm261_group_exit(void);
+enum msm261_array_health msm261_group_health(struct msm261_group *group, unsigned int index);
+
+static inline bool msm261_group_leader(const struct msm261_priv *msm261)
+{
+    return msm261->array_count > 1 && !msm261->array_index;
+}
+
+static inline unsigned int msm261_group_channels(const struct msm261_priv *msm261)
+{
+    return NUM_MICS * msm261->array_count;
+}
+
+/* Байтові межі pcm_hw розраховано на кадр у MSM261_CHANNELS_MAX каналів */
+static inline size_t msm261_group_bytes(const struct msm261_priv *msm261, size_t bytes)
+{
+    return bytes / MSM261_CHANNELS_MAX * msm261_group_channels(msm261);
+}
+
+/* Один виклик copy: час у гістограму, кадри у повні періоди; повертає їх */
+static inline unsigned int msm261_stats_copy(struct msm261_priv *msm261,
+                                     struct msm261_stream *stream, u64 ns,
+                                     unsigned int frames, unsigned int period_frames,
+                                     size_t bytes)
+{
+    struct msm261_stats *st;
+    unsigned int periods;
+
+    stream->stats_frames += frames;
+    periods = stream->stats_frames / period_frames;
+    stream->stats_frames %= period_frames;
+
+    st = get_cpu_ptr(msm261->stats);
+    u64_stats_update_begin(&st->syncp);
+    u64_stats_add(&st->periods, periods);
+    u64_stats_add(&st->frames, frames);
+    u64_stats_add(&st->bytes, bytes);
+    u64_stats_add(&st->ns, ns);
+    if (ns > u64_stats_read(&st->ns_max))
+        u64_stats_set(&st->ns_max, ns);
+    u64_stats_inc(&st->hist[min_t(unsigned int, ns ? ilog2(ns) : 0,
+                                  MSM261_STATS_BUCKETS - 1)]);
+    u64_stats_update_end(&st->syncp);
+    put_cpu_ptr(msm261->stats);
+    return periods;
+}
+
+/*
+ * Періоди, які розбудили б читача, що читає безперервно, проти тих, що
+ * потрібні читачу, який чекає на "VAD Speech": лише мова і її початки.
+ */
+static inline void msm261_stats_vad(struct msm261_priv *msm261, unsigned int periods,
+                                    bool onset)
+{
+    struct msm261_stats *st = get_cpu_ptr(msm261->stats);
+
+    u64_stats_update_begin(&st->syncp);
+    u64_stats_add(&st->vad_periods, periods);
+    if (READ_ONCE(msm261->dsp.vad.speech))
+        u64_stats_add(&st->vad_speech, periods);
+    if (onset)
+        u64_stats_inc(&st->vad_onsets);
+    u64_stats_update_end(&st->syncp);
+    put_cpu_ptr(msm261->stats);
+}
+
+static inline void msm261_stats_xrun(struct msm261_priv *msm261)
+{
+    struct msm261_stats *st = get_cpu_ptr(msm261->stats);
+
+    u64_stats_update_begin(&st->syncp);
+    u64_stats_inc(&st->xruns);
+    u64_stats_update_end(&st->syncp);
+    put_cpu_ptr(msm261->stats);
+}
+
+bool msm261_sim_requested(struct device_node *np);
+bool msm261_sim_array(struct device *dev, unsigned int *index, unsigned int *count);
+int msm261_sim_probe(struct msm261_priv *msm261);
+void msm261_sim_configure(struct msm261_priv *msm261, unsigned int width);
+int msm261_sim_init(void);
+void msm261_sim_exit(void);
+int msm261_sim_pcm_construct(struct snd_soc_component *component,
+                             struct snd_soc_pcm_runtime *rtd);
+int msm261_sim_prepare(struct snd_soc_component *component,
+                       struct snd_pcm_substream *substream);
+int msm261_sim_trigger(struct snd_soc_component *component,
+                       struct snd_pcm_substream *substream, int cmd);
+int msm261_sim_sync_stop(struct snd_soc_component *component,
+                         struct snd_pcm_substream *substream);
+snd_pcm_uframes_t msm261_sim_pointer(struct snd_soc_component *component,
+                                     struct snd_pcm_substream *substream);
+int msm261_sim_get_time_info(struct snd_soc_component *component,
+                             struct snd_pcm_substream *substream,
+                             struct timespec64 *system_ts, struct timespec64 *audio_ts,
+                             struct snd_pcm_audio_tstamp_config *audio_tstamp_config,
+                             struct snd_pcm_audio_tstamp_report *audio_tstamp_report);
 
 #endif /* MSM261_H */
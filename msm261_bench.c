@@ -0,0 +1,1376 @@
+/*
+ * Userspace-бенчмарк ядер обробки з msm261_dsp.c.
+ *
+ * Проганяє ті самі функції, що й модуль, по WAV/raw фікстурі (або по
+ * синтетичному шуму з відомого напрямку) періодами, як їх бачить
+ * msm261_pcm_copy(), і друкує ns/кадр, пропускну здатність і кеш-промахи.
+ * Демультиплексор ліній міряється на тій самій фікстурі, розкладеній по
+ * лініях за типовою картою слотів, і перевіряється на збіг з нею. Кожна
+ * перевірка має поріг; якщо хоч одна не пройшла, код виходу 1.
+ *
+ *   make bench
+ *   ./msm261_bench [-f s16|s24|s24_3|s32] [-c каналів] [-r частота]
+ *                  [-p кадрів_у_періоді] [-g підсилення] [-n проходів]
+ *                  [-a кут] [-R 2|3] [-b] [-C] [-D] [-H] [файл.wav | файл.raw]
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "msm261_dsp.h"
+
+struct fixture {
+    const char *name;
+    int fmt;
+    unsigned int channels;
+    unsigned int rate;
+    unsigned int frames;
+    void *data;
+};
+
+struct bench {
+    const struct fixture *fx;
+    unsigned int period;
+    unsigned int passes;
+    unsigned int pos;       /* кадр фікстури, з якого почато поточний виклик */
+    void *lines[NUM_DATA_LINES];
+    void *dma;              /* фікстура в порядку слотів I2S, кадр - channels слотів */
+    struct msm261_dsp dsp;
+    struct msm261_params params;
+    struct msm261_decim decim;
+    msm261_process_fn process;
+    const struct msm261_gain_ops *ops;
+};
+
+typedef void (*bench_fn)(struct bench *b, void *dst, const void *src,
+                         unsigned int frames);
+
+static const unsigned int fmt_bytes[MSM261_FMT_COUNT] = {
+    [MSM261_FMT_S16]   = 2,
+    [MSM261_FMT_S24]   = 4,
+    [MSM261_FMT_S24_3] = 3,
+    [MSM261_FMT_S32]   = 4,
+};
+
+static const char *const fmt_names[MSM261_FMT_COUNT] = {
+    [MSM261_FMT_S16]   = "s16",
+    [MSM261_FMT_S24]   = "s24",
+    [MSM261_FMT_S24_3] = "s24_3",
+    [MSM261_FMT_S32]   = "s32",
+};
+
+static size_t frame_bytes(const struct fixture *fx)
+{
+    return (size_t)fmt_bytes[fx->fmt] * fx->channels;
+}
+
+static void die(const char *msg)
+{
+    fprintf(stderr, "msm261_bench: %s\n", msg);
+    exit(1);
+}
+
+static void *xmalloc(size_t size)
+{
+    void *p = calloc(1, size ? size : 1);
+
+    if (!p)
+        die("out of memory");
+    return p;
+}
+
+static int parse_fmt(const char *s)
+{
+    int fmt;
+
+    for (fmt = 0; fmt < MSM261_FMT_COUNT; fmt++)
+        if (!strcmp(s, fmt_names[fmt]))
+            return fmt;
+    die("unknown format, expected s16, s24, s24_3 or s32");
+    return -1;
+}
+
+static u32 get_le(const u8 *p, unsigned int n)
+{
+    u32 v = 0;
+
+    while (n--)
+        v = v << 8 | p[n];
+    return v;
+}
+
+static void *read_file(const char *path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    void *buf;
+    long len;
+
+    if (!f || fseek(f, 0, SEEK_END) || (len = ftell(f)) < 0 || fseek(f, 0, SEEK_SET)) {
+        perror(path);
+        exit(1);
+    }
+    buf = xmalloc(len);
+    if (fread(buf, 1, len, f) != (size_t)len) {
+        perror(path);
+        exit(1);
+    }
+    fclose(f);
+    *size = len;
+    return buf;
+}
+
+/* PCM або WAVE_FORMAT_EXTENSIBLE з PCM-підформатом */
+static void load_wav(struct fixture *fx, const u8 *buf, size_t size)
+{
+    size_t pos = 12;
+    unsigned int bits = 0, align = 0;
+    bool have_fmt = false;
+
+    while (pos + 8 <= size) {
+        u32 id = get_le(buf + pos, 4), len = get_le(buf + pos + 4, 4);
+        const u8 *c = buf + pos + 8;
+
+        if (len > size - pos - 8)
+            len = size - pos - 8;
+
+        if (id == 0x20746d66 && len >= 16) {                    /* "fmt " */
+            unsigned int tag = get_le(c, 2);
+
+            if (tag == 0xfffe && len >= 26)
+                tag = get_le(c + 24, 2);
+            if (tag != 1)
+                die("only PCM WAV files are supported");
+            fx->channels = get_le(c + 2, 2);
+            fx->rate = get_le(c + 4, 4);
+            align = get_le(c + 12, 2);
+            bits = get_le(c + 14, 2);
+            have_fmt = true;
+        } else if (id == 0x61746164 && have_fmt) {             /* "data" */
+            if (bits == 16)
+                fx->fmt = MSM261_FMT_S16;
+            else if (bits == 24 && align == 3 * fx->channels)
+                fx->fmt = MSM261_FMT_S24_3;
+            else if (bits == 24)
+                fx->fmt = MSM261_FMT_S24;
+            else if (bits == 32)
+                fx->fmt = MSM261_FMT_S32;
+            else
+                die("unsupported WAV sample size");
+            if (!fx->channels || fx->channels > MSM261_CHANNELS_MAX)
+                die("unsupported WAV channel count");
+
+            fx->frames = len / frame_bytes(fx);
+            fx->data = xmalloc(len);
+            memcpy(fx->data, c, len);
+            return;
+        }
+        pos += 8 + len + (len & 1);
+    }
+
+    die("no fmt/data chunk in WAV file");
+}
+
+static void load_fixture(struct fixture *fx, const char *path)
+{
+    size_t size;
+    u8 *buf = read_file(path, &size);
+
+    fx->name = path;
+    if (size >= 12 && !memcmp(buf, "RIFF", 4) && !memcmp(buf + 8, "WAVE", 4)) {
+        load_wav(fx, buf, size);
+        free(buf);
+    } else {
+        /* raw: формат, канали і частота - з командного рядка */
+        fx->frames = size / frame_bytes(fx);
+        fx->data = buf;
+    }
+}
+
+static u32 xorshift(u32 *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+/* Широкосмуговий шум, що приходить на кільце з напрямку angle, плюс некорельований шум */
+static void synth_fixture(struct fixture *fx, unsigned int frames, unsigned int angle)
+{
+    const unsigned int pad = 64;
+    s32 *src = xmalloc((frames + pad) * sizeof(*src));
+    int delay[NUM_MICS];
+    u32 seed = 0x2545f491;
+    unsigned int n, m;
+    u8 *out;
+
+    for (m = 0; m < NUM_MICS; m++) {
+        double proj = 0;
+
+        /* мікрофон ближче до джерела чує його раніше */
+        if (m != MSM261_CENTER_MIC)
+            proj = MSM261_ARRAY_RADIUS_UM *
+                   cos(((int)angle - (int)m * MSM261_RING_STEP_DEG) * M_PI / 180);
+        delay[m] = pad / 2 - lround(proj * fx->rate / MSM261_SPEED_OF_SOUND_UM);
+    }
+
+    for (n = 0; n < frames + pad; n++)
+        src[n] = (s32)xorshift(&seed) >> 3;
+
+    fx->name = "synthetic";
+    fx->frames = frames;
+    fx->data = xmalloc(frames * frame_bytes(fx));
+    out = fx->data;
+
+    for (n = 0; n < frames; n++) {
+        for (m = 0; m < fx->channels; m++, out += fmt_bytes[fx->fmt]) {
+            s32 v = 0;
+
+            if (m < NUM_MICS)
+                v = src[n + pad - delay[m]] + ((s32)xorshift(&seed) >> 6);
+
+            switch (fx->fmt) {
+            case MSM261_FMT_S16:
+                *(s16 *)out = v >> 16;
+                break;
+            case MSM261_FMT_S24:
+                *(s32 *)out = v >> 8;
+                break;
+            case MSM261_FMT_S24_3:
+                out[0] = v >> 8;
+                out[1] = v >> 16;
+                out[2] = v >> 24;
+                break;
+            default:
+                *(s32 *)out = v;
+                break;
+            }
+        }
+    }
+
+    free(src);
+}
+
+/* 7 каналів мікрофонів -> 8, щоб у кадрі був слот для променя */
+static void widen_for_beam(struct fixture *fx)
+{
+    size_t in = frame_bytes(fx), out;
+    const u8 *src = fx->data;
+    unsigned int n;
+    u8 *dst;
+
+    if (fx->channels != NUM_MICS)
+        die("-b needs a 7-channel fixture");
+
+    fx->channels = MSM261_CHANNELS_MAX;
+    out = frame_bytes(fx);
+    dst = xmalloc(fx->frames * out);
+    for (n = 0; n < fx->frames; n++)
+        memcpy(dst + n * out, src + n * in, in);
+
+    free(fx->data);
+    fx->data = dst;
+}
+
+static int perf_open(u64 config)
+{
+    struct perf_event_attr attr = {
+        .type = PERF_TYPE_HARDWARE,
+        .size = sizeof(attr),
+        .config = config,
+        .disabled = 1,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+    };
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static bool perf_read(int fd, u64 *val)
+{
+    return fd >= 0 && read(fd, val, sizeof(*val)) == sizeof(*val);
+}
+
+static u64 now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Проганяє fn по фікстурі періодами, як msm261_pcm_copy(), passes разів; нс/кадр */
+static double run(struct bench *b, const char *name, bench_fn fn)
+{
+    const struct fixture *fx = b->fx;
+    size_t fbytes = frame_bytes(fx);
+    u8 *dst = xmalloc(b->period * fbytes);
+    int fd_miss = perf_open(PERF_COUNT_HW_CACHE_MISSES);
+    int fd_ref = perf_open(PERF_COUNT_HW_CACHE_REFERENCES);
+    u64 start, ns, frames = 0, misses, refs;
+    unsigned int pass, n;
+    double ns_frame;
+
+    if (fd_miss >= 0) {
+        ioctl(fd_miss, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd_miss, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    if (fd_ref >= 0) {
+        ioctl(fd_ref, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd_ref, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    start = now_ns();
+    for (pass = 0; pass < b->passes; pass++) {
+        for (n = 0; n < fx->frames; n += b->period) {
+            unsigned int chunk = min_t(unsigned int, b->period, fx->frames - n);
+
+            b->pos = n;
+            fn(b, dst, (const u8 *)fx->data + n * fbytes, chunk);
+            frames += chunk;
+        }
+    }
+    ns = now_ns() - start;
+
+    if (fd_miss >= 0)
+        ioctl(fd_miss, PERF_EVENT_IOC_DISABLE, 0);
+    if (fd_ref >= 0)
+        ioctl(fd_ref, PERF_EVENT_IOC_DISABLE, 0);
+
+    ns_frame = frames ? (double)ns / frames : 0;
+    printf("  %-14s %9.2f ns/frame %9.1f MB/s %8.1fx realtime",
+           name, ns_frame, ns ? frames * fbytes * 1e3 / ns : 0,
+           ns_frame ? 1e9 / ns_frame / fx->rate : 0);
+    if (perf_read(fd_miss, &misses) && perf_read(fd_ref, &refs))
+        printf("  cache-misses %.3f/frame (%.1f%% of refs)",
+               (double)misses / frames, refs ? 100.0 * misses / refs : 0);
+    else
+        printf("  cache-misses n/a");
+    printf("\n");
+
+    if (fd_miss >= 0)
+        close(fd_miss);
+    if (fd_ref >= 0)
+        close(fd_ref);
+    free(dst);
+    return ns_frame;
+}
+
+/* Базова лінія: копія як є, що робить copy_to_iter() без обробки */
+static void bench_copy(struct bench *b, void *dst, const void *src, unsigned int frames)
+{
+    memcpy(dst, src, frames * frame_bytes(b->fx));
+}
+
+static void bench_gain(struct bench *b, void *dst, const void *src, unsigned int frames)
+{
+    unsigned int samples = frames * b->fx->channels;
+    int gain = b->params.software_gain;
+
+    if (b->ops->needs_fpu)
+        msm261_dsp_fpu_begin();
+    switch (b->fx->fmt) {
+    case MSM261_FMT_S16:
+        b->ops->s16(dst, src, samples, gain);
+        break;
+    case MSM261_FMT_S24:
+        b->ops->s24(dst, src, samples, gain);
+        break;
+    default:
+        b->ops->s32(dst, src, samples, gain);
+        break;
+    }
+    if (b->ops->needs_fpu)
+        msm261_dsp_fpu_end();
+}
+
+static void bench_process(struct bench *b, void *dst, const void *src, unsigned int frames)
+{
+    b->process(&b->dsp, &b->params, dst, src, frames);
+}
+
+/* Фікстура, розкладена назад на L/R потоки ліній, як їх дає залізо */
+static void split_lines(struct bench *b)
+{
+    const struct fixture *fx = b->fx;
+    const unsigned int size = fmt_bytes[fx->fmt];
+    const u8 *src = fx->data;
+    unsigned int l, n, m;
+
+    for (l = 0; l < NUM_DATA_LINES; l++)
+        b->lines[l] = xmalloc((size_t)fx->frames * MSM261_SLOTS_PER_LINE * size);
+
+    for (n = 0; n < fx->frames; n++) {
+        for (m = 0; m < fx->channels && m < NUM_MICS; m++) {
+            unsigned int slot = b->dsp.slot_map[b->dsp.chan_mic[m]];
+            u8 *dst = (u8 *)b->lines[slot / MSM261_SLOTS_PER_LINE] +
+                      ((size_t)n * MSM261_SLOTS_PER_LINE + slot % MSM261_SLOTS_PER_LINE) * size;
+
+            memcpy(dst, src + (n * fx->channels + m) * size, size);
+        }
+    }
+}
+
+static void bench_demux(struct bench *b, void *dst, const void *src, unsigned int frames)
+{
+    const unsigned int size = fmt_bytes[b->fx->fmt];
+    const void *lines[NUM_DATA_LINES];
+    unsigned int l;
+
+    for (l = 0; l < NUM_DATA_LINES; l++)
+        lines[l] = (const u8 *)b->lines[l] + (size_t)b->pos * MSM261_SLOTS_PER_LINE * size;
+
+    msm261_demux(&b->dsp, dst, lines, MSM261_SLOTS_PER_LINE, frames,
+                 b->fx->fmt, b->fx->channels);
+}
+
+/* Фікстура, як її кладе DMA I2S: слоти підряд, мікрофон - у своєму слоті */
+static void split_dma(struct bench *b)
+{
+    const struct fixture *fx = b->fx;
+    const unsigned int size = fmt_bytes[fx->fmt];
+    const u8 *src = fx->data;
+    unsigned int n, m;
+    u8 *dst;
+
+    dst = b->dma = xmalloc((size_t)fx->frames * frame_bytes(fx));
+    memset(dst, 0, (size_t)fx->frames * frame_bytes(fx));
+
+    for (n = 0; n < fx->frames; n++) {
+        for (m = 0; m < fx->channels && m < NUM_MICS; m++) {
+            unsigned int slot = b->dsp.slot_map[b->dsp.chan_mic[m]];
+
+            memcpy(dst + (n * fx->channels + slot) * size,
+                   src + (n * fx->channels + m) * size, size);
+        }
+    }
+}
+
+static void bench_demux_dma(struct bench *b, void *dst, const void *src, unsigned int frames)
+{
+    const struct fixture *fx = b->fx;
+
+    msm261_demux_dma(&b->dsp, dst, (const u8 *)b->dma + (size_t)b->pos * frame_bytes(fx),
+                     fx->channels, frames, fx->fmt, fx->channels);
+}
+
+/* Демультиплексор має відтворити фікстуру: мікрофони на місці, решта - нулі */
+static bool check_demux(struct bench *b, bench_fn fn)
+{
+    const struct fixture *fx = b->fx;
+    size_t bytes = (size_t)fx->frames * frame_bytes(fx);
+    u8 *out = xmalloc(bytes), *ref = xmalloc(bytes);
+    const unsigned int size = fmt_bytes[fx->fmt];
+    unsigned int n, m;
+    bool ok;
+
+    memcpy(ref, fx->data, bytes);
+    for (n = 0; n < fx->frames; n++)
+        for (m = NUM_MICS; m < fx->channels; m++)
+            memset(ref + (n * fx->channels + m) * size, 0, size);
+
+    b->pos = 0;
+    fn(b, out, NULL, fx->frames);
+    ok = !memcmp(out, ref, bytes);
+
+    free(out);
+    free(ref);
+    return ok;
+}
+
+/*
+ * Еталон для обробки з фіксованим підсиленням: семпл у власних одиницях
+ * формату, добуток у 64 бітах, насичення на межах формату. Старший байт
+ * контейнера S24 на вході - сміття, на виході не перевіряється.
+ */
+static s64 ref_max(int fmt)
+{
+    return fmt == MSM261_FMT_S16 ? INT16_MAX :
+           fmt == MSM261_FMT_S32 ? INT32_MAX : MSM261_S24_MAX;
+}
+
+static void ref_put(void *buf, unsigned int idx, int fmt, s64 v, u8 junk)
+{
+    u8 *p = (u8 *)buf + idx * fmt_bytes[fmt];
+
+    switch (fmt) {
+    case MSM261_FMT_S16:
+        *(s16 *)p = v;
+        break;
+    case MSM261_FMT_S24:
+        *(u32 *)p = ((u32)v & 0xffffff) | (u32)junk << 24;
+        break;
+    case MSM261_FMT_S24_3:
+        p[0] = v;
+        p[1] = v >> 8;
+        p[2] = v >> 16;
+        break;
+    default:
+        *(s32 *)p = v;
+        break;
+    }
+}
+
+static s64 ref_get(const void *buf, unsigned int idx, int fmt)
+{
+    const u8 *p = (const u8 *)buf + idx * fmt_bytes[fmt];
+
+    switch (fmt) {
+    case MSM261_FMT_S16:
+        return *(const s16 *)p;
+    case MSM261_FMT_S24:
+        return (s32)(*(const u32 *)p << 8) >> 8;
+    case MSM261_FMT_S24_3:
+        return (s32)((p[0] << 8) | (p[1] << 16) | ((u32)p[2] << 24)) >> 8;
+    default:
+        return *(const s32 *)p;
+    }
+}
+
+/*
+ * Кожна пара (формат, канали) з таблиці обробки проти еталона: межі формату,
+ * пороги насичення для кожного підсилення і шум, на довжині, не кратній
+ * ширині вектора. Канал променя рахує свій тест, тут він пропускається.
+ */
+static bool check_process(void)
+{
+    static const int gains[] = { 0, 1, 2, 3, 5, 7, 100 };
+    enum { FRAMES = 37 };
+    u8 in[FRAMES * MSM261_CHANNELS_MAX * 4], out[sizeof(in)];
+    struct msm261_params params;
+    struct msm261_dsp dsp;
+    unsigned int ch, g, i, cases = 0;
+    u32 seed = 0x1234567;
+    int fmt;
+
+    msm261_dsp_init(&dsp);
+    msm261_params_init(&params);
+    params.agc_enabled = false;
+    params.doa_enabled = false;
+    msm261_beam_build(&dsp.beam, 48000, &params);
+
+    for (fmt = 0; fmt < MSM261_FMT_COUNT; fmt++) {
+        s64 hi = ref_max(fmt), lo = -hi - 1;
+        unsigned int shift = fmt == MSM261_FMT_S16 ? 16 : fmt == MSM261_FMT_S32 ? 0 : 8;
+
+        for (ch = 1; ch <= MSM261_CHANNELS_MAX; ch++) {
+            msm261_process_fn process = msm261_dsp_process_lookup(fmt, ch);
+
+            for (g = 0; g < ARRAY_SIZE(gains); g++) {
+                int gain = gains[g];
+                s64 q = gain ? hi / gain : hi;
+                const s64 edges[] = { hi, lo, 0, 1, -1, q - 1, q, q + 1,
+                                      -q - 1, -q, -q + 1, lo / (gain ? gain : 1) };
+
+                for (i = 0; i < FRAMES * ch; i++) {
+                    s64 v = i & 1 ? edges[i / 2 % ARRAY_SIZE(edges)] :
+                                    (s32)xorshift(&seed) >> shift;
+
+                    ref_put(in, i, fmt, v, xorshift(&seed));
+                }
+
+                params.software_gain = gain;
+                process(&dsp, &params, out, in, FRAMES);
+                cases++;
+
+                for (i = 0; i < FRAMES * ch; i++) {
+                    s64 want = clamp_t(s64, ref_get(in, i, fmt) * gain, lo, hi);
+
+                    if (ch == MSM261_CHANNELS_MAX && i % ch == MSM261_BEAM_CHANNEL)
+                        continue;
+                    if (ref_get(out, i, fmt) != want) {
+                        printf("  process: %s, %u ch, gain %d: frame %u ch %u is %lld, "
+                               "want %lld\n", fmt_names[fmt], ch, gain, i / ch, i % ch,
+                               (long long)ref_get(out, i, fmt), (long long)want);
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+
+    printf("  process: %u format/channel/gain cases match the reference\n", cases);
+    return true;
+}
+
+/* Енергія каналу ch з другої половини кадрів S32 */
+static double channel_energy(const s32 *buf, unsigned int frames, unsigned int channels,
+                             unsigned int ch)
+{
+    double e = 0;
+    unsigned int n;
+
+    for (n = frames / 2; n < frames; n++)
+        e += (double)buf[n * channels + ch] * buf[n * channels + ch];
+    return e;
+}
+
+/*
+ * Промінь на кадрах DMA: плоска хвиля з angle градусів за геометрією плати
+ * кладеться в слоти I2S, проходить msm261_demux_dma() і 8-канальну обробку.
+ * Повертає рівень каналу променя відносно центрального мікрофона, дБ, з
+ * променем на steer градусів.
+ */
+static double beam_level_db(int angle, int steer, double freq)
+{
+    enum { FRAMES = 4800, RATE = 48000 };
+    const unsigned int ch = MSM261_CHANNELS_MAX;
+    s32 *dma = xmalloc(FRAMES * ch * sizeof(s32));
+    s32 *in = xmalloc(FRAMES * ch * sizeof(s32)), *out = xmalloc(FRAMES * ch * sizeof(s32));
+    struct msm261_params params;
+    struct msm261_dsp dsp;
+    unsigned int n, m;
+    double db;
+
+    msm261_dsp_init(&dsp);
+    msm261_params_init(&params);
+    params.agc_enabled = false;
+    params.doa_enabled = false;
+    params.beam_dir = steer / MSM261_BEAM_STEP_DEG % MSM261_BEAM_DIRECTIONS;
+    msm261_beam_build(&dsp.beam, RATE, &params);
+
+    memset(dma, 0, FRAMES * ch * sizeof(s32));
+    for (n = 0; n < FRAMES; n++) {
+        for (m = 0; m < NUM_MICS; m++) {
+            double lead = 0;
+
+            if (m != MSM261_CENTER_MIC)
+                lead = MSM261_ARRAY_RADIUS_UM / (double)MSM261_SPEED_OF_SOUND_UM *
+                       cos((angle - (int)m * MSM261_RING_STEP_DEG) * M_PI / 180);
+            dma[n * ch + dsp.slot_map[m]] =
+                lround(0x10000000 * sin(2 * M_PI * freq * ((double)n / RATE + lead)));
+        }
+    }
+
+    msm261_demux_dma(&dsp, in, dma, ch, FRAMES, MSM261_FMT_S32, ch);
+    msm261_dsp_process_lookup(MSM261_FMT_S32, ch)(&dsp, &params, out, in, FRAMES);
+    db = 10 * log10(channel_energy(out, FRAMES, ch, MSM261_BEAM_CHANNEL) /
+                    channel_energy(out, FRAMES, ch, MSM261_CENTER_MIC));
+
+    free(dma);
+    free(in);
+    free(out);
+    return db;
+}
+
+/*
+ * Промінь на джерело зберігає рівень, від нього - послаблює; кадри DMA в
+ * порядку слотів, тож перевіряється і те, що затримки дістаються своїм
+ * мікрофонам.
+ */
+static bool check_beam(void)
+{
+    double on = beam_level_db(60, 60, 3000), off = beam_level_db(60, 240, 3000);
+    bool ok = on > -1 && on - off > 6;
+
+    printf("  beam: 3 kHz from 60 deg, %.1f dB steered at it, %.1f dB at 240 deg%s\n",
+           on, off, ok ? "" : " - FAILED");
+    return ok;
+}
+
+/* Робота драйвера: щоразу над останнім вікном, яке поклала обробка */
+static void bench_doa_update(struct msm261_doa *doa, unsigned int updates)
+{
+    u64 start, ns;
+    unsigned int i;
+
+    start = now_ns();
+    for (i = 0; i < updates; i++) {
+        doa->pending = true;
+        msm261_doa_update(doa);
+    }
+    ns = now_ns() - start;
+
+    printf("  %-14s %9.1f us/update\n", "doa update", ns / 1e3 / updates);
+}
+
+/*
+ * Напрямок синтетичної фікстури відомий (angle), тож оцінка має влучити в
+ * нього з точністю до двох кроків сітки. Для записаної фікстури напрямок
+ * лише друкується.
+ */
+static bool check_doa(const struct msm261_doa *doa, int angle)
+{
+    int err = ((int)doa->azimuth - angle + 540) % 360 - 180;
+    bool ok = angle < 0 || (abs(err) <= 2 * MSM261_BEAM_STEP_DEG && doa->confidence);
+
+    printf("  doa azimuth %u deg, confidence %u", doa->azimuth, doa->confidence);
+    if (angle >= 0)
+        printf(", source at %d deg%s", angle, ok ? "" : " - FAILED");
+    printf("\n");
+    return ok;
+}
+
+/* ns/кадр входу: децимація стоїть перед рештою обробки на частоті масиву */
+static void bench_decim(struct bench *b, void *dst, const void *src, unsigned int frames)
+{
+    msm261_decim(&b->decim, dst, src, frames, b->fx->fmt, b->fx->channels);
+}
+
+/* Рівень тону на виході децимації відносно входу, дБ */
+static double decim_gain_db(unsigned int ratio, double freq, unsigned int rate)
+{
+    static struct msm261_decim decim;
+    const unsigned int frames = rate;
+    s32 *in = xmalloc(frames * sizeof(*in)), *out = xmalloc(frames * sizeof(*out));
+    double e_in = 0, e_out = 0;
+    unsigned int n, outs;
+
+    for (n = 0; n < frames; n++)
+        in[n] = lround(0x40000000 * sin(2 * M_PI * freq * n / rate));
+
+    msm261_decim_setup(&decim, ratio);
+    outs = msm261_decim(&decim, out, in, frames, MSM261_FMT_S32, 1);
+
+    /* Друга половина: без перехідного процесу фільтра */
+    for (n = frames / 2; n < frames; n++)
+        e_in += (double)in[n] * in[n];
+    for (n = outs / 2; n < outs; n++)
+        e_out += (double)out[n] * out[n];
+
+    free(in);
+    free(out);
+    return 10 * log10(e_out * ratio / e_in);
+}
+
+/* Смуга пропускання не нижче -0.5 дБ, дзеркало - не вище -60 дБ */
+static bool check_decim(unsigned int ratio, unsigned int rate)
+{
+    double nyq = rate / ratio / 2.0;
+    /* 0.8 вихідної Найквіста - край смуги; дзеркало відносно неї згортається туди ж */
+    double pass = decim_gain_db(ratio, 0.8 * nyq, rate);
+    double alias = decim_gain_db(ratio, 2 * nyq - 0.8 * nyq, rate);
+    bool ok = pass > -0.5 && alias < -60;
+
+    printf("  decim %u:1 -> %u Hz: passband %.2f dB, alias %.1f dB%s\n", ratio, rate / ratio,
+           pass, alias, ok ? "" : " - FAILED");
+    return ok;
+}
+
+/* ns/кадр одного каналу: енергія блоками і рішення VAD */
+static void bench_vad(struct bench *b, void *dst, const void *src, unsigned int frames)
+{
+    msm261_vad_feed(&b->dsp.vad, src, b->fx->fmt, b->fx->channels, 0, frames);
+}
+
+static void bench_health(struct bench *b, void *dst, const void *src, unsigned int frames)
+{
+    msm261_health_feed(&b->dsp.health, b->dsp.chan_mic, src, b->fx->fmt, b->fx->channels,
+                       min_t(unsigned int, b->fx->channels, NUM_MICS), frames);
+}
+
+/*
+ * Детектори з вмиканням і вимиканням. Фікстура - шум, на [from_ms, to_ms)
+ * до нього додається подія; подається блоками по 10 мс, як періоди драйвера.
+ * Перевіряється, коли детектор спрацював і коли відпустив.
+ */
+struct onoff_state {
+    struct msm261_vad vad;
+    struct msm261_health health;
+};
+
+struct onoff_check {
+    const char *name;
+    const char *event;
+    unsigned int channels;
+    unsigned int len_ms;
+    unsigned int from_ms, to_ms;
+    int on_min, on_max;         /* очікуване спрацювання, мс */
+    int off_min, off_max;       /* і відпускання */
+    u32 seed;
+    /* Семпл мікрофона m у кадрі n; event - кадр усередині події */
+    s32 (*sample)(unsigned int n, unsigned int m, bool event, unsigned int rate, u32 *seed);
+    void (*setup)(struct onoff_state *st, unsigned int rate);
+    /* 1 - увімкнувся, 0 - вимкнувся, -1 - рішення не змінилося */
+    int (*feed)(struct onoff_state *st, const s32 *in, unsigned int frames);
+};
+
+/* Шум -70 дБFS, подія - тон 1 кГц -20 дБFS */
+static s32 vad_sample(unsigned int n, unsigned int m, bool event, unsigned int rate, u32 *seed)
+{
+    s32 v = (s32)xorshift(seed) >> 11;
+
+    if (event)
+        v += lround(0x0ccccccc * sin(2 * M_PI * 1000.0 * n / rate));
+    return v;
+}
+
+static void vad_setup(struct onoff_state *st, unsigned int rate)
+{
+    msm261_vad_setup(&st->vad, rate);
+}
+
+static int vad_feed(struct onoff_state *st, const s32 *in, unsigned int frames)
+{
+    if (!msm261_vad_feed(&st->vad, in, MSM261_FMT_S32, 1, 0, frames))
+        return -1;
+    return st->vad.speech;
+}
+
+#define HEALTH_FAULTY   (BIT(1) | BIT(3) | BIT(5))
+
+/* Шум -30 дБFS; під час події MIC2 застиг, MIC4 має DC -6 дБFS, MIC6 мовчить */
+static s32 health_sample(unsigned int n, unsigned int m, bool event, unsigned int rate,
+                         u32 *seed)
+{
+    s32 v = (s32)xorshift(seed) >> 5;
+
+    if (event && m == 1)
+        return 0x01234500;
+    if (event && m == 3)
+        return v / 2 + 0x40000000;
+    if (event && m == 5)
+        return 0;
+    return v;
+}
+
+static void health_setup(struct onoff_state *st, unsigned int rate)
+{
+    memset(&st->health, 0, sizeof(st->health));
+    msm261_health_setup(&st->health, rate);
+}
+
+static int health_feed(struct onoff_state *st, const s32 *in, unsigned int frames)
+{
+    static const u8 chan_mic[NUM_MICS] = { 0, 1, 2, 3, 4, 5, 6 };
+
+    if (!msm261_health_feed(&st->health, chan_mic, in, MSM261_FMT_S32,
+                            NUM_MICS, NUM_MICS, frames))
+        return -1;
+    if (st->health.bad == HEALTH_FAULTY)
+        return 1;
+    return st->health.bad ? -1 : 0;
+}
+
+static const struct onoff_check onoff_checks[] = {
+    /* Початок за 2 блоки, кінець - після утримання */
+    {
+        .name = "vad", .event = "speech", .channels = 1,
+        .len_ms = 2000, .from_ms = 500, .to_ms = 1000,
+        .on_min = 500, .on_max = 550, .off_min = 1000, .off_max = 1350,
+        .seed = 1, .sample = vad_sample, .setup = vad_setup, .feed = vad_feed,
+    },
+    /* 3 блоки монітора по 100 мс до вади і 20 блоків після неї */
+    {
+        .name = "health", .event = "faults on MIC2/4/6", .channels = NUM_MICS,
+        .len_ms = 4000, .from_ms = 0, .to_ms = 1000,
+        .on_min = 300, .on_max = 300, .off_min = 3000, .off_max = 3000,
+        .seed = 3, .sample = health_sample, .setup = health_setup, .feed = health_feed,
+    },
+};
+
+static bool check_onoff(const struct onoff_check *c, unsigned int rate)
+{
+    static struct onoff_state st;
+    const unsigned int frames = (u64)c->len_ms * rate / 1000, block = rate / 100;
+    const unsigned int from = (u64)c->from_ms * rate / 1000, to = (u64)c->to_ms * rate / 1000;
+    s32 *in = xmalloc((size_t)frames * c->channels * sizeof(*in));
+    int on = -1, off = -1, state;
+    unsigned int n, m;
+    u32 seed = c->seed;
+    bool ok;
+
+    for (n = 0; n < frames; n++)
+        for (m = 0; m < c->channels; m++)
+            in[n * c->channels + m] = c->sample(n, m, n >= from && n < to, rate, &seed);
+
+    c->setup(&st, rate);
+    for (n = 0; n + block <= frames; n += block) {
+        state = c->feed(&st, in + n * c->channels, block);
+        if (state > 0 && on < 0)
+            on = (n + block) * 1000 / rate;
+        else if (!state)
+            off = (n + block) * 1000 / rate;
+    }
+
+    ok = on >= c->on_min && on <= c->on_max && off >= c->off_min && off <= c->off_max;
+    printf("  %s: %s at %u-%u ms detected at %d-%d ms%s\n", c->name, c->event,
+           c->from_ms, c->to_ms, on, off, ok ? "" : " - FAILED");
+    free(in);
+    return ok;
+}
+
+static double peak_dbfs(const s32 *x, unsigned int n)
+{
+    s64 peak = 1;
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+        if (llabs((s64)x[i]) > peak)
+            peak = llabs((s64)x[i]);
+    return 20 * log10(peak / 2147483648.0);
+}
+
+/*
+ * AGC на одному каналі: 1 с тону -40 дБFS, потім 1 с тону -3 дБFS. Обидва
+ * мають вийти в межах 1.5 дБ від цілі. Стрибок рівня м'який обмежувач тримає
+ * біля повної шкали лише до першої межі блоку AGC, тож на ній - не більше
+ * двох блоків семплів.
+ */
+static bool check_agc(const struct msm261_params *params, unsigned int rate)
+{
+    static struct msm261_dsp dsp;
+    const unsigned int frames = 2 * rate, tail = rate / 10;
+    msm261_process_fn process = msm261_dsp_process_lookup(MSM261_FMT_S32, 1);
+    s32 *in = xmalloc(frames * sizeof(*in));
+    s32 *out = xmalloc(frames * sizeof(*out));
+    struct msm261_params p = *params;
+    unsigned int n, clipped = 0;
+    double quiet, loud;
+    bool ok;
+
+    for (n = 0; n < frames; n++)
+        in[n] = lround((n < rate ? 0.01 : 0.708) * 2147483647.0 *
+                       sin(2 * M_PI * 1000.0 * n / rate));
+
+    msm261_dsp_init(&dsp);
+    p.agc_enabled = true;
+    p.doa_enabled = false;
+    p.hpf_enabled = false;
+    for (n = 0; n < frames; n += 256)
+        process(&dsp, &p, out + n, in + n, min_t(unsigned int, 256, frames - n));
+
+    for (n = 0; n < frames; n++)
+        clipped += out[n] >= S32_MAX || out[n] <= -S32_MAX;
+    quiet = peak_dbfs(out + rate - tail, tail);
+    loud = peak_dbfs(out + frames - tail, tail);
+    ok = fabs(quiet - p.agc_target_db) < 1.5 && fabs(loud - p.agc_target_db) < 1.5 &&
+         clipped <= 2 * MSM261_AGC_BLOCK;
+
+    printf("  agc: target %d dBFS, max gain %u dB: -40 dBFS -> %.1f, -3 dBFS -> %.1f, "
+           "%u samples at full scale%s\n", p.agc_target_db, p.agc_max_db, quiet, loud,
+           clipped, ok ? "" : " - FAILED");
+    free(in);
+    free(out);
+    return ok;
+}
+
+/*
+ * Оцінка дрейфу: масив спішить на 50 ppm, точки - на кожному 10-мс
+ * спрацюванні таймера з тремтінням до 100 мкс, 30 с.
+ */
+static bool check_drift(unsigned int rate)
+{
+    struct msm261_drift drift;
+    u32 seed = 7;
+    u64 t;
+    bool ok;
+
+    msm261_drift_reset(&drift, rate);
+    for (t = 0; t <= 30 * NSEC_PER_SEC; t += 10000000) {
+        u64 ns = t + xorshift(&seed) % 100000;
+
+        msm261_drift_feed(&drift, (u64)((double)ns * rate * 1.00005 / NSEC_PER_SEC), ns);
+    }
+
+    /* Тремтіння таймера дає похибку в кілька тисяч ppb */
+    ok = drift.ppb >= 40000 && drift.ppb <= 60000;
+    printf("  drift: +50000 ppb estimated %d ppb%s\n", drift.ppb, ok ? "" : " - FAILED");
+    return ok;
+}
+
+/*
+ * Рішення драйвера при відкритті споживача, ті самі, що в msm261_hw_claim(),
+ * msm261_stream_check() і обмеженнях open: режим за BCLK, частоти і канали,
+ * які можна взяти, і чому споживача не пускають до масиву.
+ */
+static bool check_link(void)
+{
+    static const struct {
+        unsigned int rate;
+        int mode;
+    } modes[] = {
+        { 48000, MSM261_MODE_NORMAL },      /* 3.072 МГц */
+        { 44100, MSM261_MODE_NORMAL },
+        { 16000, MSM261_MODE_NORMAL },      /* 1.024 МГц */
+        { 12000, MSM261_MODE_LOW_POWER },   /* 768 кГц */
+        { 8000, MSM261_MODE_LOW_POWER },    /* 512 кГц */
+        { 14000, -EINVAL },                 /* 896 кГц, між діапазонами */
+        { 96000, -EINVAL },
+        { 2000, -EINVAL },
+    };
+    static const struct {
+        unsigned int native;
+        bool decimate;
+        unsigned int count;
+        unsigned int rates[MSM261_RATES_MAX];
+    } lists[] = {
+        { 48000, true, 2, { 16000, 48000 } },
+        { 44100, true, 2, { 22050, 44100 } },
+        { 32000, true, 1, { 32000 } },
+        { 48000, false, 1, { 48000 } },
+    };
+    static const struct {
+        unsigned int mic_mask;
+        unsigned int channels;
+        bool beam;
+        bool line_data;
+        enum msm261_open_err err;
+        bool reorder;
+    } opens[] = {
+        { MSM261_MIC_MASK_ALL, MSM261_CHANNELS_MAX, false, true, MSM261_OPEN_OK, false },
+        { MSM261_MIC_MASK_ALL, 1, true, true, MSM261_OPEN_OK, false },
+        { 0x41, 2, false, true, MSM261_OPEN_OK, false },
+        { 0x41, 3, false, true, MSM261_OPEN_CHANNELS, false },
+        { 0x41, 1, true, true, MSM261_OPEN_CHANNELS, false },
+        /* Залізо: кадр DMA у порядку слотів типової карти */
+        { MSM261_MIC_MASK_ALL, NUM_MICS, false, false, MSM261_OPEN_OK, true },
+        { MSM261_MIC_MASK_ALL, 1, false, false, MSM261_OPEN_OK, false },
+        { MSM261_MIC_MASK_ALL, 2, false, false, MSM261_OPEN_SLOTS, false },   /* MIC2 у слоті 2 */
+        { 0x7e, 2, false, false, MSM261_OPEN_MASK, false },
+    };
+    static const struct {
+        bool group;
+        bool others;
+        bool with_group;
+        unsigned int mic_mask;
+        unsigned int rate;
+        unsigned int array_rate;
+        enum msm261_open_err err;
+    } shares[] = {
+        { false, false, false, 0x41, 44100, 48000, MSM261_OPEN_OK },
+        { false, true, false, 0x41, 48000, 48000, MSM261_OPEN_OK },
+        { false, true, false, MSM261_MIC_MASK_ALL, 44100, 48000, MSM261_OPEN_RATE },
+        { false, true, true, MSM261_MIC_MASK_ALL, 48000, 48000, MSM261_OPEN_BUSY },
+        { true, false, false, MSM261_MIC_MASK_ALL, 48000, 0, MSM261_OPEN_OK },
+        { true, true, false, MSM261_MIC_MASK_ALL, 48000, 48000, MSM261_OPEN_BUSY },
+        { true, false, false, 0x7e, 48000, 0, MSM261_OPEN_GROUP_MASK },
+    };
+    static const struct {
+        unsigned int mic_mask;
+        unsigned int avail;
+    } avails[] = {
+        { MSM261_MIC_MASK_ALL, MSM261_CHANNELS_MAX },   /* і промінь */
+        { 0x3f, 6 },
+        { 0x41, 2 },
+    };
+    static struct msm261_dsp dsp;
+    unsigned int rates[MSM261_RATES_MAX], i, n, cases = 0;
+    bool ok = true, reorder;
+    int mode;
+
+    for (i = 0; i < ARRAY_SIZE(modes); i++, cases++) {
+        mode = msm261_mode_for_bclk(msm261_link_bclk(modes[i].rate));
+        if (mode != modes[i].mode) {
+            printf("  link: %u Hz gives mode %d, expected %d\n",
+                   modes[i].rate, mode, modes[i].mode);
+            ok = false;
+        }
+    }
+    for (i = 0; i < ARRAY_SIZE(lists); i++, cases++) {
+        n = msm261_rate_list(lists[i].native, lists[i].decimate, rates);
+        if (n != lists[i].count || memcmp(rates, lists[i].rates, n * sizeof(*rates))) {
+            printf("  link: wrong rate list for a %u Hz array\n", lists[i].native);
+            ok = false;
+        }
+    }
+    for (i = 0; i < ARRAY_SIZE(lists); i++, cases++) {
+        if (lists[i].decimate && lists[i].count > 1 &&
+            msm261_decim_ratio_for(lists[i].rates[0]) * lists[i].rates[0] != lists[i].native) {
+            printf("  link: %u Hz is not decimated from %u Hz\n",
+                   lists[i].rates[0], lists[i].native);
+            ok = false;
+        }
+    }
+
+    msm261_dsp_init(&dsp);
+    for (i = 0; i < ARRAY_SIZE(opens); i++, cases++) {
+        enum msm261_open_err err;
+
+        msm261_dsp_select(&dsp, opens[i].mic_mask);
+        err = msm261_open_check(&dsp, opens[i].mic_mask, opens[i].channels, opens[i].beam,
+                                opens[i].line_data, &reorder);
+        if (err != opens[i].err || (!err && reorder != opens[i].reorder)) {
+            printf("  link: open of %u ch%s on mask 0x%02x%s gives %d, expected %d\n",
+                   opens[i].channels, opens[i].beam ? " beam" : "", opens[i].mic_mask,
+                   opens[i].line_data ? "" : " (hardware)", err, opens[i].err);
+            ok = false;
+        }
+    }
+    for (i = 0; i < ARRAY_SIZE(shares); i++, cases++) {
+        enum msm261_open_err err;
+
+        err = msm261_share_check(shares[i].group, shares[i].others, shares[i].with_group,
+                                 shares[i].mic_mask, shares[i].rate, shares[i].array_rate);
+        if (err != shares[i].err) {
+            printf("  link: %s claim case %u gives %d, expected %d\n",
+                   shares[i].group ? "group" : "stream", i, err, shares[i].err);
+            ok = false;
+        }
+    }
+    for (i = 0; i < ARRAY_SIZE(avails); i++, cases++) {
+        n = msm261_channels_avail(avails[i].mic_mask);
+        if (n != avails[i].avail) {
+            printf("  link: mask 0x%02x offers %u channels, expected %u\n",
+                   avails[i].mic_mask, n, avails[i].avail);
+            ok = false;
+        }
+    }
+
+    printf("  link: %u clock, rate, channel and claim cases%s\n", cases,
+           ok ? "" : " - FAILED");
+    return ok;
+}
+
+/*
+ * Зведення трьох масивів групи в один кадр, як у таймері симулятора: та сама
+ * фікстура за кожен масив, середній - відсутній (тиша на своєму місці).
+ */
+static bool bench_interleave(const struct fixture *fx, unsigned int period,
+                             unsigned int passes)
+{
+    const unsigned int arrays = 3, width = NUM_MICS * arrays;
+    s32 *dst = xmalloc((size_t)period * width * sizeof(s32));
+    const s32 *data = fx->data;
+    const s32 *src[3];
+    u64 start, ns, frames = 0;
+    unsigned int pass, n, chunk = 0, c;
+    bool ok = true;
+
+    start = now_ns();
+    for (pass = 0; pass < passes; pass++) {
+        for (n = 0; n < fx->frames; n += chunk) {
+            chunk = min_t(unsigned int, period, fx->frames - n);
+            src[0] = data + n * NUM_MICS;
+            src[1] = NULL;
+            src[2] = src[0];
+            msm261_interleave(dst, MSM261_FMT_S32, src, arrays, NUM_MICS, chunk);
+            frames += chunk;
+        }
+    }
+    ns = now_ns() - start;
+
+    /* Останній шматок: масиви на своїх місцях */
+    n -= chunk;
+    for (c = 0; c < chunk * width; c++) {
+        unsigned int a = c % width / NUM_MICS;
+        s32 ref = a == 1 ? 0 : data[(n + c / width) * NUM_MICS + c % NUM_MICS];
+
+        ok &= dst[c] == ref;
+    }
+
+    printf("  %-14s %9.2f ns/frame (%u arrays)%s\n", "interleave",
+           frames ? (double)ns / frames : 0, arrays,
+           ok ? "" : ", output does not match the arrays - FAILED");
+    free(dst);
+    return ok;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: msm261_bench [-f s16|s24|s24_3|s32] [-c channels] [-r rate]\n"
+            "                    [-p period_frames] [-g gain] [-n passes] [-a angle]\n"
+            "                    [-R 2|3] [-m mic_mask] [-T ns] [-b] [-A] [-C] [-D] [-H]\n"
+            "                    [fixture.wav|fixture.raw]\n"
+            "  exits with 1 if a reference check fails or -T is exceeded\n"
+            "  -R  also run the polyphase decimator at this ratio\n"
+            "  -m  capture only these mics (bit 0 = MIC1); the fixture channels\n"
+            "      are placed on their line slots and compacted back by demux\n"
+            "  -T  per-frame budget of the full processing path, ns\n"
+            "  -b  widen a 7-channel fixture to 8 channels to run the beamformer\n"
+            "  -A  enable AGC instead of the fixed gain set by -g\n"
+            "  -C  apply a sample per-mic calibration (gain and delay trims)\n"
+            "  -D  enable DOA; process then only snapshots its window, and the\n"
+            "      FFT update the driver runs in a work item is timed separately\n"
+            "  -H  enable the highpass biquad cascade\n"
+            "  -a  source direction of the synthetic fixture, degrees\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    struct fixture fx = { .fmt = MSM261_FMT_S32, .channels = NUM_MICS, .rate = 48000 };
+    struct bench b = { .fx = &fx, .period = 1024, .passes = 20 };
+    unsigned int angle = 60, ratio = 1, mic_mask = MSM261_MIC_MASK_ALL;
+    char name[32];
+    bool beam = false, doa = false, synthetic = false, simd = true, ok = true, reorder;
+    double budget = 0, process_ns;
+    int opt, i;
+
+    msm261_dsp_init(&b.dsp);
+    msm261_params_init(&b.params);
+    b.params.software_gain = 5;
+
+    while ((opt = getopt(argc, argv, "f:c:r:p:g:n:a:R:m:T:bACDHh")) != -1) {
+        switch (opt) {
+        case 'f':
+            fx.fmt = parse_fmt(optarg);
+            break;
+        case 'c':
+            fx.channels = atoi(optarg);
+            break;
+        case 'r':
+            fx.rate = atoi(optarg);
+            break;
+        case 'p':
+            b.period = atoi(optarg);
+            break;
+        case 'g':
+            b.params.software_gain = atoi(optarg);
+            break;
+        case 'n':
+            b.passes = atoi(optarg);
+            break;
+        case 'a':
+            angle = atoi(optarg) % 360;
+            break;
+        case 'R':
+            ratio = atoi(optarg);
+            if (!msm261_decim_setup(&b.decim, ratio))
+                usage();
+            break;
+        case 'm':
+            mic_mask = strtoul(optarg, NULL, 0);
+            break;
+        case 'T':
+            budget = atof(optarg);
+            break;
+        case 'b':
+            beam = true;
+            break;
+        case 'A':
+            b.params.agc_enabled = true;
+            break;
+        case 'C':
+            /* ±5% підсилення і до 2 семплів затримки - типовий розкид плат */
+            for (i = 0; i < NUM_MICS; i++) {
+                b.params.cal_gain[i] = MSM261_CAL_ONE + (i - NUM_MICS / 2) * 68;
+                b.params.cal_delay[i] = i % 3;
+            }
+            msm261_params_cal_check(&b.params);
+            break;
+        case 'D':
+            doa = true;
+            break;
+        case 'H':
+            b.params.hpf_enabled = true;
+            break;
+        default:
+            usage();
+        }
+    }
+
+    if (!fx.channels || fx.channels > MSM261_CHANNELS_MAX || !fx.rate ||
+        !b.period || !b.passes)
+        usage();
+    /* Як у драйвері: каналів не більше, ніж вибраних мікрофонів */
+    if (mic_mask != MSM261_MIC_MASK_ALL &&
+        (mic_mask > MSM261_MIC_MASK_ALL ||
+         msm261_dsp_select(&b.dsp, mic_mask) < fx.channels))
+        usage();
+
+    if (optind < argc)
+        load_fixture(&fx, argv[optind]);
+    else
+        synthetic = true;
+    if (synthetic)
+        synth_fixture(&fx, fx.rate * 2, angle);
+    if (beam)
+        widen_for_beam(&fx);
+    if (!fx.frames)
+        die("fixture has no frames");
+
+    printf("msm261_bench: %s, %s, %u ch, %u Hz, %u frames, period %u, ",
+           fx.name, fmt_names[fx.fmt], fx.channels, fx.rate, fx.frames, b.period);
+    if (b.params.agc_enabled)
+        printf("agc %d dBFS", b.params.agc_target_db);
+    else
+        printf("gain %d", b.params.software_gain);
+    printf("%s\n", b.params.hpf_enabled ? ", highpass" : "");
+    if (b.params.cal_active)
+        printf("  calibrated: per-mic gain and delay trims\n");
+    if (mic_mask != MSM261_MIC_MASK_ALL)
+        printf("  mic mask 0x%02x\n", mic_mask);
+
+    msm261_gain_select();
+#ifdef MSM261_DSP_SIMD
+    /* Час зламаного ядра нічого не значить, тож його й не міряємо */
+    if (!msm261_gain_selftest(&msm261_gain_simd)) {
+        printf("  %s gain kernels do not match scalar - FAILED\n", msm261_gain_simd.name);
+        simd = false;
+        ok = false;
+    }
+#endif
+    ok &= check_process();
+    ok &= check_beam();
+    ok &= check_link();
+
+    b.dsp.period_frames = b.period;
+    b.dsp.doa = xmalloc(sizeof(*b.dsp.doa));
+    b.params.doa_enabled = doa;
+    if (fx.channels == MSM261_CHANNELS_MAX)
+        msm261_beam_build(&b.dsp.beam, fx.rate, &b.params);
+    if (fx.channels >= NUM_MICS)
+        msm261_doa_build(b.dsp.doa, fx.rate, &b.params);
+    b.process = msm261_dsp_process_lookup(fx.fmt, fx.channels);
+
+    run(&b, "copy", bench_copy);
+
+    split_lines(&b);
+    if (!check_demux(&b, bench_demux)) {
+        printf("  demux output does not match the fixture\n");
+        ok = false;
+    }
+    run(&b, "demux", bench_demux);
+    /* Залізний режим: кадр DMA з channels слотів, якщо мікрофони в нього влазять */
+    if (msm261_demux_dma_valid(&b.dsp, fx.channels, fx.channels, &reorder)) {
+        split_dma(&b);
+        if (!check_demux(&b, bench_demux_dma)) {
+            printf("  DMA demux output does not match the fixture\n");
+            ok = false;
+        }
+        run(&b, reorder ? "demux dma" : "demux dma (id)", bench_demux_dma);
+    }
+    if (fx.fmt != MSM261_FMT_S24_3) {
+        b.ops = &msm261_gain_scalar;
+        run(&b, "gain scalar", bench_gain);
+#ifdef MSM261_DSP_SIMD
+        if (simd) {
+            b.ops = &msm261_gain_simd;
+            snprintf(name, sizeof(name), "gain %s", b.ops->name);
+            run(&b, name, bench_gain);
+        }
+#endif
+    }
+    process_ns = run(&b, "process", bench_process);
+    /* Поріг для регресій: повний шлях не дорожчий за бюджет на кадр */
+    if (budget && process_ns > budget) {
+        printf("  process %.2f ns/frame is over the %.2f ns budget\n", process_ns, budget);
+        ok = false;
+    }
+    if (ratio > 1) {
+        snprintf(name, sizeof(name), "decim %u:1", ratio);
+        run(&b, name, bench_decim);
+        ok &= check_decim(ratio, fx.rate);
+    }
+
+    msm261_vad_setup(&b.dsp.vad, fx.rate);
+    run(&b, "vad", bench_vad);
+    msm261_health_setup(&b.dsp.health, fx.rate);
+    run(&b, "health", bench_health);
+    if (b.dsp.health.bad)
+        printf("  health: fixture mics 0x%02x look faulty\n", b.dsp.health.bad);
+    for (i = 0; i < ARRAY_SIZE(onoff_checks); i++)
+        ok &= check_onoff(&onoff_checks[i], fx.rate);
+    ok &= check_agc(&b.params, fx.rate);
+    ok &= check_drift(fx.rate);
+    if (fx.fmt == MSM261_FMT_S32 && fx.channels == NUM_MICS)
+        ok &= bench_interleave(&fx, b.period, b.passes);
+
+    if (fx.channels >= NUM_MICS && doa) {
+        bench_doa_update(b.dsp.doa, 200);
+        ok &= check_doa(b.dsp.doa, synthetic ? angle : -1);
+    }
+
+    for (i = 0; i < NUM_DATA_LINES; i++)
+        free(b.lines[i]);
+    free(b.dma);
+    free(b.dsp.doa);
+    free(fx.data);
+    return ok ? 0 : 1;
+}
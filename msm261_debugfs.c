@@ -0,0 +1,185 @@
+/*
+ * debugfs: вартість гарячого шляху без dmesg.
+ *
+ * /sys/kernel/debug/<пристрій>/stats - сума per-CPU лічильників
+ * msm261_stats: періоди, кадри, байти, час copy/DSP з log2-гістограмою,
+ * максимум, xrun-и, а також тривалість hw_init (один раз у probe), останнього
+ * open, затримку від open до START, останній runtime resume і режим BCLK.
+ * Далі по рядку на споживача спільного потоку: стан, частота і його xrun-и.
+ * Рядок vad порівнює безперервне читання з читанням лише під час мови.
+ * По рядку на мікрофон - вердикт і вади останнього блоку монітора стану.
+ * Масив групи показує своє місце в ній, ведучий - ще й стан кожного масиву.
+ */
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include "msm261.h"
+
+struct msm261_stats_sum {
+    u64 periods, frames, bytes, ns, ns_max, xruns;
+    u64 vad_periods, vad_speech, vad_onsets;
+    u64 hist[MSM261_STATS_BUCKETS];
+};
+
+static void msm261_stats_sum(struct msm261_priv *msm261, struct msm261_stats_sum *sum)
+{
+    int cpu, i;
+
+    memset(sum, 0, sizeof(*sum));
+
+    for_each_possible_cpu(cpu) {
+        const struct msm261_stats *st = per_cpu_ptr(msm261->stats, cpu);
+        struct msm261_stats_sum s;
+        unsigned int start;
+
+        do {
+            start = u64_stats_fetch_begin(&st->syncp);
+            s.periods = u64_stats_read(&st->periods);
+            s.frames = u64_stats_read(&st->frames);
+            s.bytes = u64_stats_read(&st->bytes);
+            s.ns = u64_stats_read(&st->ns);
+            s.ns_max = u64_stats_read(&st->ns_max);
+            s.xruns = u64_stats_read(&st->xruns);
+            s.vad_periods = u64_stats_read(&st->vad_periods);
+            s.vad_speech = u64_stats_read(&st->vad_speech);
+            s.vad_onsets = u64_stats_read(&st->vad_onsets);
+            for (i = 0; i < MSM261_STATS_BUCKETS; i++)
+                s.hist[i] = u64_stats_read(&st->hist[i]);
+        } while (u64_stats_fetch_retry(&st->syncp, start));
+
+        sum->periods += s.periods;
+        sum->frames += s.frames;
+        sum->bytes += s.bytes;
+        sum->ns += s.ns;
+        sum->ns_max = max(sum->ns_max, s.ns_max);
+        sum->xruns += s.xruns;
+        sum->vad_periods += s.vad_periods;
+        sum->vad_speech += s.vad_speech;
+        sum->vad_onsets += s.vad_onsets;
+        for (i = 0; i < MSM261_STATS_BUCKETS; i++)
+            sum->hist[i] += s.hist[i];
+    }
+}
+
+static void msm261_mics_show(struct seq_file *m, struct msm261_priv *msm261)
+{
+    static const char * const faults[] = {
+        "silent", "stuck", "dc", "clipping", "level",
+    };
+    unsigned int i, f;
+
+    for (i = 0; i < NUM_MICS; i++) {
+        u8 mask = READ_ONCE(msm261->dsp.health.faults[i]);
+
+        seq_printf(m, "mic %u:       %s", i + 1,
+                   READ_ONCE(msm261->mic_status[i].error) ? "error" : "ok");
+        for (f = 0; f < ARRAY_SIZE(faults); f++)
+            if (mask & BIT(f))
+                seq_printf(m, ", %s", faults[f]);
+        seq_putc(m, '\n');
+    }
+}
+
+static int msm261_stats_show(struct seq_file *m, void *v)
+{
+    struct msm261_priv *msm261 = m->private;
+    struct msm261_stats_sum *sum;
+    u64 calls = 0;
+    int i;
+
+    sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+    if (!sum)
+        return -ENOMEM;
+
+    msm261_stats_sum(msm261, sum);
+    for (i = 0; i < MSM261_STATS_BUCKETS; i++)
+        calls += sum->hist[i];
+
+    seq_printf(m, "periods:     %llu\n", sum->periods);
+    seq_printf(m, "frames:      %llu\n", sum->frames);
+    seq_printf(m, "bytes:       %llu\n", sum->bytes);
+    seq_printf(m, "xruns:       %llu\n", sum->xruns);
+    seq_printf(m, "copy calls:  %llu\n", calls);
+    seq_printf(m, "copy ns:     %llu total, %llu max, %llu per period\n", sum->ns,
+               sum->ns_max, sum->periods ? div64_u64(sum->ns, sum->periods) : 0);
+    seq_printf(m, "hw_init ns:  %llu\n", READ_ONCE(msm261->hw_init_ns));
+    seq_printf(m, "open ns:     %llu\n", READ_ONCE(msm261->open_ns));
+    seq_printf(m, "start ns:    %llu\n", READ_ONCE(msm261->start_ns));
+    seq_printf(m, "resume ns:   %llu\n", READ_ONCE(msm261->resume_ns));
+    seq_printf(m, "mode:        %s, BCLK %u Hz\n",
+               msm261->operation_mode == MSM261_MODE_LOW_POWER ? "low power" : "normal",
+               msm261->bclk);
+    seq_printf(m, "array rate:  %u Hz\n", READ_ONCE(msm261->native_rate));
+    seq_printf(m, "clock drift: %d ppb\n", READ_ONCE(msm261->drift.ppb));
+    /* Читач, що чекає на VAD, прокидається на початку мови і читає лише її */
+    seq_printf(m, "vad:         %llu periods, %llu speech, %llu onsets, %lld wakeups saved\n",
+               sum->vad_periods, sum->vad_speech, sum->vad_onsets,
+               (s64)(sum->vad_periods - sum->vad_speech - sum->vad_onsets));
+    msm261_mics_show(m, msm261);
+
+    if (msm261->group) {
+        static const char * const health[] = {
+            [MSM261_ARRAY_MISSING] = "missing",
+            [MSM261_ARRAY_OK] = "ok",
+            [MSM261_ARRAY_MIC_ERROR] = "mic error",
+        };
+
+        seq_printf(m, "group:       %u, array %u of %u\n", msm261->group_id,
+                   msm261->array_index, msm261->array_count);
+        for (i = 0; msm261_group_leader(msm261) && i < msm261->array_count; i++)
+            seq_printf(m, "  array %d:   %s\n", i,
+                       health[msm261_group_health(msm261->group, i)]);
+    }
+
+    for (i = 0; i < MSM261_STREAMS; i++) {
+        struct msm261_stream *stream = &msm261->streams[i];
+
+        seq_printf(m, "stream %d:    %s, %u ch, decim %u, xruns %llu\n", i,
+                   test_bit(i, &msm261->streaming) ? "running" :
+                   test_bit(i, &msm261->hw_users) ? "set up" : "idle",
+                   stream->channels, stream->decim.ratio, READ_ONCE(stream->xruns));
+        /* Без замка таймера: для людини досить, ALSA бере узгоджену пару */
+        if (READ_ONCE(stream->period_raw_ns))
+            seq_printf(m, "  last period at frame %llu, raw %llu ns\n",
+                       READ_ONCE(stream->period_frames), READ_ONCE(stream->period_raw_ns));
+    }
+
+    seq_puts(m, "copy ns histogram:\n");
+    for (i = 0; i < MSM261_STATS_BUCKETS; i++) {
+        if (!sum->hist[i])
+            continue;
+        if (i == MSM261_STATS_BUCKETS - 1)
+            seq_printf(m, "  >= %-10llu %llu\n", 1ULL << i, sum->hist[i]);
+        else
+            seq_printf(m, "  <  %-10llu %llu\n", 2ULL << i, sum->hist[i]);
+    }
+
+    kfree(sum);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(msm261_stats);
+
+static void msm261_debugfs_remove(void *data)
+{
+    struct msm261_priv *msm261 = data;
+
+    debugfs_remove_recursive(msm261->debugfs);
+}
+
+int msm261_debugfs_init(struct msm261_priv *msm261)
+{
+    struct device *dev = msm261->dev;
+    int cpu;
+
+    /* Лічильники потрібні гарячому шляху і без CONFIG_DEBUG_FS */
+    msm261->stats = devm_alloc_percpu(dev, struct msm261_stats);
+    if (!msm261->stats)
+        return -ENOMEM;
+
+    for_each_possible_cpu(cpu)
+        u64_stats_init(&per_cpu_ptr(msm261->stats, cpu)->syncp);
+
+    msm261->debugfs = debugfs_create_dir(dev_name(dev), NULL);
+    debugfs_create_file("stats", 0444, msm261->debugfs, msm261, &msm261_stats_fops);
+
+    return devm_add_action_or_reset(dev, msm261_debugfs_remove, msm261);
+}
@@ -0,0 +1,1787 @@
+/*
+ * Ядра обробки сигналу: підсилення, промінь delay-and-sum і оцінка напрямку.
+ *
+ * Файл не залежить від ALSA і збирається як частина модуля, так і в
+ * userspace-бенчмарк msm261_bench (див. msm261_dsp.h), тож зміни тут можна
+ * міряти без плати.
+ */
+#include "msm261_dsp.h"
+
+/* Скалярні ядра підсилення */
+static void msm261_gain_s16_c(int16_t *dst, const int16_t *src, unsigned int n, int gain)
+{
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+        dst[i] = msm261_gain_sample_s16(src[i], gain);
+}
+
+static void msm261_gain_s24_c(int32_t *dst, const int32_t *src, unsigned int n, int gain)
+{
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+        dst[i] = msm261_gain_sample_s24(src[i], gain);
+}
+
+static void msm261_gain_s32_c(int32_t *dst, const int32_t *src, unsigned int n, int gain)
+{
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+        dst[i] = msm261_gain_sample_s32(src[i], gain);
+}
+
+const struct msm261_gain_ops msm261_gain_scalar = {
+    .name = "scalar",
+    .needs_fpu = false,
+    .s16 = msm261_gain_s16_c,
+    .s24 = msm261_gain_s24_c,
+    .s32 = msm261_gain_s32_c,
+};
+
+/* Вибирається один раз у msm261_gain_select() */
+static const struct msm261_gain_ops *msm261_gain_ops = &msm261_gain_scalar;
+
+static inline void msm261_fpu_begin(const struct msm261_gain_ops *ops)
+{
+#ifdef MSM261_DSP_SIMD
+    if (ops->needs_fpu)
+        msm261_dsp_fpu_begin();
+#endif
+}
+
+static inline void msm261_fpu_end(const struct msm261_gain_ops *ops)
+{
+#ifdef MSM261_DSP_SIMD
+    if (ops->needs_fpu)
+        msm261_dsp_fpu_end();
+#endif
+}
+
+#ifdef MSM261_DSP_SIMD
+/*
+ * Перевірка векторних ядер проти скалярних на межових значеннях: порогах
+ * насичення для кожного підсилення і довжинах, що не кратні ширині вектора.
+ */
+bool msm261_gain_selftest(const struct msm261_gain_ops *ops)
+{
+    static const int gains[] = { 0, 1, 2, 3, 5, 7, 100, 255, MSM261_SIMD_GAIN_MAX };
+    int16_t in16[37], ref16[37], out16[37];
+    int32_t in32[37], ref32[37], out32[37];
+    unsigned int g, i;
+    bool ok = true;
+
+    for (g = 0; g < ARRAY_SIZE(gains) && ok; g++) {
+        int gain = gains[g];
+        int q16 = gain ? 32767 / gain : 32767;
+        int q24 = gain ? MSM261_S24_MAX / gain : MSM261_S24_MAX;
+        int q32 = gain ? 2147483647 / gain : 2147483647;
+
+        for (i = 0; i < ARRAY_SIZE(in16); i++) {
+            int d = (int)(i % 3) - 1;
+            int sign = (i & 4) ? -1 : 1;
+
+            in16[i] = (i & 8) ? (int16_t)(i * 2654435761u) : (int16_t)(sign * (q16 + d));
+            in32[i] = (i & 8) ? (int32_t)(i * 2654435761u) : sign * (q32 - 1 + d);
+        }
+        in16[0] = 32767;
+        in16[1] = -32768;
+        in32[0] = 2147483647;
+        in32[1] = -2147483647 - 1;
+
+        msm261_dsp_fpu_begin();
+        ops->s16(out16, in16, ARRAY_SIZE(in16), gain);
+        ops->s32(out32, in32, ARRAY_SIZE(in32), gain);
+        msm261_dsp_fpu_end();
+        msm261_gain_s16_c(ref16, in16, ARRAY_SIZE(in16), gain);
+        msm261_gain_s32_c(ref32, in32, ARRAY_SIZE(in32), gain);
+        ok &= !memcmp(out16, ref16, sizeof(ref16)) && !memcmp(out32, ref32, sizeof(ref32));
+
+        /* S24: сміття у старшому байті контейнера має ігноруватися */
+        for (i = 0; i < ARRAY_SIZE(in32); i++) {
+            int v = ((i & 4) ? -1 : 1) * (q24 + (int)(i % 3) - 1);
+
+            in32[i] = (int32_t)((i << 24) | ((uint32_t)v & 0xffffff));
+        }
+
+        msm261_dsp_fpu_begin();
+        ops->s24(out32, in32, ARRAY_SIZE(in32), gain);
+        msm261_dsp_fpu_end();
+        msm261_gain_s24_c(ref32, in32, ARRAY_SIZE(in32), gain);
+        ok &= !memcmp(out32, ref32, sizeof(ref32));
+    }
+
+    return ok;
+}
+#endif
+
+void msm261_gain_select(void)
+{
+#ifdef MSM261_DSP_SIMD
+    if (msm261_dsp_fpu_available()) {
+        if (msm261_gain_selftest(&msm261_gain_simd))
+            msm261_gain_ops = &msm261_gain_simd;
+        else
+            pr_warn("MSM261: %s gain kernels failed self-test, using scalar\n",
+                    msm261_gain_simd.name);
+    }
+#endif
+    pr_info("MSM261: Using %s gain kernels\n", msm261_gain_ops->name);
+}
+
+void msm261_dsp_init(struct msm261_dsp *dsp)
+{
+    unsigned int m;
+
+    for (m = 0; m < NUM_MICS; m++) {
+        dsp->slot_map[m] = MSM261_DEFAULT_SLOT(m);
+        dsp->chan_mic[m] = m;
+    }
+    msm261_cal_reset(&dsp->cal);
+    msm261_hpf_reset(&dsp->hpf);
+    msm261_agc_reset(&dsp->agc);
+    dsp->dead = 0;
+}
+
+/* Типові параметри: одиничні підсилення і поправки, DOA і AGC вимкнено */
+void msm261_params_init(struct msm261_params *p)
+{
+    unsigned int m, k;
+
+    memset(p, 0, sizeof(*p));
+    p->software_gain = 1;
+    for (m = 0; m < NUM_MICS; m++)
+        p->cal_gain[m] = MSM261_CAL_ONE;
+
+    /*
+     * Типово - DC-блокер (1 - z^-1) / (1 - 0.995 z^-1): зріз ~38 Гц при
+     * 48 кГц; решта ланок пропускає сигнал без змін.
+     */
+    for (k = 0; k < MSM261_HPF_STAGES; k++)
+        p->hpf[k] = (struct msm261_biquad_coef){ .b0 = MSM261_HPF_ONE };
+    p->hpf[0].b1 = -MSM261_HPF_ONE;
+    p->hpf[0].a1 = -1068373115;     /* -0.995 */
+
+    p->agc_target_db = -18;
+    p->agc_max_db = 30;
+    msm261_params_agc(p);
+}
+
+/* 10^(-1/20) і 10^(1/20) у Q30: крок 1 дБ для перерахунку рівнів AGC */
+#define MSM261_DB_DOWN_Q30  956973237u
+#define MSM261_DB_UP_Q30    1204750638u
+
+/* Рівні AGC з дБ у лінійну шкалу обробки; викликається писачем блоку */
+void msm261_params_agc(struct msm261_params *p)
+{
+    u64 v = 1ull << 30;
+    int i;
+
+    p->agc_target_db = clamp_t(int, p->agc_target_db, -MSM261_AGC_DB_MAX, 0);
+    p->agc_max_db = min_t(unsigned int, p->agc_max_db, MSM261_AGC_DB_MAX);
+
+    for (i = p->agc_target_db; i < 0; i++)
+        v = (v * MSM261_DB_DOWN_Q30) >> 30;
+    p->agc_target = ((u64)S32_MAX * v) >> 30;
+
+    /* Q16, щоб 40 дБ (x100) не переповнили добуток */
+    v = MSM261_AGC_GAIN_ONE;
+    for (i = 0; i < p->agc_max_db; i++)
+        v = (v * MSM261_DB_UP_Q30) >> 30;
+    p->agc_max_gain = v;
+}
+
+/*
+ * Канали потоку - вибрані маскою мікрофони за зростанням номера. Повертає
+ * їх кількість; повна маска дає тотожне відображення, тож промінь і DOA,
+ * яким потрібні всі мікрофони, бачать канали на своїх місцях.
+ */
+unsigned int msm261_dsp_select(struct msm261_dsp *dsp, unsigned int mic_mask)
+{
+    unsigned int m, n = 0;
+
+    for (m = 0; m < NUM_MICS; m++)
+        if (mic_mask & (1u << m))
+            dsp->chan_mic[n++] = m;
+
+    return n;
+}
+
+/* Трикутник стійкості: |a2| < 1 і |a1| < 1 + a2 */
+bool msm261_hpf_valid(const struct msm261_biquad_coef *coef)
+{
+    unsigned int k;
+
+    for (k = 0; k < MSM261_HPF_STAGES; k++) {
+        s64 a1 = coef[k].a1, a2 = coef[k].a2;
+
+        if (a2 <= -MSM261_HPF_ONE || a2 >= MSM261_HPF_ONE)
+            return false;
+        if (a1 >= MSM261_HPF_ONE + a2 || -a1 >= MSM261_HPF_ONE + a2)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Перевіряє поправки нового блоку до публікації і оновлює cal_active.
+ * false - якщо затримка поза межами.
+ */
+bool msm261_params_cal_check(struct msm261_params *p)
+{
+    unsigned int m;
+
+    p->cal_active = false;
+    for (m = 0; m < NUM_MICS; m++) {
+        if (p->cal_delay[m] > MSM261_CAL_DELAY_MAX)
+            return false;
+        if (p->cal_gain[m] != MSM261_CAL_ONE || p->cal_delay[m])
+            p->cal_active = true;
+    }
+    return true;
+}
+
+void msm261_cal_reset(struct msm261_cal *cal)
+{
+    memset(cal->history, 0, sizeof(cal->history));
+    cal->pos = 0;
+}
+
+void msm261_hpf_reset(struct msm261_hpf *hpf)
+{
+    memset(hpf->state, 0, sizeof(hpf->state));
+}
+
+void msm261_agc_reset(struct msm261_agc *agc)
+{
+    unsigned int c;
+
+    for (c = 0; c < MSM261_CHANNELS_MAX; c++) {
+        agc->env[c] = 0;
+        agc->gain[c] = MSM261_AGC_GAIN_ONE;
+    }
+    agc->phase = 0;
+}
+
+/*
+ * Транспонування блоку: канал c кадру n береться з його слоту лінії.
+ * size - константа, тож memcpy розгортається у одне завантаження/запис.
+ */
+static __always_inline void msm261_demux_block(u8 *dst, const u8 *const *src,
+                                               unsigned int frames,
+                                               unsigned int channels,
+                                               unsigned int stride,
+                                               const unsigned int size)
+{
+    const unsigned int dst_stride = channels * size;
+    unsigned int n, c;
+
+    for (c = 0; c < channels; c++) {
+        const u8 *s = src[c];
+        u8 *d = dst + c * size;
+
+        if (!s) {
+            for (n = 0; n < frames; n++, d += dst_stride)
+                memset(d, 0, size);
+            continue;
+        }
+        for (n = 0; n < frames; n++, s += stride, d += dst_stride)
+            memcpy(d, s, size);
+    }
+}
+
+static __always_inline void msm261_demux_fmt(u8 *dst, const u8 **src,
+                                             unsigned int stride,
+                                             unsigned int frames,
+                                             unsigned int channels,
+                                             const unsigned int size)
+{
+    unsigned int done, c;
+
+    /* Блок входу і виходу лишається в L1, поки по ньому проходять усі канали */
+    for (done = 0; done < frames; done += MSM261_DEMUX_BLOCK) {
+        unsigned int block = min_t(unsigned int, frames - done, MSM261_DEMUX_BLOCK);
+
+        msm261_demux_block(dst, src, block, channels, stride, size);
+        dst += block * channels * size;
+        for (c = 0; c < channels; c++)
+            if (src[c])
+                src[c] += block * stride;
+    }
+}
+
+static const unsigned int msm261_sample_bytes[MSM261_FMT_COUNT] = {
+    [MSM261_FMT_S16]   = 2,
+    [MSM261_FMT_S24]   = 4,
+    [MSM261_FMT_S24_3] = 3,
+    [MSM261_FMT_S32]   = 4,
+};
+
+/*
+ * Кадри DMA I2S -> кадри ALSA. DMA кладе слоти підряд, slots на кадр, тож
+ * лінія l починається зі слоту l * MSM261_SLOTS_PER_LINE; кожен слот
+ * мікрофона каналу має бути < slots (перевіряє msm261_demux_dma_valid()).
+ */
+void msm261_demux_dma(const struct msm261_dsp *dsp, void *dst, const void *src,
+                      unsigned int slots, unsigned int frames, int fmt,
+                      unsigned int channels)
+{
+    const void *lines[NUM_DATA_LINES];
+    unsigned int l;
+
+    if (fmt < 0 || fmt >= MSM261_FMT_COUNT)
+        return;
+
+    for (l = 0; l < NUM_DATA_LINES; l++)
+        lines[l] = (const u8 *)src + l * MSM261_SLOTS_PER_LINE * msm261_sample_bytes[fmt];
+    msm261_demux(dsp, dst, lines, slots, frames, fmt, channels);
+}
+
+/*
+ * Чи вміщує кадр DMA з slots слотами мікрофони перших channels каналів.
+ * *reorder - чи слоти йдуть не в порядку каналів, тобто чи потрібна
+ * msm261_demux_dma().
+ */
+bool msm261_demux_dma_valid(const struct msm261_dsp *dsp, unsigned int slots,
+                            unsigned int channels, bool *reorder)
+{
+    unsigned int c;
+
+    *reorder = false;
+    for (c = 0; c < channels && c < NUM_MICS; c++) {
+        unsigned int slot = dsp->slot_map[dsp->chan_mic[c]];
+
+        if (slot >= slots)
+            return false;
+        if (slot != c)
+            *reorder = true;
+    }
+    return true;
+}
+
+/*
+ * Режим мікрофонів за BCLK: нормальний, якщо частота в його діапазоні, інакше
+ * низького енергоспоживання, якщо влазить туди (8 кГц -> 512 кГц).
+ */
+int msm261_mode_for_bclk(unsigned int bclk)
+{
+    if (bclk >= MSM261_NORMAL_MODE_MIN_CLK && bclk <= MSM261_NORMAL_MODE_MAX_CLK)
+        return MSM261_MODE_NORMAL;
+    if (bclk >= MSM261_LOW_POWER_MIN_CLK && bclk <= MSM261_LOW_POWER_MAX_CLK)
+        return MSM261_MODE_LOW_POWER;
+    return -EINVAL;
+}
+
+/* Скільки каналів можна відкрити: вибрані мікрофони, плюс промінь, якщо всі */
+unsigned int msm261_channels_avail(unsigned int mic_mask)
+{
+    if (mic_mask == MSM261_MIC_MASK_ALL)
+        return MSM261_CHANNELS_MAX;
+    return hweight32(mic_mask);
+}
+
+/*
+ * Частоти, які віддаються децимацією з вищої частоти масиву; BCLK при цьому
+ * лишається на частоті масиву.
+ */
+static const struct {
+    unsigned int rate;
+    unsigned int ratio;
+} msm261_decim_rates[MSM261_DECIM_RATES] = {
+    { 16000, 3 },   /* 48 кГц */
+    { 22050, 2 },   /* 44.1 кГц */
+};
+
+/* У скільки разів частота масиву вища за rate споживача */
+unsigned int msm261_decim_ratio_for(unsigned int rate)
+{
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE(msm261_decim_rates); i++)
+        if (msm261_decim_rates[i].rate == rate)
+            return msm261_decim_rates[i].ratio;
+    return 1;
+}
+
+/* Частоти споживача на масиві native, до MSM261_RATES_MAX; повертає кількість */
+unsigned int msm261_rate_list(unsigned int native, bool decimate, unsigned int *rates)
+{
+    unsigned int i, n = 0;
+
+    for (i = 0; decimate && i < ARRAY_SIZE(msm261_decim_rates); i++)
+        if (msm261_decim_rates[i].rate * msm261_decim_rates[i].ratio == native)
+            rates[n++] = msm261_decim_rates[i].rate;
+    rates[n++] = native;
+    return n;
+}
+
+/*
+ * Чи можна відкрити channels каналів (beam - споживач променя) при масці
+ * mic_mask. Без line_data (залізо) кадр DMA - channels слотів підряд, тож
+ * вибір має бути повним, а мікрофони каналів - влазити в кадр.
+ */
+enum msm261_open_err msm261_open_check(const struct msm261_dsp *dsp, unsigned int mic_mask,
+                                       unsigned int channels, bool beam, bool line_data,
+                                       bool *reorder)
+{
+    unsigned int avail = msm261_channels_avail(mic_mask);
+
+    *reorder = false;
+    /* Промінь рахується лише з усіх мікрофонів */
+    if (beam ? avail != MSM261_CHANNELS_MAX : channels > avail)
+        return MSM261_OPEN_CHANNELS;
+    if (line_data)
+        return MSM261_OPEN_OK;
+
+    if (mic_mask != MSM261_MIC_MASK_ALL)
+        return MSM261_OPEN_MASK;
+    if (!msm261_demux_dma_valid(dsp, channels, channels, reorder))
+        return MSM261_OPEN_SLOTS;
+    return MSM261_OPEN_OK;
+}
+
+/*
+ * Чи може споживач (group - потік групи) приєднатися до масиву на частоті
+ * rate. others - масив уже тримають інші, with_group - серед них потік групи,
+ * array_rate - частота, на якій масив тоді йде.
+ */
+enum msm261_open_err msm261_share_check(bool group, bool others, bool with_group,
+                                        unsigned int mic_mask, unsigned int rate,
+                                        unsigned int array_rate)
+{
+    /* Потік групи має свою ширину обробки, тож масив ні з ким не ділить */
+    if (others && (group || with_group))
+        return MSM261_OPEN_BUSY;
+    if (group && mic_mask != MSM261_MIC_MASK_ALL)
+        return MSM261_OPEN_GROUP_MASK;
+    if (others && rate != array_rate)
+        return MSM261_OPEN_RATE;
+    return MSM261_OPEN_OK;
+}
+
+/*
+ * Лінії даних -> кадри ALSA. lines[l] - семпли лінії l, кадр лінії займає
+ * line_stride семплів (2 для окремих L/R потоків на лінію, кількість слотів
+ * кадру для DMA, що вже чергує всі слоти, див. msm261_demux_dma()). Канал c - мікрофон chan_mic[c], тож
+ * невибрані мікрофони не читаються і не пишуться. Канали понад NUM_MICS
+ * заповнюються нулями: канал променя обчислюється пізніше.
+ */
+void msm261_demux(const struct msm261_dsp *dsp, void *dst,
+                  const void *const lines[NUM_DATA_LINES], unsigned int line_stride,
+                  unsigned int frames, int fmt, unsigned int channels)
+{
+    const u8 *src[MSM261_CHANNELS_MAX] = { NULL };
+    unsigned int size, stride, c;
+
+    if (fmt < 0 || fmt >= MSM261_FMT_COUNT || channels > MSM261_CHANNELS_MAX)
+        return;
+
+    size = msm261_sample_bytes[fmt];
+    stride = line_stride * size;
+    for (c = 0; c < channels && c < NUM_MICS; c++) {
+        unsigned int slot = dsp->slot_map[dsp->chan_mic[c]];
+
+        src[c] = (const u8 *)lines[slot / MSM261_SLOTS_PER_LINE] +
+                 (slot % MSM261_SLOTS_PER_LINE) * size;
+    }
+
+    switch (size) {
+    case 2:
+        msm261_demux_fmt(dst, src, stride, frames, channels, 2);
+        break;
+    case 3:
+        msm261_demux_fmt(dst, src, stride, frames, channels, 3);
+        break;
+    default:
+        msm261_demux_fmt(dst, src, stride, frames, channels, 4);
+        break;
+    }
+}
+
+/*
+ * Обробка періоду, спеціалізована під (формат, кількість каналів).
+ * msm261_process() інлайниться з константними fmt і channels, тож кожен
+ * елемент msm261_process_table - окремо скомпільований варіант; вибір
+ * робиться один раз у hw_params, а не на кожен виклик copy.
+ */
+static inline const struct msm261_gain_ops *msm261_gain_ops_for(int gain)
+{
+    /* Векторні ядра розраховані на 0..MSM261_SIMD_GAIN_MAX */
+    if (gain < 0 || gain > MSM261_SIMD_GAIN_MAX)
+        return &msm261_gain_scalar;
+    return msm261_gain_ops;
+}
+
+/* S24_3LE: розпаковка, підсилення і запаковка за один прохід */
+static void msm261_gain_s24_3le(u8 *dst, const u8 *src, unsigned int n, int gain)
+{
+    unsigned int i;
+
+    for (i = 0; i < n; i++, src += 3, dst += 3) {
+        int32_t val = src[0] | (src[1] << 8) | (src[2] << 16);
+
+        val = msm261_gain_sample_s24(val, gain);
+        dst[0] = val;
+        dst[1] = val >> 8;
+        dst[2] = val >> 16;
+    }
+}
+
+/* Семпл idx у форматі fmt -> ліво-вирівняне s32 і назад */
+static __always_inline s32 msm261_load_sample(const void *buf, unsigned int idx,
+                                              const int fmt)
+{
+    const u8 *p;
+
+    switch (fmt) {
+    case MSM261_FMT_S16:
+        return (s32)((const s16 *)buf)[idx] << 16;
+    case MSM261_FMT_S24:
+        return (s32)((u32)((const s32 *)buf)[idx] << 8);
+    case MSM261_FMT_S24_3:
+        p = (const u8 *)buf + idx * 3;
+        return (s32)((p[0] << 8) | (p[1] << 16) | ((u32)p[2] << 24));
+    default:
+        return ((const s32 *)buf)[idx];
+    }
+}
+
+static __always_inline void msm261_store_sample(void *buf, unsigned int idx,
+                                                s32 val, const int fmt)
+{
+    u8 *p;
+
+    switch (fmt) {
+    case MSM261_FMT_S16:
+        ((s16 *)buf)[idx] = val >> 16;
+        break;
+    case MSM261_FMT_S24:
+        ((s32 *)buf)[idx] = val >> 8;
+        break;
+    case MSM261_FMT_S24_3:
+        p = (u8 *)buf + idx * 3;
+        p[0] = val >> 8;
+        p[1] = val >> 16;
+        p[2] = val >> 24;
+        break;
+    default:
+        ((s32 *)buf)[idx] = val;
+        break;
+    }
+}
+
+/*
+ * М'який обмежувач: до коліна без змін, вище - квадратичне коліно
+ * d -> d - d^2 / 4R (R = KNEE = півшкали), з нахилом 1 на коліні і 0 на
+ * повній шкалі, куди вихід доходить при вході 1.5 FS. Без ділення: воно
+ * коштувало б більше за решту AGC на кожному семплі перехідного процесу.
+ */
+static __always_inline s32 msm261_soft_limit(s64 y)
+{
+    u64 a = y < 0 ? -(u64)y : y;
+    u64 d;
+
+    if (a <= MSM261_AGC_KNEE)
+        return y;
+    d = min_t(u64, a - MSM261_AGC_KNEE, 2ull * MSM261_AGC_KNEE);
+    a = min_t(u64, MSM261_AGC_KNEE + d - ((d * d) >> 32), S32_MAX);
+    return y < 0 ? -(s32)a : (s32)a;
+}
+
+/*
+ * Обвідна по вхідному семплу і сам семпл з поточним підсиленням. Стан -
+ * локальні копії викликача: запис у буфер s32 інакше змушував би
+ * перечитувати його з пам'яті на кожному семплі.
+ */
+static __always_inline s32 msm261_agc_sample(u32 *env, u32 gain, s32 x)
+{
+    s64 diff = (s64)(x < 0 ? -(u32)x : x) - *env;
+
+    *env += diff >> (diff > 0 ? MSM261_AGC_ATTACK_SHIFT : MSM261_AGC_RELEASE_SHIFT);
+
+    return msm261_soft_limit(((s64)x * gain) >> MSM261_AGC_GAIN_SHIFT);
+}
+
+/* Межа блоку: нове підсилення до target / обвідна */
+static u32 msm261_agc_update(const struct msm261_params *p, u32 env, u32 gain)
+{
+    u32 want;
+
+    /* Тиша: тримаємо підсилення, щоб не піднімати шум */
+    if (env < MSM261_AGC_GATE)
+        return gain;
+
+    want = min_t(u64, div_u64((u64)p->agc_target << MSM261_AGC_GAIN_SHIFT, env),
+                 p->agc_max_gain);
+    if (want < gain)
+        return want;
+    return gain + ((want - gain) >> MSM261_AGC_RISE_SHIFT);
+}
+
+static __always_inline bool msm261_agc_boundary(const struct msm261_agc *agc,
+                                                unsigned int n)
+{
+    return ((agc->phase + n + 1) & (MSM261_AGC_BLOCK - 1)) == 0;
+}
+
+/*
+ * Підсилення з поправками калібрування за один прохід: кожен мікрофон
+ * затримується на свою кількість семплів і множиться на gain[c] (Q12) і
+ * software_gain, або, з agc, на підсилення AGC свого каналу. Насичення те
+ * саме, що й у msm261_gain_sample_*(); з agc - м'який обмежувач.
+ */
+static __always_inline void msm261_gain_cal(struct msm261_dsp *dsp,
+                                            const struct msm261_params *p,
+                                            void *dst, const void *src,
+                                            unsigned int frames,
+                                            const int fmt,
+                                            const unsigned int channels,
+                                            const bool agc)
+{
+    struct msm261_cal *cal = &dsp->cal;
+    const unsigned int mics = min_t(unsigned int, channels, NUM_MICS);
+    s64 gain[MSM261_CHANNELS_MAX];
+    unsigned int delay[MSM261_CHANNELS_MAX];
+    u32 env[NUM_MICS], agc_gain[NUM_MICS];
+    unsigned int pos = cal->pos;
+    unsigned int n, c;
+
+    if (agc) {
+        memcpy(env, dsp->agc.env, sizeof(env));
+        memcpy(agc_gain, dsp->agc.gain, sizeof(agc_gain));
+    }
+
+    for (c = 0; c < channels; c++) {
+        unsigned int m = c < NUM_MICS ? dsp->chan_mic[c] : 0;
+        s64 g = c < NUM_MICS ? p->cal_gain[m] : MSM261_CAL_ONE;
+
+        gain[c] = clamp_t(s64, agc ? g : g * p->software_gain, -S32_MAX, S32_MAX);
+        delay[c] = c < NUM_MICS ? p->cal_delay[m] : 0;
+    }
+
+    for (n = 0; n < frames; n++) {
+        pos = (pos + 1) & (MSM261_CAL_HISTORY - 1);
+
+        for (c = 0; c < channels; c++) {
+            s32 x = msm261_load_sample(src, n * channels + c, fmt);
+            s64 y;
+
+            if (c < NUM_MICS) {
+                cal->history[pos][c] = x;
+                x = cal->history[(pos - delay[c]) & (MSM261_CAL_HISTORY - 1)][c];
+            }
+            y = clamp_t(s64, ((s64)x * gain[c]) >> MSM261_CAL_SHIFT, S32_MIN, S32_MAX);
+            /* Канал променя тут лише місце; AGC для нього - у msm261_beam_process() */
+            if (agc && c < NUM_MICS)
+                y = msm261_agc_sample(&env[c], agc_gain[c], y);
+            msm261_store_sample(dst, n * channels + c, y, fmt);
+        }
+
+        if (agc && msm261_agc_boundary(&dsp->agc, n))
+            for (c = 0; c < mics; c++)
+                agc_gain[c] = msm261_agc_update(p, env[c], agc_gain[c]);
+    }
+
+    cal->pos = pos;
+    if (agc) {
+        memcpy(dsp->agc.env, env, sizeof(env));
+        memcpy(dsp->agc.gain, agc_gain, sizeof(agc_gain));
+    }
+}
+
+/*
+ * Ваги напрямку на один виклик, без поганих мікрофонів (msm261_health):
+ * решта підсилюється, щоб рівень суми не впав. Якщо погані всі, беремо всіх.
+ */
+static void msm261_beam_weights(const struct msm261_beam_steer *st, unsigned int bad,
+                                s32 w[NUM_MICS][MSM261_BEAM_TAPS])
+{
+    unsigned int good = NUM_MICS, m, k;
+
+    for (m = 0; m < NUM_MICS; m++)
+        if (bad & BIT(m))
+            good--;
+    if (!good) {
+        bad = 0;
+        good = NUM_MICS;
+    }
+
+    for (m = 0; m < NUM_MICS; m++)
+        for (k = 0; k < MSM261_BEAM_TAPS; k++)
+            w[m][k] = bad & BIT(m) ? 0 : st->weight[m][k] * NUM_MICS / (s32)good;
+}
+
+/*
+ * Delay-and-sum: промінь з сирих семплів src записується у віртуальний
+ * канал MSM261_BEAM_CHANNEL кадрів dst з тим самим підсиленням, або з
+ * власним AGC, бо рівень суми не дорівнює рівню окремих мікрофонів.
+ * Затримки - за номером мікрофона, тож src - кадри після демультиплексора
+ * з повною маскою, де канал m - це MIC(m + 1), а не порядок слотів DMA.
+ */
+static __always_inline void msm261_beam_process(struct msm261_dsp *dsp,
+                                                const struct msm261_params *p,
+                                                void *dst, const void *src,
+                                                unsigned int frames,
+                                                const int fmt)
+{
+    struct msm261_beam *beam = &dsp->beam;
+    const struct msm261_beam_steer *st = &beam->steer[p->beam_dir];
+    unsigned int pos = beam->pos;
+    int gain = p->software_gain;
+    u32 env = dsp->agc.env[MSM261_BEAM_CHANNEL];
+    u32 agc_gain = dsp->agc.gain[MSM261_BEAM_CHANNEL];
+    s32 weight[NUM_MICS][MSM261_BEAM_TAPS];
+    unsigned int n, m, k;
+
+    msm261_beam_weights(st, msm261_dsp_excluded(dsp), weight);
+
+    for (n = 0; n < frames; n++) {
+        const unsigned int base = n * MSM261_CHANNELS_MAX;
+        s64 acc = 0;
+
+        pos = (pos + 1) & (MSM261_BEAM_HISTORY - 1);
+        for (m = 0; m < NUM_MICS; m++)
+            beam->history[pos][m] = msm261_load_sample(src, base + m, fmt);
+
+        for (m = 0; m < NUM_MICS; m++) {
+            unsigned int tap = pos - st->delay[m] + 1;
+
+            for (k = 0; k < MSM261_BEAM_TAPS; k++, tap--)
+                acc += (s64)weight[m][k] *
+                       beam->history[tap & (MSM261_BEAM_HISTORY - 1)][m];
+        }
+
+        acc = clamp_t(s64, acc >> 16, S32_MIN, S32_MAX);
+        if (p->agc_enabled) {
+            acc = msm261_agc_sample(&env, agc_gain, acc);
+            if (msm261_agc_boundary(&dsp->agc, n))
+                agc_gain = msm261_agc_update(p, env, agc_gain);
+        } else {
+            acc = msm261_gain_sample_s32(acc, gain);
+        }
+        msm261_store_sample(dst, base + MSM261_BEAM_CHANNEL, acc, fmt);
+    }
+
+    beam->pos = pos;
+    dsp->agc.env[MSM261_BEAM_CHANNEL] = env;
+    dsp->agc.gain[MSM261_BEAM_CHANNEL] = agc_gain;
+}
+
+/*
+ * Мікрофони кільця з сирих кадрів у буфер DOA; раз на період - знімок
+ * вікна для msm261_doa_update(), якщо попередній уже забрано.
+ */
+static __always_inline void msm261_doa_feed(struct msm261_dsp *dsp,
+                                            const void *src, unsigned int frames,
+                                            const int fmt,
+                                            const unsigned int channels)
+{
+    struct msm261_doa *doa = dsp->doa;
+    unsigned int n, m;
+
+    for (n = 0; n < frames; n++) {
+        doa->ring_pos = (doa->ring_pos + 1) & (MSM261_DOA_FFT_SIZE - 1);
+        for (m = 0; m < MSM261_DOA_RING_MICS; m++)
+            doa->ring[doa->ring_pos][m] =
+                msm261_load_sample(src, n * channels + m, fmt) >> 8;
+
+        if (doa->filled < MSM261_DOA_FFT_SIZE)
+            doa->filled++;
+        if (++doa->frames_since >= dsp->period_frames &&
+            doa->filled == MSM261_DOA_FFT_SIZE) {
+            doa->frames_since = 0;
+            if (!smp_load_acquire(&doa->pending)) {
+                memcpy(doa->window, doa->ring, sizeof(doa->window));
+                doa->window_pos = doa->ring_pos;
+                doa->excluded = msm261_dsp_excluded(dsp);
+                smp_store_release(&doa->pending, true);
+            }
+        }
+    }
+}
+
+/*
+ * Каскад біквадів по всіх каналах кадру за один прохід по періоду (на місці).
+ * Коефіцієнти і стан копіюються у локальні змінні на весь період, а цикл по
+ * каналах має константну довжину, тож компілятор тримає їх у регістрах і
+ * розгортає/векторизує цикл по каналах.
+ */
+static __always_inline void msm261_hpf_process(struct msm261_dsp *dsp,
+                                               const struct msm261_params *p, void *buf,
+                                               unsigned int frames,
+                                               const int fmt,
+                                               const unsigned int channels)
+{
+    struct msm261_hpf *hpf = &dsp->hpf;
+    struct msm261_biquad_coef coef[MSM261_HPF_STAGES];
+    s32 st[MSM261_HPF_STAGES][MSM261_HPF_VARS][MSM261_CHANNELS_MAX];
+    unsigned int n, c, k;
+
+    memcpy(coef, p->hpf, sizeof(coef));
+    memcpy(st, hpf->state, sizeof(st));
+
+    for (n = 0; n < frames; n++) {
+        s32 x[MSM261_CHANNELS_MAX];
+
+        for (c = 0; c < channels; c++)
+            x[c] = msm261_load_sample(buf, n * channels + c, fmt);
+
+        /* Канали - незалежні лінії: внутрішній цикл без залежностей між ітераціями */
+        for (k = 0; k < MSM261_HPF_STAGES; k++) {
+            s32 (*v)[MSM261_CHANNELS_MAX] = st[k];
+
+            for (c = 0; c < channels; c++) {
+                s64 acc = (s64)coef[k].b0 * x[c] +
+                          (s64)coef[k].b1 * v[MSM261_HPF_X1][c] +
+                          (s64)coef[k].b2 * v[MSM261_HPF_X2][c] -
+                          (s64)coef[k].a1 * v[MSM261_HPF_Y1][c] -
+                          (s64)coef[k].a2 * v[MSM261_HPF_Y2][c];
+                s32 y = clamp_t(s64, (acc + (1 << (MSM261_HPF_COEF_SHIFT - 1))) >>
+                                     MSM261_HPF_COEF_SHIFT, S32_MIN, S32_MAX);
+
+                v[MSM261_HPF_X2][c] = v[MSM261_HPF_X1][c];
+                v[MSM261_HPF_X1][c] = x[c];
+                v[MSM261_HPF_Y2][c] = v[MSM261_HPF_Y1][c];
+                v[MSM261_HPF_Y1][c] = y;
+                x[c] = y;
+            }
+        }
+
+        for (c = 0; c < channels; c++)
+            msm261_store_sample(buf, n * channels + c, x[c], fmt);
+    }
+
+    memcpy(hpf->state, st, sizeof(st));
+}
+
+static __always_inline void msm261_process(struct msm261_dsp *dsp,
+                                           const struct msm261_params *p,
+                                           void *dst, const void *src,
+                                           unsigned int frames,
+                                           const int fmt,
+                                           const unsigned int channels)
+{
+    unsigned int samples = frames * channels;
+    int gain = p->software_gain;
+    const struct msm261_gain_ops *ops;
+
+    /* Стан скидає лише обробка: kcontrol тільки міняє покоління в параметрах */
+    if (dsp->hpf_gen != p->hpf_gen) {
+        msm261_hpf_reset(&dsp->hpf);
+        dsp->hpf_gen = p->hpf_gen;
+    }
+    if (dsp->agc_gen != p->agc_gen) {
+        msm261_agc_reset(&dsp->agc);
+        dsp->agc_gen = p->agc_gen;
+    }
+
+    if (p->agc_enabled) {
+        msm261_gain_cal(dsp, p, dst, src, frames, fmt, channels, true);
+    } else if (p->cal_active) {
+        msm261_gain_cal(dsp, p, dst, src, frames, fmt, channels, false);
+    } else if (fmt == MSM261_FMT_S24_3) {
+        msm261_gain_s24_3le(dst, src, samples, gain);
+    } else {
+        ops = msm261_gain_ops_for(gain);
+        msm261_fpu_begin(ops);
+
+        switch (fmt) {
+        case MSM261_FMT_S16:
+            ops->s16(dst, src, samples, gain);
+            break;
+        case MSM261_FMT_S24:
+            ops->s24(dst, src, samples, gain);
+            break;
+        case MSM261_FMT_S32:
+            ops->s32(dst, src, samples, gain);
+            break;
+        }
+
+        msm261_fpu_end(ops);
+    }
+
+    if (channels == MSM261_CHANNELS_MAX)
+        msm261_beam_process(dsp, p, dst, src, frames, fmt);
+
+    /* Після променя, щоб фільтр пройшов і по його каналу */
+    if (p->hpf_enabled)
+        msm261_hpf_process(dsp, p, dst, frames, fmt, channels);
+
+    if (channels >= NUM_MICS && p->doa_enabled)
+        msm261_doa_feed(dsp, src, frames, fmt, channels);
+
+    dsp->agc.phase += frames;
+}
+
+#define MSM261_PROCESS_FN(fmt, ch)                                              \
+static void msm261_process_##fmt##_##ch(struct msm261_dsp *dsp,                \
+                                        const struct msm261_params *p,          \
+                                        void *dst, const void *src,             \
+                                        unsigned int frames)                    \
+{                                                                               \
+    msm261_process(dsp, p, dst, src, frames, MSM261_FMT_##fmt, ch);             \
+}
+
+#define MSM261_PROCESS_FNS(fmt)                                                 \
+    MSM261_PROCESS_FN(fmt, 1) MSM261_PROCESS_FN(fmt, 2)                         \
+    MSM261_PROCESS_FN(fmt, 3) MSM261_PROCESS_FN(fmt, 4)                         \
+    MSM261_PROCESS_FN(fmt, 5) MSM261_PROCESS_FN(fmt, 6)                         \
+    MSM261_PROCESS_FN(fmt, 7) MSM261_PROCESS_FN(fmt, 8)
+
+#define MSM261_PROCESS_ROW(fmt)                                                 \
+    { msm261_process_##fmt##_1, msm261_process_##fmt##_2,                       \
+      msm261_process_##fmt##_3, msm261_process_##fmt##_4,                       \
+      msm261_process_##fmt##_5, msm261_process_##fmt##_6,                       \
+      msm261_process_##fmt##_7, msm261_process_##fmt##_8 }
+
+MSM261_PROCESS_FNS(S16)
+MSM261_PROCESS_FNS(S24)
+MSM261_PROCESS_FNS(S24_3)
+MSM261_PROCESS_FNS(S32)
+
+static const msm261_process_fn msm261_process_table[MSM261_FMT_COUNT][MSM261_CHANNELS_MAX] = {
+    [MSM261_FMT_S16]   = MSM261_PROCESS_ROW(S16),
+    [MSM261_FMT_S24]   = MSM261_PROCESS_ROW(S24),
+    [MSM261_FMT_S24_3] = MSM261_PROCESS_ROW(S24_3),
+    [MSM261_FMT_S32]   = MSM261_PROCESS_ROW(S32),
+};
+
+msm261_process_fn msm261_dsp_process_lookup(int fmt, unsigned int channels)
+{
+    if (fmt < 0 || fmt >= MSM261_FMT_COUNT)
+        return NULL;
+    if (channels < 1 || channels > MSM261_CHANNELS_MAX)
+        return NULL;
+
+    return msm261_process_table[fmt][channels - 1];
+}
+
+/*
+ * Коефіцієнти децимації: sinc з вікном Кайзера (beta 7), Q15, сума 32768.
+ * 2:1 - 48 відводів, зріз 0.95 вихідної Найквіста; 3:1 - 72 відводи, зріз на
+ * вихідній Найквісті. Смуга до 0.8 вихідної Найквіста рівна в межах 0.1 дБ,
+ * усе, що при децимації згортається в неї, придушено на ~69 дБ.
+ */
+static const s16 msm261_decim2_coef[48] = {
+    -1, 5, 8, -15, -24, 31, 60, -49,
+    -125, 64, 232, -61, -395, 20, 632, 93,
+    -973, -338, 1486, 861, -2419, -2234, 5389, 14137,
+    14137, 5389, -2234, -2419, 861, 1486, -338, -973,
+    93, 632, 20, -395, -61, 232, 64, -125,
+    -49, 60, 31, -24, -15, 8, 5, -1,
+};
+
+static const s16 msm261_decim3_coef[72] = {
+    -1, -3, -3, 4, 12, 8, -11, -29,
+    -18, 23, 59, 36, -45, -109, -65, 78,
+    186, 110, -129, -302, -176, 205, 476, 276,
+    -320, -744, -434, 508, 1202, 719, -877, -2200,
+    -1444, 2053, 6914, 10425, 10425, 6914, 2053, -1444,
+    -2200, -877, 719, 1202, 508, -434, -744, -320,
+    276, 476, 205, -176, -302, -129, 110, 186,
+    78, -65, -109, -45, 36, 59, 23, -18,
+    -29, -11, 8, 12, 4, -3, -3, -1,
+};
+
+bool msm261_decim_setup(struct msm261_decim *decim, unsigned int ratio)
+{
+    switch (ratio) {
+    case 1:
+        decim->coef = NULL;
+        decim->taps = 1;
+        break;
+    case 2:
+        decim->coef = msm261_decim2_coef;
+        decim->taps = ARRAY_SIZE(msm261_decim2_coef);
+        break;
+    case 3:
+        decim->coef = msm261_decim3_coef;
+        decim->taps = ARRAY_SIZE(msm261_decim3_coef);
+        break;
+    default:
+        return false;
+    }
+
+    decim->ratio = ratio;
+    decim->skip = 0;
+    memset(decim->history, 0, sizeof(decim->history));
+    return true;
+}
+
+/*
+ * Вхід розпаковується блоками в history після хвоста попереднього блоку;
+ * для кожного вихідного кадру згортка йде по відводах, а всередині - по
+ * каналах з константною кількістю, тож акумулятори каналів векторизуються.
+ */
+static __always_inline unsigned int msm261_decim_run(struct msm261_decim *decim,
+                                                     void *dst, const void *src,
+                                                     unsigned int frames,
+                                                     const int fmt,
+                                                     const unsigned int channels)
+{
+    s32 (*x)[MSM261_CHANNELS_MAX] = decim->history;
+    const unsigned int keep = decim->taps - 1;
+    const s16 *coef = decim->coef;
+    unsigned int done, block, n, k, c, out = 0;
+
+    for (done = 0; done < frames; done += block) {
+        block = min_t(unsigned int, frames - done, MSM261_DECIM_BLOCK);
+
+        for (n = 0; n < block; n++)
+            for (c = 0; c < channels; c++)
+                x[keep + n][c] = msm261_load_sample(src, (done + n) * channels + c, fmt);
+
+        for (n = decim->skip; n < block; n += decim->ratio, out++) {
+            s64 acc[MSM261_CHANNELS_MAX] = { 0 };
+
+            /* Фільтр симетричний: пара відводів - одне множення */
+            for (k = 0; k < decim->taps / 2; k++)
+                for (c = 0; c < channels; c++)
+                    acc[c] += (s64)coef[k] * ((s64)x[keep + n - k][c] + x[n + k][c]);
+
+            for (c = 0; c < channels; c++)
+                msm261_store_sample(dst, out * channels + c,
+                                    clamp_t(s64, (acc[c] + (1 << (MSM261_DECIM_COEF_SHIFT - 1))) >>
+                                                 MSM261_DECIM_COEF_SHIFT, S32_MIN, S32_MAX),
+                                    fmt);
+        }
+        decim->skip = n - block;
+
+        memmove(x, x[block], keep * sizeof(x[0]));
+    }
+
+    return out;
+}
+
+typedef unsigned int (*msm261_decim_fn)(struct msm261_decim *decim, void *dst,
+                                        const void *src, unsigned int frames);
+
+#define MSM261_DECIM_FN(fmt, ch)                                                \
+static unsigned int msm261_decim_##fmt##_##ch(struct msm261_decim *decim,       \
+                                              void *dst, const void *src,       \
+                                              unsigned int frames)              \
+{                                                                               \
+    return msm261_decim_run(decim, dst, src, frames, MSM261_FMT_##fmt, ch);     \
+}
+
+#define MSM261_DECIM_FNS(fmt)                                                   \
+    MSM261_DECIM_FN(fmt, 1) MSM261_DECIM_FN(fmt, 2)                             \
+    MSM261_DECIM_FN(fmt, 3) MSM261_DECIM_FN(fmt, 4)                             \
+    MSM261_DECIM_FN(fmt, 5) MSM261_DECIM_FN(fmt, 6)                             \
+    MSM261_DECIM_FN(fmt, 7) MSM261_DECIM_FN(fmt, 8)
+
+#define MSM261_DECIM_ROW(fmt)                                                   \
+    { msm261_decim_##fmt##_1, msm261_decim_##fmt##_2,                           \
+      msm261_decim_##fmt##_3, msm261_decim_##fmt##_4,                           \
+      msm261_decim_##fmt##_5, msm261_decim_##fmt##_6,                           \
+      msm261_decim_##fmt##_7, msm261_decim_##fmt##_8 }
+
+MSM261_DECIM_FNS(S16)
+MSM261_DECIM_FNS(S24)
+MSM261_DECIM_FNS(S24_3)
+MSM261_DECIM_FNS(S32)
+
+static const msm261_decim_fn msm261_decim_table[MSM261_FMT_COUNT][MSM261_CHANNELS_MAX] = {
+    [MSM261_FMT_S16]   = MSM261_DECIM_ROW(S16),
+    [MSM261_FMT_S24]   = MSM261_DECIM_ROW(S24),
+    [MSM261_FMT_S24_3] = MSM261_DECIM_ROW(S24_3),
+    [MSM261_FMT_S32]   = MSM261_DECIM_ROW(S32),
+};
+
+/* frames кадрів входу з src -> кадри на зниженій частоті в dst; повертає їх кількість */
+unsigned int msm261_decim(struct msm261_decim *decim, void *dst, const void *src,
+                          unsigned int frames, int fmt, unsigned int channels)
+{
+    if (fmt < 0 || fmt >= MSM261_FMT_COUNT)
+        return 0;
+    if (channels < 1 || channels > MSM261_CHANNELS_MAX || decim->ratio < 2)
+        return 0;
+
+    return msm261_decim_table[fmt][channels - 1](decim, dst, src, frames);
+}
+
+/* Канали спільного кадру S32 -> кадри споживача у його форматі */
+static __always_inline void msm261_pick_fmt(void *dst, unsigned int channels,
+                                            const s32 *src, unsigned int src_channels,
+                                            unsigned int frames, const int fmt)
+{
+    unsigned int n, c;
+
+    for (n = 0; n < frames; n++, src += src_channels)
+        for (c = 0; c < channels; c++)
+            msm261_store_sample(dst, n * channels + c, src[c], fmt);
+}
+
+/*
+ * Канали [first, first + channels) кожного з frames кадрів src (src_channels
+ * каналів S32) записуються у dst як кадри формату fmt.
+ */
+void msm261_pick(void *dst, int fmt, unsigned int channels, const s32 *src,
+                 unsigned int src_channels, unsigned int first, unsigned int frames)
+{
+    src += first;
+
+    switch (fmt) {
+    case MSM261_FMT_S16:
+        msm261_pick_fmt(dst, channels, src, src_channels, frames, MSM261_FMT_S16);
+        break;
+    case MSM261_FMT_S24:
+        msm261_pick_fmt(dst, channels, src, src_channels, frames, MSM261_FMT_S24);
+        break;
+    case MSM261_FMT_S24_3:
+        msm261_pick_fmt(dst, channels, src, src_channels, frames, MSM261_FMT_S24_3);
+        break;
+    case MSM261_FMT_S32:
+        msm261_pick_fmt(dst, channels, src, src_channels, frames, MSM261_FMT_S32);
+        break;
+    }
+}
+
+static __always_inline void msm261_interleave_fmt(void *dst, const s32 *const *src,
+                                                  unsigned int arrays,
+                                                  unsigned int channels,
+                                                  unsigned int frames, const int fmt)
+{
+    const unsigned int width = arrays * channels;
+    unsigned int n, a, c;
+
+    /* Масив за масивом: перевірка на NULL - раз на масив, а не на семпл */
+    for (a = 0; a < arrays; a++) {
+        const s32 *s = src[a];
+        unsigned int i = a * channels;
+
+        for (n = 0; n < frames; n++, i += width)
+            for (c = 0; c < channels; c++)
+                msm261_store_sample(dst, i + c, s ? s[n * channels + c] : 0, fmt);
+    }
+}
+
+/*
+ * Кадри кількох масивів (channels каналів S32 кожен) в один кадр формату
+ * fmt: канал a * channels + c - канал c масиву a. Масив без даних
+ * (src[a] == NULL) дає тишу, тож порядок каналів не зсувається.
+ */
+void msm261_interleave(void *dst, int fmt, const s32 *const *src, unsigned int arrays,
+                       unsigned int channels, unsigned int frames)
+{
+    switch (fmt) {
+    case MSM261_FMT_S16:
+        msm261_interleave_fmt(dst, src, arrays, channels, frames, MSM261_FMT_S16);
+        break;
+    case MSM261_FMT_S24:
+        msm261_interleave_fmt(dst, src, arrays, channels, frames, MSM261_FMT_S24);
+        break;
+    case MSM261_FMT_S24_3:
+        msm261_interleave_fmt(dst, src, arrays, channels, frames, MSM261_FMT_S24_3);
+        break;
+    case MSM261_FMT_S32:
+        msm261_interleave_fmt(dst, src, arrays, channels, frames, MSM261_FMT_S32);
+        break;
+    }
+}
+
+/* Стан детектора з нуля; блок - MSM261_VAD_BLOCK_MS на частоті rate */
+void msm261_vad_setup(struct msm261_vad *vad, unsigned int rate)
+{
+    vad->block_frames = rate * MSM261_VAD_BLOCK_MS / 1000;
+    vad->frames = 0;
+    vad->acc = 0;
+    vad->energy = 0;
+    vad->floor = 0;
+    vad->loud = 0;
+    vad->hang = 0;
+    WRITE_ONCE(vad->speech, false);
+}
+
+/* Рішення по завершеному блоку; true, якщо змінився стан мови */
+static bool msm261_vad_block(struct msm261_vad *vad)
+{
+    u32 energy = vad->acc / vad->block_frames;
+    u32 floor = vad->floor;
+    bool speech = vad->speech;
+    bool loud;
+
+    vad->acc = 0;
+    vad->frames = 0;
+    vad->energy = energy;
+
+    loud = floor && energy > (u64)floor << MSM261_VAD_THRESH_SHIFT;
+    if (!floor)
+        floor = energy;
+    else if (energy < floor)
+        floor -= (floor - energy) >> MSM261_VAD_FALL_SHIFT;
+    else
+        floor += (energy - floor) >> (speech ? MSM261_VAD_SPEECH_RISE :
+                                               MSM261_VAD_RISE_SHIFT);
+    vad->floor = floor > MSM261_VAD_FLOOR_MIN ? floor : MSM261_VAD_FLOOR_MIN;
+
+    if (loud) {
+        /* Під час мови кожен гучний блок продовжує утримання */
+        if (++vad->loud >= MSM261_VAD_ONSET || speech) {
+            speech = true;
+            vad->hang = MSM261_VAD_HANGOVER;
+        }
+    } else {
+        vad->loud = 0;
+        if (speech && !--vad->hang)
+            speech = false;
+    }
+
+    if (speech == vad->speech)
+        return false;
+    WRITE_ONCE(vad->speech, speech);
+    return true;
+}
+
+static __always_inline bool msm261_vad_feed_fmt(struct msm261_vad *vad, const void *src,
+                                                unsigned int channels, unsigned int channel,
+                                                unsigned int frames, const int fmt)
+{
+    bool changed = false;
+    unsigned int n;
+
+    for (n = 0; n < frames; n++) {
+        s32 v = msm261_load_sample(src, n * channels + channel, fmt) >> 16;
+
+        vad->acc += (u32)(v * v);
+        if (++vad->frames == vad->block_frames)
+            changed |= msm261_vad_block(vad);
+    }
+    return changed;
+}
+
+/* Канал channel кадрів src; true, якщо за ці кадри змінився стан мови */
+bool msm261_vad_feed(struct msm261_vad *vad, const void *src, int fmt,
+                     unsigned int channels, unsigned int channel, unsigned int frames)
+{
+    if (!vad->block_frames)
+        return false;
+
+    switch (fmt) {
+    case MSM261_FMT_S16:
+        return msm261_vad_feed_fmt(vad, src, channels, channel, frames, MSM261_FMT_S16);
+    case MSM261_FMT_S24:
+        return msm261_vad_feed_fmt(vad, src, channels, channel, frames, MSM261_FMT_S24);
+    case MSM261_FMT_S24_3:
+        return msm261_vad_feed_fmt(vad, src, channels, channel, frames, MSM261_FMT_S24_3);
+    case MSM261_FMT_S32:
+        return msm261_vad_feed_fmt(vad, src, channels, channel, frames, MSM261_FMT_S32);
+    }
+    return false;
+}
+
+/*
+ * Новий потік: накопичувачі з нуля на частоті rate. Вердикт лишається, тож
+ * мікрофон, що відмовив, не повертається в промінь лише через перезапуск.
+ */
+void msm261_health_setup(struct msm261_health *health, unsigned int rate)
+{
+    u8 bad = health->bad;
+
+    memset(health, 0, sizeof(*health));
+    health->block_frames = rate * MSM261_HEALTH_BLOCK_MS / 1000;
+    health->bad = bad;
+}
+
+/* Медіана енергій каналів, n <= NUM_MICS */
+static u64 msm261_health_median(const u64 *energy, unsigned int n)
+{
+    u64 e[NUM_MICS];
+    unsigned int i, j;
+
+    for (i = 0; i < n; i++) {
+        for (j = i; j && e[j - 1] > energy[i]; j--)
+            e[j] = e[j - 1];
+        e[j] = energy[i];
+    }
+    return e[n / 2];
+}
+
+/* Вади завершеного блоку і вердикт; true, якщо змінилася маска поганих */
+static bool msm261_health_block(struct msm261_health *h, const u8 *chan_mic,
+                                unsigned int mics)
+{
+    const unsigned int frames = h->block_frames;
+    u64 energy[NUM_MICS], median;
+    unsigned int c, clipping = 0;
+    u8 bad = h->bad;
+
+    for (c = 0; c < mics; c++) {
+        energy[c] = div64_u64(h->energy[c], frames);
+        if (h->clips[c] > frames >> MSM261_HEALTH_CLIP_SHIFT)
+            clipping++;
+    }
+    median = msm261_health_median(energy, mics);
+
+    for (c = 0; c < mics; c++) {
+        unsigned int m = chan_mic[c];
+        s64 mean = div_s64(h->sum[c], frames);
+        u8 faults = 0;
+
+        if (energy[c] < MSM261_HEALTH_SILENT)
+            faults |= MSM261_HEALTH_SILENT_FAULT;
+        if (h->repeats[c] >= frames / 2)
+            faults |= MSM261_HEALTH_STUCK;
+        if (mean > MSM261_HEALTH_DC || mean < -MSM261_HEALTH_DC)
+            faults |= MSM261_HEALTH_DC_FAULT;
+        /* Гучне джерело перевантажує всі мікрофони - це не вада одного */
+        if (h->clips[c] > frames >> MSM261_HEALTH_CLIP_SHIFT && clipping * 2 < mics)
+            faults |= MSM261_HEALTH_CLIPPING;
+        /* Рівень порівнюється, лише коли є з чим: хоч три мікрофони і не тиша */
+        if (mics >= 3 && median >= MSM261_HEALTH_SILENT &&
+            (energy[c] * MSM261_HEALTH_LEVEL_RATIO < median ||
+             energy[c] > median * MSM261_HEALTH_LEVEL_RATIO))
+            faults |= MSM261_HEALTH_LEVEL;
+        h->faults[m] = faults;
+
+        if (!faults == !(bad & BIT(m)))
+            h->count[m] = 0;
+        else if (++h->count[m] >= (bad & BIT(m) ? MSM261_HEALTH_GOOD_BLOCKS :
+                                                  MSM261_HEALTH_BAD_BLOCKS)) {
+            bad ^= BIT(m);
+            h->count[m] = 0;
+        }
+
+        h->sum[c] = 0;
+        h->energy[c] = 0;
+        h->repeats[c] = 0;
+        h->clips[c] = 0;
+    }
+    h->frames = 0;
+
+    if (bad == h->bad)
+        return false;
+    WRITE_ONCE(h->bad, bad);
+    return true;
+}
+
+/*
+ * Накопичувачі - у локальних змінних на весь шматок: записи в стан інакше
+ * могли б перекриватися з семплами src і змушували б перечитувати їх.
+ */
+static __always_inline void msm261_health_acc(struct msm261_health *h, const void *src,
+                                              unsigned int first, unsigned int channels,
+                                              unsigned int mics, unsigned int frames,
+                                              const int fmt)
+{
+    s64 sum[NUM_MICS];
+    u64 energy[NUM_MICS];
+    s32 last[NUM_MICS];
+    u32 repeats[NUM_MICS], clips[NUM_MICS];
+    unsigned int n, c;
+
+    for (c = 0; c < mics; c++) {
+        sum[c] = h->sum[c];
+        energy[c] = h->energy[c];
+        last[c] = h->last[c];
+        repeats[c] = h->repeats[c];
+        clips[c] = h->clips[c];
+    }
+
+    for (n = first; n < first + frames; n++) {
+        for (c = 0; c < mics; c++) {
+            s32 x = msm261_load_sample(src, n * channels + c, fmt);
+            s32 v = x >> 8;
+
+            sum[c] += v;
+            energy[c] += (s64)v * v;
+            repeats[c] += x == last[c];
+            last[c] = x;
+            clips[c] += x >= MSM261_HEALTH_CLIP || x <= -MSM261_HEALTH_CLIP;
+        }
+    }
+
+    for (c = 0; c < mics; c++) {
+        h->sum[c] = sum[c];
+        h->energy[c] = energy[c];
+        h->last[c] = last[c];
+        h->repeats[c] = repeats[c];
+        h->clips[c] = clips[c];
+    }
+}
+
+static __always_inline bool msm261_health_feed_fmt(struct msm261_health *h,
+                                                   const u8 *chan_mic, const void *src,
+                                                   unsigned int channels, unsigned int mics,
+                                                   unsigned int frames, const int fmt)
+{
+    bool changed = false;
+    unsigned int done, n;
+
+    for (done = 0; done < frames; done += n) {
+        n = min_t(unsigned int, frames - done, h->block_frames - h->frames);
+        msm261_health_acc(h, src, done, channels, mics, n, fmt);
+        h->frames += n;
+        if (h->frames == h->block_frames)
+            changed |= msm261_health_block(h, chan_mic, mics);
+    }
+    return changed;
+}
+
+/*
+ * Сирі кадри src: перші mics каналів - мікрофони chan_mic[]. true, якщо за
+ * ці кадри змінилася маска поганих мікрофонів.
+ */
+bool msm261_health_feed(struct msm261_health *health, const u8 *chan_mic, const void *src,
+                        int fmt, unsigned int channels, unsigned int mics,
+                        unsigned int frames)
+{
+    if (!health->block_frames || !mics)
+        return false;
+
+    switch (fmt) {
+    case MSM261_FMT_S16:
+        return msm261_health_feed_fmt(health, chan_mic, src, channels, mics, frames,
+                                      MSM261_FMT_S16);
+    case MSM261_FMT_S24:
+        return msm261_health_feed_fmt(health, chan_mic, src, channels, mics, frames,
+                                      MSM261_FMT_S24);
+    case MSM261_FMT_S24_3:
+        return msm261_health_feed_fmt(health, chan_mic, src, channels, mics, frames,
+                                      MSM261_FMT_S24_3);
+    case MSM261_FMT_S32:
+        return msm261_health_feed_fmt(health, chan_mic, src, channels, mics, frames,
+                                      MSM261_FMT_S32);
+    }
+    return false;
+}
+
+/*
+ * Монітор вимкнено: без нових блоків вердикт застаріє, а промінь і DOA далі
+ * обходили б мікрофон. Скидає вердикт і недобраний блок; true, якщо був вердикт.
+ */
+bool msm261_health_clear(struct msm261_health *health)
+{
+    unsigned int block_frames = health->block_frames;
+    bool changed = health->bad;
+    unsigned int m;
+
+    for (m = 0; m < NUM_MICS; m++)
+        changed |= health->faults[m];
+    if (!changed && !health->frames)
+        return false;
+
+    memset(health, 0, sizeof(*health));
+    health->block_frames = block_frames;
+    return changed;
+}
+
+void msm261_drift_reset(struct msm261_drift *drift, unsigned int rate)
+{
+    memset(drift, 0, sizeof(*drift));
+    drift->rate = rate;
+}
+
+/*
+ * Точка (кадрів масиву від старту, нс системного годинника в момент
+ * останнього з них). true, якщо оцінка оновилася.
+ */
+bool msm261_drift_feed(struct msm261_drift *drift, u64 frames, u64 ns)
+{
+    unsigned int oldest;
+    s64 dt, err, limit;
+    s32 ppb;
+
+    if (drift->count && ns - drift->ns[drift->head] < MSM261_DRIFT_INTERVAL_NS)
+        return false;
+
+    drift->head = (drift->head + 1) % MSM261_DRIFT_POINTS;
+    drift->frames[drift->head] = frames;
+    drift->ns[drift->head] = ns;
+    if (drift->count < MSM261_DRIFT_POINTS)
+        drift->count++;
+    if (drift->count < 2)
+        return false;
+
+    /* Час цих кадрів за номінальною частотою проти виміряного */
+    oldest = (drift->head + MSM261_DRIFT_POINTS + 1 - drift->count) % MSM261_DRIFT_POINTS;
+    dt = ns - drift->ns[oldest];
+    err = div_u64((frames - drift->frames[oldest]) * NSEC_PER_SEC, drift->rate) - dt;
+    limit = div_s64(dt * MSM261_DRIFT_PPB_MAX, NSEC_PER_SEC);
+    err = clamp_t(s64, err, -limit, limit);
+
+    ppb = div64_s64(err * NSEC_PER_SEC, dt);
+    if (ppb == drift->ppb)
+        return false;
+    drift->ppb = ppb;
+    return true;
+}
+
+/*
+ * Таблиці наведення променя для заданої частоти дискретизації.
+ * Плоска хвиля з напрямку theta приходить на мікрофон кільця під кутом phi
+ * раніше за центр на r*cos(theta - phi)/c, тож його затримуємо на
+ * 1 + r/c * (1 + cos(theta - phi)) семплів; центральний - на 1 + r/c.
+ * Дробову частину реалізує 4-точковий фільтр Лагранжа на вузлах D-1..D+2.
+ * Промінь читає сирі семпли, тож поправки калібрування входять у затримки
+ * і ваги: при 48 кГц найбільша затримка ~20 семплів, у межах історії.
+ */
+void msm261_beam_build(struct msm261_beam *beam, unsigned int rate,
+                       const struct msm261_params *p)
+{
+    /* r/c у семплах, Q16 */
+    u64 r_q16 = div_u64((u64)MSM261_ARRAY_RADIUS_UM * rate << 16,
+                        MSM261_SPEED_OF_SOUND_UM);
+    unsigned int dir, m, k;
+
+    for (dir = 0; dir < MSM261_BEAM_DIRECTIONS; dir++) {
+        struct msm261_beam_steer *st = &beam->steer[dir];
+
+        for (m = 0; m < NUM_MICS; m++) {
+            s64 cos_q31 = 0, f, w[MSM261_BEAM_TAPS];
+            u64 delay_q16;
+
+            if (m != MSM261_CENTER_MIC)
+                cos_q31 = fixp_cos32(dir * MSM261_BEAM_STEP_DEG -
+                                     m * MSM261_RING_STEP_DEG);
+
+            delay_q16 = (1 << 16) + ((r_q16 * ((1LL << 31) + cos_q31)) >> 31) +
+                        ((u64)p->cal_delay[m] << 16);
+            st->delay[m] = delay_q16 >> 16;
+            f = delay_q16 & 0xffff;
+
+            /* Ваги Лагранжа у Q16 для вузлів -1, 0, 1, 2 */
+            w[0] = -((((f * (f - 65536)) >> 16) * (f - 131072)) >> 16) / 6;
+            w[1] = ((((f + 65536) * (f - 65536)) >> 16) * (f - 131072) >> 16) / 2;
+            w[2] = -((((f + 65536) * f) >> 16) * (f - 131072) >> 16) / 2;
+            w[3] = ((((f + 65536) * f) >> 16) * (f - 65536) >> 16) / 6;
+
+            for (k = 0; k < MSM261_BEAM_TAPS; k++)
+                st->weight[m][k] = div_s64(w[k] * p->cal_gain[m],
+                                           NUM_MICS * MSM261_CAL_ONE);
+        }
+    }
+
+    memset(beam->history, 0, sizeof(beam->history));
+    beam->pos = 0;
+}
+
+/* Q15 e^{-j*2*pi*k/N}: { cos, -sin } для k < N/2 */
+static const s16 msm261_fft_twiddle[MSM261_DOA_FFT_SIZE / 2][2] = {
+    {  32767,      0 }, {  32758,   -804 }, {  32729,  -1608 }, {  32679,  -2411 },
+    {  32610,  -3212 }, {  32522,  -4011 }, {  32413,  -4808 }, {  32286,  -5602 },
+    {  32138,  -6393 }, {  31972,  -7180 }, {  31786,  -7962 }, {  31581,  -8740 },
+    {  31357,  -9512 }, {  31114, -10279 }, {  30853, -11039 }, {  30572, -11793 },
+    {  30274, -12540 }, {  29957, -13279 }, {  29622, -14010 }, {  29269, -14733 },
+    {  28899, -15447 }, {  28511, -16151 }, {  28106, -16846 }, {  27684, -17531 },
+    {  27246, -18205 }, {  26791, -18868 }, {  26320, -19520 }, {  25833, -20160 },
+    {  25330, -20788 }, {  24812, -21403 }, {  24279, -22006 }, {  23732, -22595 },
+    {  23170, -23170 }, {  22595, -23732 }, {  22006, -24279 }, {  21403, -24812 },
+    {  20788, -25330 }, {  20160, -25833 }, {  19520, -26320 }, {  18868, -26791 },
+    {  18205, -27246 }, {  17531, -27684 }, {  16846, -28106 }, {  16151, -28511 },
+    {  15447, -28899 }, {  14733, -29269 }, {  14010, -29622 }, {  13279, -29957 },
+    {  12540, -30274 }, {  11793, -30572 }, {  11039, -30853 }, {  10279, -31114 },
+    {   9512, -31357 }, {   8740, -31581 }, {   7962, -31786 }, {   7180, -31972 },
+    {   6393, -32138 }, {   5602, -32286 }, {   4808, -32413 }, {   4011, -32522 },
+    {   3212, -32610 }, {   2411, -32679 }, {   1608, -32729 }, {    804, -32758 },
+    {      0, -32767 }, {   -804, -32758 }, {  -1608, -32729 }, {  -2411, -32679 },
+    {  -3212, -32610 }, {  -4011, -32522 }, {  -4808, -32413 }, {  -5602, -32286 },
+    {  -6393, -32138 }, {  -7180, -31972 }, {  -7962, -31786 }, {  -8740, -31581 },
+    {  -9512, -31357 }, { -10279, -31114 }, { -11039, -30853 }, { -11793, -30572 },
+    { -12540, -30274 }, { -13279, -29957 }, { -14010, -29622 }, { -14733, -29269 },
+    { -15447, -28899 }, { -16151, -28511 }, { -16846, -28106 }, { -17531, -27684 },
+    { -18205, -27246 }, { -18868, -26791 }, { -19520, -26320 }, { -20160, -25833 },
+    { -20788, -25330 }, { -21403, -24812 }, { -22006, -24279 }, { -22595, -23732 },
+    { -23170, -23170 }, { -23732, -22595 }, { -24279, -22006 }, { -24812, -21403 },
+    { -25330, -20788 }, { -25833, -20160 }, { -26320, -19520 }, { -26791, -18868 },
+    { -27246, -18205 }, { -27684, -17531 }, { -28106, -16846 }, { -28511, -16151 },
+    { -28899, -15447 }, { -29269, -14733 }, { -29622, -14010 }, { -29957, -13279 },
+    { -30274, -12540 }, { -30572, -11793 }, { -30853, -11039 }, { -31114, -10279 },
+    { -31357,  -9512 }, { -31581,  -8740 }, { -31786,  -7962 }, { -31972,  -7180 },
+    { -32138,  -6393 }, { -32286,  -5602 }, { -32413,  -4808 }, { -32522,  -4011 },
+    { -32610,  -3212 }, { -32679,  -2411 }, { -32729,  -1608 }, { -32758,   -804 },
+};
+
+static inline void msm261_twiddle(unsigned int idx, s32 *c, s32 *s)
+{
+    idx &= MSM261_DOA_FFT_SIZE - 1;
+    if (idx < MSM261_DOA_FFT_SIZE / 2) {
+        *c = msm261_fft_twiddle[idx][0];
+        *s = -msm261_fft_twiddle[idx][1];
+    } else {
+        *c = -msm261_fft_twiddle[idx - MSM261_DOA_FFT_SIZE / 2][0];
+        *s = msm261_fft_twiddle[idx - MSM261_DOA_FFT_SIZE / 2][1];
+    }
+}
+
+/* Комплексне FFT на місці, radix-2, з масштабуванням 1/2 на кожному етапі */
+static void msm261_fft(s32 (*x)[2])
+{
+    const unsigned int n = MSM261_DOA_FFT_SIZE;
+    unsigned int i, j, len, k;
+
+    for (i = 1, j = 0; i < n; i++) {
+        unsigned int bit = n >> 1;
+
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j) {
+            swap(x[i][0], x[j][0]);
+            swap(x[i][1], x[j][1]);
+        }
+    }
+
+    for (len = 2; len <= n; len <<= 1) {
+        unsigned int half = len >> 1, step = n / len;
+
+        for (i = 0; i < n; i += len) {
+            for (k = 0; k < half; k++) {
+                s32 wr = msm261_fft_twiddle[k * step][0];
+                s32 wi = msm261_fft_twiddle[k * step][1];
+                s32 *a = x[i + k], *b = x[i + k + half];
+                s32 tr = ((s64)b[0] * wr - (s64)b[1] * wi) >> 15;
+                s32 ti = ((s64)b[0] * wi + (s64)b[1] * wr) >> 15;
+
+                b[0] = (a[0] - tr) >> 1;
+                b[1] = (a[1] - ti) >> 1;
+                a[0] = (a[0] + tr) >> 1;
+                a[1] = (a[1] + ti) >> 1;
+            }
+        }
+    }
+}
+
+/* Вікно Ханна + FFT + нормування кожного біна до одиничної амплітуди (PHAT) */
+static void msm261_doa_spectrum(struct msm261_doa *doa, unsigned int mic, s32 (*x)[2])
+{
+    unsigned int n, k;
+
+    for (n = 0; n < MSM261_DOA_FFT_SIZE; n++) {
+        /* Затримка калібрування зсуває вікно; загорнутий край гасить вікно Ханна */
+        unsigned int idx = (doa->window_pos + 1 + n - doa->delay[mic]) &
+                           (MSM261_DOA_FFT_SIZE - 1);
+        s32 c, s;
+
+        msm261_twiddle(n, &c, &s);
+        x[n][0] = ((s64)doa->window[idx][mic] * (32768 - c)) >> 16;
+        x[n][1] = 0;
+    }
+
+    msm261_fft(x);
+
+    for (k = 1; k < MSM261_DOA_FFT_SIZE / 2; k++) {
+        s64 re = x[k][0], im = x[k][1];
+        u32 mag = int_sqrt64(re * re + im * im);
+
+        if (!mag) {
+            x[k][0] = x[k][1] = 0;
+            continue;
+        }
+        x[k][0] = div_s64(re << 15, mag);
+        x[k][1] = div_s64(im << 15, mag);
+    }
+}
+
+/* Таблиця очікуваних затримок пар (Q8 семплів) для кожного напрямку */
+void msm261_doa_build(struct msm261_doa *doa, unsigned int rate,
+                      const struct msm261_params *params)
+{
+    u64 r_q16 = div_u64((u64)MSM261_ARRAY_RADIUS_UM * rate << 16,
+                        MSM261_SPEED_OF_SOUND_UM);
+    unsigned int dir, p;
+
+    for (dir = 0; dir < MSM261_BEAM_DIRECTIONS; dir++) {
+        for (p = 0; p < MSM261_DOA_PAIRS; p++) {
+            s64 cos_q31 = fixp_cos32(dir * MSM261_BEAM_STEP_DEG -
+                                     p * MSM261_RING_STEP_DEG);
+
+            /* TDOA між мікрофонами p і p + 3 = -2r/c * cos(theta - phi_p) */
+            doa->lag_q8[dir][p] = -(((2 * r_q16 * cos_q31) >> 31) >> 8);
+        }
+    }
+
+    /* PHAT нормує амплітуду, тож з калібрування потрібні лише затримки */
+    for (p = 0; p < MSM261_DOA_RING_MICS; p++)
+        doa->delay[p] = params->cal_delay[p];
+
+    doa->max_lag = min_t(unsigned int, (2 * r_q16 >> 16) + 2, MSM261_DOA_MAX_LAG);
+    doa->ring_pos = 0;
+    doa->filled = 0;
+    doa->frames_since = 0;
+    doa->excluded = 0;
+    doa->pending = false;
+    memset(doa->cross, 0, sizeof(doa->cross));
+}
+
+static s32 msm261_doa_corr_at(const s32 *corr, s32 lag_q8)
+{
+    s32 li = lag_q8 >> 8, frac = lag_q8 & 0xff;
+
+    li = clamp_t(s32, li, -MSM261_DOA_MAX_LAG, MSM261_DOA_MAX_LAG - 1);
+    corr += li + MSM261_DOA_MAX_LAG;
+    return corr[0] + (((s64)(corr[1] - corr[0]) * frac) >> 8);
+}
+
+/*
+ * Одне оновлення оцінки з вікна, яке поклала обробка: крос-спектри пар, GCC
+ * для допустимих лагів, пошук напрямку. Пари з поганим мікрофоном
+ * пропускаються; без жодної пари напрямок лишається старим, а впевненість -
+ * нуль. Без нового вікна нічого не робить; одночасно - лише один виклик.
+ */
+void msm261_doa_update(struct msm261_doa *doa)
+{
+    const s32 corr_max = (MSM261_DOA_FFT_SIZE / 2 - 1) * 32767;
+    unsigned int p, k, dir, best_dir = 0, used = 0, pairs = 0;
+    s64 best = S64_MIN;
+    int lag;
+
+    if (!smp_load_acquire(&doa->pending))
+        return;
+
+    for (p = 0; p < MSM261_DOA_PAIRS; p++) {
+        s32 (*a)[2] = doa->spec[0], (*b)[2] = doa->spec[1];
+
+        if (doa->excluded & (BIT(p) | BIT(p + MSM261_DOA_PAIRS)))
+            continue;
+        pairs |= BIT(p);
+        used++;
+
+        msm261_doa_spectrum(doa, p, a);
+        msm261_doa_spectrum(doa, p + MSM261_DOA_PAIRS, b);
+
+        for (k = 1; k < MSM261_DOA_FFT_SIZE / 2; k++) {
+            s32 cr = ((s64)a[k][0] * b[k][0] + (s64)a[k][1] * b[k][1]) >> 15;
+            s32 ci = ((s64)a[k][1] * b[k][0] - (s64)a[k][0] * b[k][1]) >> 15;
+
+            doa->cross[p][k][0] += (cr - doa->cross[p][k][0]) >> MSM261_DOA_SMOOTH_SHIFT;
+            doa->cross[p][k][1] += (ci - doa->cross[p][k][1]) >> MSM261_DOA_SMOOTH_SHIFT;
+        }
+
+        /* r(lag) = sum Re(G[k] * e^{j*2*pi*k*lag/N}) лише для фізично можливих лагів */
+        for (lag = -(int)doa->max_lag; lag <= (int)doa->max_lag; lag++) {
+            s64 acc = 0;
+
+            for (k = 1; k < MSM261_DOA_FFT_SIZE / 2; k++) {
+                s32 c, s;
+
+                msm261_twiddle(k * lag, &c, &s);
+                acc += (s64)doa->cross[p][k][0] * c - (s64)doa->cross[p][k][1] * s;
+            }
+            doa->corr[p][lag + MSM261_DOA_MAX_LAG] = acc >> 15;
+        }
+    }
+
+    for (dir = 0; dir < MSM261_BEAM_DIRECTIONS; dir++) {
+        s64 score = 0;
+
+        for (p = 0; p < MSM261_DOA_PAIRS; p++)
+            if (pairs & BIT(p))
+                score += msm261_doa_corr_at(doa->corr[p], doa->lag_q8[dir][p]);
+        if (score > best) {
+            best = score;
+            best_dir = dir;
+        }
+    }
+
+    if (!used) {
+        WRITE_ONCE(doa->confidence, 0);
+    } else {
+        WRITE_ONCE(doa->azimuth, best_dir * MSM261_BEAM_STEP_DEG);
+        WRITE_ONCE(doa->confidence,
+                   clamp_t(s64, div_s64(best * 100, (s32)used * corr_max), 0, 100));
+    }
+    /* Вікно прочитано: обробка може класти наступне */
+    smp_store_release(&doa->pending, false);
+}
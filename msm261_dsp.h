@@ -0,0 +1,577 @@
+#ifndef MSM261_DSP_H
+#define MSM261_DSP_H
+
+/*
+ * Обробка сигналу масиву без залежностей від ALSA: той самий код збирається
+ * у модуль і в msm261_bench (make bench), щоб міряти його на будь-якій машині.
+ */
+#ifdef __KERNEL__
+
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/math64.h>
+#include <linux/time64.h>
+#include <linux/fixp-arith.h>
+
+#ifdef CONFIG_ARCH_HAS_KERNEL_FPU_SUPPORT
+#include <linux/fpu.h>
+#define MSM261_DSP_SIMD
+#define msm261_dsp_fpu_available()  kernel_fpu_available()
+#define msm261_dsp_fpu_begin()      kernel_fpu_begin()
+#define msm261_dsp_fpu_end()        kernel_fpu_end()
+#endif
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+#define MSM261_DSP_NEON
+#endif
+
+#else /* !__KERNEL__ */
+
+/* Мінімальна заміна ядерних типів і хелперів для userspace-збірки */
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+typedef int8_t s8;
+typedef uint8_t u8;
+typedef int16_t s16;
+typedef uint16_t u16;
+typedef int32_t s32;
+typedef uint32_t u32;
+typedef int64_t s64;
+typedef uint64_t u64;
+
+#define S32_MAX     INT32_MAX
+#define S32_MIN     INT32_MIN
+#define S64_MIN     INT64_MIN
+
+#ifndef __always_inline
+#define __always_inline inline __attribute__((__always_inline__))
+#endif
+
+#define ARRAY_SIZE(a)           (sizeof(a) / sizeof((a)[0]))
+#define BIT(nr)                 (1UL << (nr))
+#define hweight32(w)            __builtin_popcount(w)
+#define READ_ONCE(x)            (*(const volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, val)      (*(volatile __typeof__(x) *)&(x) = (val))
+#define smp_load_acquire(p)     __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define min_t(type, a, b)       ((type)(a) < (type)(b) ? (type)(a) : (type)(b))
+#define clamp_t(type, v, lo, hi) \
+    ((type)(v) < (type)(lo) ? (type)(lo) : (type)(v) > (type)(hi) ? (type)(hi) : (type)(v))
+#define swap(a, b) \
+    do { __typeof__(a) __tmp = (a); (a) = (b); (b) = __tmp; } while (0)
+
+#define pr_info(fmt, ...)   fprintf(stderr, fmt, ##__VA_ARGS__)
+#define pr_warn(fmt, ...)   fprintf(stderr, fmt, ##__VA_ARGS__)
+
+static inline u64 div_u64(u64 dividend, u32 divisor) { return dividend / divisor; }
+static inline s64 div_s64(s64 dividend, s32 divisor) { return dividend / divisor; }
+static inline u64 div64_u64(u64 dividend, u64 divisor) { return dividend / divisor; }
+static inline s64 div64_s64(s64 dividend, s64 divisor) { return dividend / divisor; }
+
+#define NSEC_PER_SEC    1000000000L
+
+/* Те саме порозрядне округлення вниз, що й у lib/math/int_sqrt.c */
+static inline u32 int_sqrt64(u64 x)
+{
+    u64 b, m, y = 0;
+
+    if (x <= 1)
+        return x;
+
+    m = 1ULL << ((63 - __builtin_clzll(x)) & ~1);
+    while (m) {
+        b = y + m;
+        y >>= 1;
+        if (x >= b) {
+            x -= b;
+            y += m;
+        }
+        m >>= 2;
+    }
+    return y;
+}
+
+/* Таблиця ядра - sin з кроком 1 градус у Q31, для цілих градусів це те саме */
+static inline s32 fixp_cos32(int degrees)
+{
+    return (s32)lround(cos(degrees * M_PI / 180.0) * 2147483647.0);
+}
+
+#define MSM261_DSP_SIMD
+#define msm261_dsp_fpu_available()  true
+#define msm261_dsp_fpu_begin()      do { } while (0)
+#define msm261_dsp_fpu_end()        do { } while (0)
+
+#ifdef __ARM_NEON
+#define MSM261_DSP_NEON
+#endif
+
+#endif /* __KERNEL__ */
+
+#define NUM_MICS        7
+#define NUM_DATA_LINES  4
+#define MSM261_SLOTS_PER_LINE   2   /* L/R слоти на кожній лінії даних */
+#define NUM_SLOTS       (NUM_DATA_LINES * MSM261_SLOTS_PER_LINE)
+
+/*
+ * Вільний восьмий слот (R лінії DATA3) несе віртуальний канал променя
+ * delay-and-sum, тому потік може мати NUM_MICS + 1 каналів.
+ */
+#define MSM261_BEAM_CHANNEL     NUM_MICS
+#define MSM261_CHANNELS_MAX     (NUM_MICS + 1)
+
+/* Маска вибору мікрофонів: біт m - MIC(m + 1) */
+#define MSM261_MIC_MASK_ALL     ((1u << NUM_MICS) - 1)
+
+/* Режими мікрофонів і їхні діапазони BCLK */
+#define MSM261_MODE_NORMAL      0
+#define MSM261_MODE_LOW_POWER   1
+
+#define MSM261_NORMAL_MODE_MIN_CLK   1000000  /* 1.0 MHz */
+#define MSM261_NORMAL_MODE_MAX_CLK   4000000  /* 4.0 MHz */
+#define MSM261_LOW_POWER_MIN_CLK     150000   /* 150 kHz */
+#define MSM261_LOW_POWER_MAX_CLK     800000   /* 800 kHz */
+
+/* Частота масиву і до MSM261_DECIM_RATES частот, що віддаються децимацією */
+#define MSM261_DECIM_RATES      2
+#define MSM261_RATES_MAX        (MSM261_DECIM_RATES + 1)
+
+/*
+ * Чому не можна відкрити споживача (msm261_open_check(), msm261_share_check()).
+ * Рішення без стану ALSA, тож їх перевіряє і стенд; повідомлення і коди
+ * помилок - у драйвері.
+ */
+enum msm261_open_err {
+    MSM261_OPEN_OK,
+    MSM261_OPEN_CHANNELS,       /* каналів більше, ніж вибрано; промінь - лише з усіх */
+    MSM261_OPEN_MASK,           /* неповний вибір без ліній даних */
+    MSM261_OPEN_SLOTS,          /* мікрофони каналів не влазять у кадр DMA */
+    MSM261_OPEN_BUSY,           /* потік групи ні з ким не ділить масив */
+    MSM261_OPEN_GROUP_MASK,     /* потік групи - лише з усіма мікрофонами */
+    MSM261_OPEN_RATE,           /* масив уже йде на іншій частоті */
+};
+
+/*
+ * Слот = лінія * MSM261_SLOTS_PER_LINE + (0 - L, 1 - R). Типова розкладка
+ * плати: мікрофон i на лінії i % NUM_DATA_LINES, перші чотири у лівому слоті.
+ */
+#define MSM261_DEFAULT_SLOT(mic) \
+    (((mic) % NUM_DATA_LINES) * MSM261_SLOTS_PER_LINE + (mic) / NUM_DATA_LINES)
+
+/*
+ * Демультиплексор обробляє блоки по стільки кадрів: для S32 вхід (4 лінії
+ * по 2 слоти) і вихід блоку займають 16 КіБ і разом лишаються у L1.
+ */
+#define MSM261_DEMUX_BLOCK      256
+
+/* Геометрія плати: 6 мікрофонів по колу через 60 градусів + центральний */
+#define MSM261_CENTER_MIC           (NUM_MICS - 1)
+#define MSM261_RING_STEP_DEG        60
+#define MSM261_ARRAY_RADIUS_UM      40000
+#define MSM261_SPEED_OF_SOUND_UM    343000000   /* мкм/с */
+
+/* Таблиці наведення променя: напрямок з кроком MSM261_BEAM_STEP_DEG */
+#define MSM261_BEAM_STEP_DEG    5
+#define MSM261_BEAM_DIRECTIONS  (360 / MSM261_BEAM_STEP_DEG)
+#define MSM261_BEAM_TAPS        4   /* дробова затримка: Лагранж 3-го порядку */
+#define MSM261_BEAM_HISTORY     32  /* степінь двійки, > максимальна затримка + TAPS */
+
+struct msm261_beam_steer {
+    u8 delay[NUM_MICS];                         /* ціла частина затримки, семпли */
+    s32 weight[NUM_MICS][MSM261_BEAM_TAPS];     /* Q16, вже поділені на NUM_MICS */
+};
+
+struct msm261_beam {
+    struct msm261_beam_steer steer[MSM261_BEAM_DIRECTIONS];
+    s32 history[MSM261_BEAM_HISTORY][NUM_MICS];
+    unsigned int pos;
+};
+
+/*
+ * Оцінка напрямку (GCC-PHAT) по трьох протилежних парах мікрофонів кільця.
+ * Крос-спектри усереднюються рекурсивно, оновлення - раз на період. Обробка
+ * лише кладе останні MSM261_DOA_FFT_SIZE кадрів у window; FFT і пошук
+ * напрямку робить msm261_doa_update() поза гарячим шляхом (у драйвері -
+ * робота), поки pending, нове вікно не пишеться.
+ */
+#define MSM261_DOA_FFT_ORDER    8
+#define MSM261_DOA_FFT_SIZE     (1 << MSM261_DOA_FFT_ORDER)
+#define MSM261_DOA_RING_MICS    (NUM_MICS - 1)
+#define MSM261_DOA_PAIRS        (MSM261_DOA_RING_MICS / 2)
+#define MSM261_DOA_MAX_LAG      16
+#define MSM261_DOA_SMOOTH_SHIFT 2   /* вага нового крос-спектра 1/4 */
+#define MSM261_DOA_MIN_INTERVAL (MSM261_DOA_FFT_SIZE / 2)  /* кадрів між оновленнями */
+
+struct msm261_doa {
+    s32 ring[MSM261_DOA_FFT_SIZE][MSM261_DOA_RING_MICS];   /* Q23 */
+    unsigned int ring_pos;
+    unsigned int filled;
+    unsigned int frames_since;
+    s32 spec[2][MSM261_DOA_FFT_SIZE][2];
+    s32 cross[MSM261_DOA_PAIRS][MSM261_DOA_FFT_SIZE / 2][2];    /* Q15 */
+    s32 corr[MSM261_DOA_PAIRS][2 * MSM261_DOA_MAX_LAG + 1];
+    s16 lag_q8[MSM261_BEAM_DIRECTIONS][MSM261_DOA_PAIRS];
+    u8 delay[MSM261_DOA_RING_MICS];     /* поправки затримки з калібрування */
+    s32 window[MSM261_DOA_FFT_SIZE][MSM261_DOA_RING_MICS];
+    unsigned int window_pos;            /* ring_pos знімка */
+    u8 excluded;                        /* погані мікрофони, пари з ними не рахуються */
+    bool pending;                       /* window чекає на msm261_doa_update() */
+    unsigned int max_lag;
+    unsigned int azimuth;       /* градуси */
+    unsigned int confidence;    /* 0..100 */
+};
+
+/*
+ * Каскад біквадів для зрізання DC і низькочастотного гулу MEMS-мікрофонів.
+ * Коефіцієнти Q30 з a0 = 1: y = b0*x + b1*x1 + b2*x2 - a1*y1 - a2*y2.
+ * Стан лежить як [ланка][змінна][канал], щоб канали кадру йшли поруч.
+ */
+#define MSM261_HPF_STAGES       2
+#define MSM261_HPF_COEF_SHIFT   30
+#define MSM261_HPF_ONE          (1 << MSM261_HPF_COEF_SHIFT)
+
+struct msm261_biquad_coef {
+    s32 b0, b1, b2, a1, a2;
+};
+
+enum { MSM261_HPF_X1, MSM261_HPF_X2, MSM261_HPF_Y1, MSM261_HPF_Y2, MSM261_HPF_VARS };
+
+struct msm261_hpf {
+    s32 state[MSM261_HPF_STAGES][MSM261_HPF_VARS][MSM261_CHANNELS_MAX];
+};
+
+/*
+ * Калібрування мікрофонів: поправки підсилення (Q12) і цілої затримки, з DT
+ * або файлу прошивки. Застосовуються в тому ж проході, що й підсилення.
+ */
+#define MSM261_CAL_SHIFT        12
+#define MSM261_CAL_ONE          (1 << MSM261_CAL_SHIFT)
+#define MSM261_CAL_DELAY_MAX    7
+#define MSM261_CAL_HISTORY      8   /* степінь двійки, > MSM261_CAL_DELAY_MAX */
+
+struct msm261_cal {
+    s32 history[MSM261_CAL_HISTORY][NUM_MICS];
+    unsigned int pos;
+};
+
+/*
+ * Автоматичне підсилення (AGC) кожного каналу в тому ж проході, що й
+ * калібрування: обвідна |x| зі швидкою атакою і повільним спадом, раз на
+ * MSM261_AGC_BLOCK кадрів підсилення тягнеться до target / обвідна (не вище
+ * max), вниз одразу, вгору плавно. Нижче порогу тиші підсилення тримається,
+ * щоб не піднімати шум. Вихід проходить м'який обмежувач вище -6 дБFS.
+ * Сталі часу - у семплах, при 48 кГц атака ~1.3 мс, спад ~170 мс.
+ */
+#define MSM261_AGC_BLOCK            32  /* степінь двійки */
+#define MSM261_AGC_GAIN_SHIFT       16
+#define MSM261_AGC_GAIN_ONE         (1u << MSM261_AGC_GAIN_SHIFT)
+#define MSM261_AGC_ATTACK_SHIFT     6
+#define MSM261_AGC_RELEASE_SHIFT    13
+#define MSM261_AGC_RISE_SHIFT       4   /* блоків: підсилення вгору */
+#define MSM261_AGC_GATE             2147484     /* -60 дБFS */
+#define MSM261_AGC_KNEE             (1u << 30)  /* -6 дБFS */
+#define MSM261_AGC_DB_MAX           40
+
+struct msm261_agc {
+    u32 env[MSM261_CHANNELS_MAX];       /* обвідна, шкала s32 */
+    u32 gain[MSM261_CHANNELS_MAX];      /* Q16 */
+    unsigned int phase;                 /* кадрів від початку, для меж блоків */
+};
+
+/*
+ * Параметри обробки, які змінюються під час потоку. Опублікований блок не
+ * змінюється: писач заповнює новий і підміняє покажчик (у драйвері - RCU),
+ * а обробка отримує блок аргументом і весь виклик бачить узгоджений набір
+ * без блокувань. Стан фільтрів і ліній затримки лишається в msm261_dsp.
+ */
+struct msm261_params {
+    int software_gain;              /* фіксоване, коли AGC вимкнено */
+    bool agc_enabled;
+    u32 agc_gen;                    /* +1 на кожне увімкнення: обробка скидає стан */
+    int agc_target_db;              /* дБFS, -MSM261_AGC_DB_MAX..0 */
+    unsigned int agc_max_db;        /* 0..MSM261_AGC_DB_MAX */
+    u32 agc_target;                 /* з agc_target_db, шкала s32 */
+    u32 agc_max_gain;               /* з agc_max_db, Q16 */
+    u16 cal_gain[NUM_MICS];         /* Q12, MSM261_CAL_ONE - без змін */
+    u8 cal_delay[NUM_MICS];         /* семпли, 0..MSM261_CAL_DELAY_MAX */
+    bool cal_active;                /* є хоч одна не-одинична поправка */
+    struct msm261_biquad_coef hpf[MSM261_HPF_STAGES];
+    bool hpf_enabled;
+    u32 hpf_gen;                    /* як agc_gen */
+    unsigned int beam_dir;          /* індекс у msm261_beam.steer[] */
+    unsigned int beam_angle;        /* градуси, як задано через kcontrol */
+    bool doa_enabled;
+    bool vad_enabled;
+    bool health_enabled;
+};
+
+/*
+ * Поліфазна FIR-децимація цілим коефіцієнтом (2:1, 3:1) перед рештою
+ * обробки: фільтр рахується лише в позиціях вихідних кадрів. Коефіцієнти
+ * Q15 із сумою 1.0; history тримає TAPS_MAX - 1 попередніх кадрів перед
+ * блоком входу, тож згортка читає суцільну пам'ять.
+ */
+#define MSM261_DECIM_RATIO_MAX  3
+#define MSM261_DECIM_TAPS_MAX   72
+#define MSM261_DECIM_COEF_SHIFT 15
+#define MSM261_DECIM_BLOCK      128
+
+struct msm261_decim {
+    unsigned int ratio;             /* 1 - вимкнено */
+    unsigned int taps;
+    const s16 *coef;
+    unsigned int skip;              /* кадрів входу до наступного виходу */
+    s32 history[MSM261_DECIM_TAPS_MAX - 1 + MSM261_DECIM_BLOCK][MSM261_CHANNELS_MAX];
+};
+
+/*
+ * Детектор голосу за енергією (VAD): середня енергія одного каналу блоками по
+ * MSM261_VAD_BLOCK_MS проти рівня шуму, який швидко йде вниз і повільно
+ * вгору. Мова - після MSM261_VAD_ONSET гучних блоків поспіль, тиша - після
+ * MSM261_VAD_HANGOVER тихих. Енергія - в одиницях s16^2.
+ */
+#define MSM261_VAD_BLOCK_MS     10
+#define MSM261_VAD_THRESH_SHIFT 2   /* гучний блок: енергія > шум * 4, +6 дБ */
+#define MSM261_VAD_FLOOR_MIN    64  /* -72 дБFS: цифрова тиша не опускає поріг до нуля */
+#define MSM261_VAD_FALL_SHIFT   1
+#define MSM261_VAD_RISE_SHIFT   7   /* новий фон поглинається за ~1.3 с */
+#define MSM261_VAD_SPEECH_RISE  10  /* під час мови - за ~10 с */
+#define MSM261_VAD_ONSET        2
+#define MSM261_VAD_HANGOVER     30  /* 300 мс */
+
+struct msm261_vad {
+    unsigned int block_frames;
+    unsigned int frames;            /* кадрів у поточному блоці */
+    u64 acc;
+    u32 energy;                     /* останнього блоку */
+    u32 floor;                      /* 0 - ще не оцінено */
+    unsigned int loud;              /* гучних блоків поспіль */
+    unsigned int hang;              /* тихих блоків до кінця мови */
+    bool speech;
+};
+
+/*
+ * Дрейф тактування масиву відносно системного годинника: нахил між
+ * найстарішою і найновішою з MSM261_DRIFT_POINTS точок (кадри, нс), узятих
+ * не частіше ніж раз на MSM261_DRIFT_INTERVAL_NS. База до 15 с розмазує
+ * тремтіння моменту вимірювання, а старі точки витісняються, тож оцінка
+ * йде за повільною зміною частоти кварцу з температурою.
+ */
+#define MSM261_DRIFT_POINTS         16
+#define MSM261_DRIFT_INTERVAL_NS    1000000000LL
+#define MSM261_DRIFT_PPB_MAX        1000000     /* +-1000 ppm, далі - не дрейф */
+
+struct msm261_drift {
+    unsigned int rate;
+    u64 frames[MSM261_DRIFT_POINTS];
+    u64 ns[MSM261_DRIFT_POINTS];
+    unsigned int head;              /* найновіша точка */
+    unsigned int count;
+    s32 ppb;                        /* > 0 - масив спішить */
+};
+
+/*
+ * Стан мікрофонів у потоці: по сирих кадрах кожного мікрофона блоками по
+ * MSM261_HEALTH_BLOCK_MS - енергія, середнє (DC), скільки семплів повторює
+ * попередній (застиглий вихід) і семпли на межі шкали, а також рівень проти
+ * медіани решти мікрофонів: плата маленька, тож далеке поле всі чують майже
+ * однаково.
+ * Мікрофон поганий після MSM261_HEALTH_BAD_BLOCKS блоків з вадою поспіль і
+ * знову добрий після MSM261_HEALTH_GOOD_BLOCKS чистих. Поганих промінь і
+ * DOA не беруть. Енергія - в одиницях s24^2.
+ */
+#define MSM261_HEALTH_BLOCK_MS      100
+#define MSM261_HEALTH_BAD_BLOCKS    3
+#define MSM261_HEALTH_GOOD_BLOCKS   20
+#define MSM261_HEALTH_SILENT        7037        /* -100 дБFS */
+#define MSM261_HEALTH_DC            838861      /* середнє -20 дБFS, s24 */
+#define MSM261_HEALTH_CLIP          0x7e000000  /* |x| - за -0.14 дБFS, s32 */
+#define MSM261_HEALTH_CLIP_SHIFT    7           /* вада: більше 1/128 блоку */
+#define MSM261_HEALTH_LEVEL_RATIO   100         /* +-20 дБ від медіани */
+
+/* Вади останнього блоку, msm261_health.faults */
+#define MSM261_HEALTH_SILENT_FAULT  BIT(0)
+#define MSM261_HEALTH_STUCK         BIT(1)
+#define MSM261_HEALTH_DC_FAULT      BIT(2)
+#define MSM261_HEALTH_CLIPPING      BIT(3)
+#define MSM261_HEALTH_LEVEL         BIT(4)
+
+struct msm261_health {
+    unsigned int block_frames;
+    unsigned int frames;            /* кадрів у поточному блоці */
+    /* Накопичувачі блоку, по каналах кадру */
+    s64 sum[NUM_MICS];
+    u64 energy[NUM_MICS];
+    s32 last[NUM_MICS];
+    u32 repeats[NUM_MICS];          /* семплів, рівних попередньому */
+    u32 clips[NUM_MICS];
+    /* Вердикт, по мікрофонах */
+    u8 faults[NUM_MICS];
+    u8 count[NUM_MICS];             /* блоків поспіль проти поточного вердикту */
+    u8 bad;                         /* маска поганих мікрофонів */
+};
+
+/* Стан обробки одного потоку захоплення */
+struct msm261_dsp {
+    u8 slot_map[NUM_MICS];          /* слот лінії для кожного мікрофона */
+    u8 chan_mic[NUM_MICS];          /* мікрофон каналу потоку, msm261_dsp_select() */
+    unsigned int period_frames;     /* як часто оновлюється DOA */
+    struct msm261_beam beam;
+    struct msm261_doa *doa;
+    struct msm261_hpf hpf;
+    u32 hpf_gen;                    /* останній побачений msm261_params.hpf_gen */
+    struct msm261_cal cal;
+    struct msm261_agc agc;
+    u32 agc_gen;
+    struct msm261_vad vad;
+    struct msm261_health health;
+    u8 dead;                        /* не піднялися при включенні живлення */
+};
+
+/* Формати семплів, під які спеціалізовано обробку */
+enum {
+    MSM261_FMT_S16,
+    MSM261_FMT_S24,     /* 24 біти у 32-бітному контейнері */
+    MSM261_FMT_S24_3,   /* 24 біти, запаковано у 3 байти */
+    MSM261_FMT_S32,
+    MSM261_FMT_COUNT,
+};
+
+/* Обробка frames кадрів з src у dst, спеціалізована під формат і канали */
+typedef void (*msm261_process_fn)(struct msm261_dsp *dsp, const struct msm261_params *p,
+                                  void *dst, const void *src, unsigned int frames);
+
+#define MSM261_S24_MAX      8388607
+#define MSM261_S24_MIN      (-8388608)
+
+/* Найбільше підсилення, яке обробляють векторні ядра */
+#define MSM261_SIMD_GAIN_MAX    32767
+
+/*
+ * Набір ядер підсилення. dst і src можуть збігатися, n - кількість семплів.
+ * S24 - 24 біти у 32-бітному контейнері, результат розширюється знаком.
+ */
+struct msm261_gain_ops {
+    const char *name;
+    bool needs_fpu;
+    void (*s16)(int16_t *dst, const int16_t *src, unsigned int n, int gain);
+    void (*s24)(int32_t *dst, const int32_t *src, unsigned int n, int gain);
+    void (*s32)(int32_t *dst, const int32_t *src, unsigned int n, int gain);
+};
+
+/* Скалярні еталонні операції: векторні ядра мають збігатися з ними біт у біт */
+static inline int16_t msm261_gain_sample_s16(int16_t x, int gain)
+{
+    int32_t val = (int32_t)x * gain;
+
+    if (val > 32767)    val = 32767;
+    if (val < -32768)   val = -32768;
+    return (int16_t)val;
+}
+
+static inline int32_t msm261_gain_sample_s24(int32_t x, int gain)
+{
+    int64_t val = (int64_t)((int32_t)((uint32_t)x << 8) >> 8) * gain;
+
+    if (val > MSM261_S24_MAX)   val = MSM261_S24_MAX;
+    if (val < MSM261_S24_MIN)   val = MSM261_S24_MIN;
+    return (int32_t)val;
+}
+
+static inline int32_t msm261_gain_sample_s32(int32_t x, int gain)
+{
+    int64_t val = (int64_t)x * gain;
+
+    if (val > 2147483647LL)   val = 2147483647LL;
+    if (val < -2147483648LL)  val = -2147483648LL;
+    return (int32_t)val;
+}
+
+extern const struct msm261_gain_ops msm261_gain_scalar;
+
+#ifdef MSM261_DSP_SIMD
+/* msm261_simd.c, викликати лише між msm261_dsp_fpu_begin()/msm261_dsp_fpu_end() */
+extern const struct msm261_gain_ops msm261_gain_simd;
+
+bool msm261_gain_selftest(const struct msm261_gain_ops *ops);
+#endif
+
+/* msm261_dsp.c */
+void msm261_gain_select(void);
+void msm261_dsp_init(struct msm261_dsp *dsp);
+void msm261_params_init(struct msm261_params *p);
+bool msm261_params_cal_check(struct msm261_params *p);
+void msm261_params_agc(struct msm261_params *p);
+void msm261_agc_reset(struct msm261_agc *agc);
+unsigned int msm261_dsp_select(struct msm261_dsp *dsp, unsigned int mic_mask);
+void msm261_demux(const struct msm261_dsp *dsp, void *dst,
+                  const void *const lines[NUM_DATA_LINES], unsigned int line_stride,
+                  unsigned int frames, int fmt, unsigned int channels);
+void msm261_demux_dma(const struct msm261_dsp *dsp, void *dst, const void *src,
+                      unsigned int slots, unsigned int frames, int fmt,
+                      unsigned int channels);
+bool msm261_demux_dma_valid(const struct msm261_dsp *dsp, unsigned int slots,
+                            unsigned int channels, bool *reorder);
+int msm261_mode_for_bclk(unsigned int bclk);
+unsigned int msm261_channels_avail(unsigned int mic_mask);
+unsigned int msm261_decim_ratio_for(unsigned int rate);
+unsigned int msm261_rate_list(unsigned int native, bool decimate, unsigned int *rates);
+enum msm261_open_err msm261_open_check(const struct msm261_dsp *dsp, unsigned int mic_mask,
+                                       unsigned int channels, bool beam, bool line_data,
+                                       bool *reorder);
+enum msm261_open_err msm261_share_check(bool group, bool others, bool with_group,
+                                        unsigned int mic_mask, unsigned int rate,
+                                        unsigned int array_rate);
+msm261_process_fn msm261_dsp_process_lookup(int fmt, unsigned int channels);
+bool msm261_decim_setup(struct msm261_decim *decim, unsigned int ratio);
+unsigned int msm261_decim(struct msm261_decim *decim, void *dst, const void *src,
+                          unsigned int frames, int fmt, unsigned int channels);
+void msm261_pick(void *dst, int fmt, unsigned int channels, const s32 *src,
+                 unsigned int src_channels, unsigned int first, unsigned int frames);
+void msm261_interleave(void *dst, int fmt, const s32 *const *src, unsigned int arrays,
+                       unsigned int channels, unsigned int frames);
+void msm261_vad_setup(struct msm261_vad *vad, unsigned int rate);
+bool msm261_vad_feed(struct msm261_vad *vad, const void *src, int fmt,
+                     unsigned int channels, unsigned int channel, unsigned int frames);
+void msm261_health_setup(struct msm261_health *health, unsigned int rate);
+bool msm261_health_feed(struct msm261_health *health, const u8 *chan_mic, const void *src,
+                        int fmt, unsigned int channels, unsigned int mics,
+                        unsigned int frames);
+bool msm261_health_clear(struct msm261_health *health);
+void msm261_drift_reset(struct msm261_drift *drift, unsigned int rate);
+bool msm261_drift_feed(struct msm261_drift *drift, u64 frames, u64 ns);
+bool msm261_hpf_valid(const struct msm261_biquad_coef *coef);
+void msm261_hpf_reset(struct msm261_hpf *hpf);
+void msm261_cal_reset(struct msm261_cal *cal);
+void msm261_beam_build(struct msm261_beam *beam, unsigned int rate,
+                       const struct msm261_params *p);
+void msm261_doa_build(struct msm261_doa *doa, unsigned int rate,
+                      const struct msm261_params *params);
+void msm261_doa_update(struct msm261_doa *doa);
+
+/* Кожна лінія даних несе два 32-бітні слоти незалежно від кількості каналів */
+static inline unsigned int msm261_link_bclk(unsigned int rate)
+{
+    return rate * MSM261_SLOTS_PER_LINE * 32;
+}
+
+/* Мікрофони, яких промінь і DOA не беруть: вердикт монітора або живлення */
+static inline u8 msm261_dsp_excluded(const struct msm261_dsp *dsp)
+{
+    return READ_ONCE(dsp->health.bad) | READ_ONCE(dsp->dead);
+}
+
+/* Після обробки: чи є вікно для msm261_doa_update() */
+static inline bool msm261_doa_pending(const struct msm261_doa *doa)
+{
+    return doa && READ_ONCE(doa->pending);
+}
+
+#endif /* MSM261_DSP_H */
@@ -0,0 +1,159 @@
+/*
+ * Групи масивів: кілька MSM261 на спільному BCLK/WS, які застосунок бачить
+ * як один потік захоплення, масив за масивом (msm261.h, MSM261_STREAM_GROUP).
+ *
+ * Належність задає DT: "msm,array-group" (номер групи), "msm,array-index"
+ * (місце масиву в кадрі) і "msm,array-count" (скільки масивів чекати).
+ * Симулятор без DT бере її з sim_arrays. Масив з'являється в групі, коли
+ * пройшов probe, і зникає перед звільненням свого стану; сама група живе до
+ * вивантаження модуля, тож ведучий може тримати на неї покажчик без
+ * лічильника посилань.
+ */
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/of.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include "msm261.h"
+
+static LIST_HEAD(msm261_groups);
+static DEFINE_MUTEX(msm261_groups_lock);
+
+int msm261_group_parse(struct msm261_priv *msm261, struct device_node *np)
+{
+    u32 id = 0, index = 0, count = 1;
+
+    if (np) {
+        of_property_read_u32(np, "msm,array-group", &id);
+        of_property_read_u32(np, "msm,array-index", &index);
+        of_property_read_u32(np, "msm,array-count", &count);
+    } else if (msm261->sim) {
+        msm261_sim_array(msm261->dev, &index, &count);
+    }
+
+    if (!count || count > MSM261_GROUP_MAX || index >= count) {
+        dev_err(msm261->dev, "MSM261: Invalid array group: index %u of %u (max %u)\n",
+                index, count, MSM261_GROUP_MAX);
+        return -EINVAL;
+    }
+
+    msm261->group_id = id;
+    msm261->array_index = index;
+    msm261->array_count = count;
+    return 0;
+}
+
+static struct msm261_group *msm261_group_get(u32 id, unsigned int count)
+{
+    struct msm261_group *group;
+
+    list_for_each_entry(group, &msm261_groups, node)
+        if (group->id == id)
+            return group->count == count ? group : ERR_PTR(-EINVAL);
+
+    group = kzalloc(sizeof(*group), GFP_KERNEL);
+    if (!group)
+        return ERR_PTR(-ENOMEM);
+
+    group->id = id;
+    group->count = count;
+    mutex_init(&group->mutex);
+    spin_lock_init(&group->lock);
+    list_add_tail(&group->node, &msm261_groups);
+    return group;
+}
+
+/*
+ * Спершу з-під таймера ведучого, потім devm звільняє стан масиву. Прохід
+ * таймера бере масиви під group->lock, а обробляє поза ним, тож чекаємо,
+ * поки прохід, що ще бачив цей масив, закінчиться.
+ */
+static void msm261_group_leave(void *data)
+{
+    struct msm261_priv *msm261 = data;
+    struct msm261_group *group = msm261->group;
+    DECLARE_COMPLETION_ONSTACK(done);
+    bool wait;
+
+    mutex_lock(&group->mutex);
+    spin_lock_bh(&group->lock);
+    group->arrays[msm261->array_index] = NULL;
+    wait = group->running;
+    if (wait)
+        group->leaving = &done;
+    spin_unlock_bh(&group->lock);
+    if (wait)
+        wait_for_completion(&done);
+    mutex_unlock(&group->mutex);
+
+    dev_info(msm261->dev, "MSM261: Left array group %u\n", group->id);
+}
+
+/* Після msm261_sim_probe(): вихід з групи мусить іти раніше за його release */
+int msm261_group_join(struct msm261_priv *msm261)
+{
+    struct msm261_group *group;
+    int ret = 0;
+
+    if (msm261->array_count < 2)
+        return 0;
+
+    mutex_lock(&msm261_groups_lock);
+    group = msm261_group_get(msm261->group_id, msm261->array_count);
+    mutex_unlock(&msm261_groups_lock);
+    if (IS_ERR(group)) {
+        dev_err(msm261->dev, "MSM261: Array group %u has a different size\n",
+                msm261->group_id);
+        return PTR_ERR(group);
+    }
+
+    mutex_lock(&group->mutex);
+    if (group->arrays[msm261->array_index]) {
+        ret = -EBUSY;
+    } else {
+        spin_lock_bh(&group->lock);
+        group->arrays[msm261->array_index] = msm261;
+        spin_unlock_bh(&group->lock);
+        msm261->group = group;
+    }
+    mutex_unlock(&group->mutex);
+    if (ret < 0) {
+        dev_err(msm261->dev, "MSM261: Array group %u already has index %u\n",
+                msm261->group_id, msm261->array_index);
+        return ret;
+    }
+
+    dev_info(msm261->dev, "MSM261: Array %u of %u in group %u\n",
+             msm261->array_index, msm261->array_count, msm261->group_id);
+    return devm_add_action_or_reset(msm261->dev, msm261_group_leave, msm261);
+}
+
+enum msm261_array_health msm261_group_health(struct msm261_group *group, unsigned int index)
+{
+    enum msm261_array_health health = MSM261_ARRAY_MISSING;
+    struct msm261_priv *msm261;
+    int m;
+
+    mutex_lock(&group->mutex);
+    msm261 = group->arrays[index];
+    if (msm261) {
+        health = MSM261_ARRAY_OK;
+        for (m = 0; m < NUM_MICS; m++)
+            if (READ_ONCE(msm261->mic_status[m].error))
+                health = MSM261_ARRAY_MIC_ERROR;
+    }
+    mutex_unlock(&group->mutex);
+
+    return health;
+}
+
+/* Усі пристрої вже видалено, масивів у групах не лишилося */
+void msm261_group_exit(void)
+{
+    struct msm261_group *group, *tmp;
+
+    list_for_each_entry_safe(group, tmp, &msm261_groups, node) {
+        list_del(&group->node);
+        kfree(group);
+    }
+}
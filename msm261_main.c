@@ -0,0 +1,2239 @@
+#include <linux/module.h>
+#include <linux/uio.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/init.h>
+#include <linux/platform_device.h>
+#include <linux/firmware.h>
+#include <linux/pm_runtime.h>
+#include <linux/devm-helpers.h>
+#include <sound/core.h>
+#include <sound/pcm.h>
+#include <sound/pcm_params.h>
+#include <sound/soc.h>
+#include "msm261.h"
+
+#define CREATE_TRACE_POINTS
+#include "msm261_trace.h"
+
+#define MSM261_LOG_PREFIX "MSM261: "
+
+static bool msm261_debug = false;
+module_param(msm261_debug, bool, 0644);
+MODULE_PARM_DESC(msm261_debug, "Enable debug output for MSM261");
+
+/* Геометрія буфера; 0 - з DT ("msm,period-frames-min" тощо) або типова */
+static unsigned int period_frames_min;
+module_param(period_frames_min, uint, 0444);
+MODULE_PARM_DESC(period_frames_min, "Minimum period size in frames (>= 32)");
+
+static unsigned int period_frames_max;
+module_param(period_frames_max, uint, 0444);
+MODULE_PARM_DESC(period_frames_max, "Maximum period size in frames");
+
+static unsigned int buffer_ms;
+module_param(buffer_ms, uint, 0444);
+MODULE_PARM_DESC(buffer_ms, "Maximum buffer length in ms at 48 kHz, 8 ch, S32");
+
+static bool decimate = true;
+module_param(decimate, bool, 0644);
+MODULE_PARM_DESC(decimate, "Capture 16 kHz / 22.05 kHz by decimating 48 kHz / 44.1 kHz");
+
+/* Функція ініціалізації GPIO */
+static int msm261_gpio_init(struct msm261_priv *msm261)
+{
+    int ret, i;
+
+    /* Request BCK GPIO */
+    ret = devm_gpio_request(msm261->dev, msm261->bck_gpio, "MSM261_BCK");
+    if (ret < 0) {
+        dev_err(msm261->dev, "Failed to request BCK GPIO: %d\n", ret);
+        return ret;
+    }
+
+    /* Request WS GPIO */
+    ret = devm_gpio_request(msm261->dev, msm261->ws_gpio, "MSM261_WS");
+    if (ret < 0) {
+        dev_err(msm261->dev, "Failed to request WS GPIO: %d\n", ret);
+        return ret;
+    }
+
+    /* Configure clock GPIOs */
+    gpio_direction_output(msm261->bck_gpio, 0);
+    gpio_direction_output(msm261->ws_gpio, 0);
+
+    /* Configure data GPIOs */
+    for (i = 0; i < NUM_DATA_LINES; i++) {
+        char label[32];
+        snprintf(label, sizeof(label), "MSM261_DATA%d", i);
+
+        ret = devm_gpio_request(msm261->dev, msm261->data_gpio[i], label);
+        if (ret < 0) {
+            dev_err(msm261->dev, "Failed to request DATA%d GPIO: %d\n", i, ret);
+            return ret;
+        }
+        gpio_direction_input(msm261->data_gpio[i]);
+    }
+
+    return 0;
+}
+
+/* Мікрофони, що не піднялися при останньому включенні живлення */
+static unsigned long msm261_power_failed(struct msm261_priv *msm261)
+{
+    return READ_ONCE(msm261->dsp.dead);
+}
+
+/*
+ * Функція включення живлення. Повертає маску мікрофонів, що не піднялися й
+ * після повторів: масив працює без них, а open пробує їх знову.
+ */
+static unsigned long msm261_power_on(struct msm261_priv *msm261)
+{
+    int i, retry;
+    bool all_mics_ok = false;
+    unsigned long failed = 0;
+    u64 start = ktime_get_ns();
+
+    /* Тут спимо, тому не спінлок: послідовність серіалізує hw_lock */
+    mutex_lock(&msm261->hw_lock);
+
+    /* Потік масиву вже йде: BCK/WS не чіпаємо, спробуємо на наступному open */
+    if (msm261->hw_users) {
+        mutex_unlock(&msm261->hw_lock);
+        return msm261_power_failed(msm261);
+    }
+
+    /* Початкова затримка для стабілізації живлення */
+    usleep_range(1000, 1500);
+
+    /* Спроби включення з повторами при помилці */
+    for (retry = 0; retry < MSM261_RETRY_COUNT && !all_mics_ok; retry++) {
+        all_mics_ok = true;
+        failed = 0;
+
+        /* Активуємо I2S інтерфейс */
+        gpio_set_value(msm261->bck_gpio, 1);
+        gpio_set_value(msm261->ws_gpio, 1);
+
+        /* Чекаємо готовності мікрофонів */
+        usleep_range(5000, 6000);
+
+        /* Перевіряємо статус кожного мікрофона */
+        for (i = 0; i < NUM_MICS; i++) {
+            /* Читаємо статус через GPIO лінії, на якій сидить мікрофон */
+            unsigned int line = msm261->dsp.slot_map[i] / MSM261_SLOTS_PER_LINE;
+            int data_value = gpio_get_value(msm261->data_gpio[line]);
+
+            if (data_value == 0) {
+                all_mics_ok = false;
+                failed |= BIT(i);
+                WRITE_ONCE(msm261->mic_status[i].gpio_error, true);
+                WRITE_ONCE(msm261->mic_status[i].error, true);
+                dev_err(msm261->dev, "Mic %d failed to initialize\n", i);
+
+                if (retry < MSM261_RETRY_COUNT - 1) {
+                    /* Скидаємо і пробуємо знову */
+                    gpio_set_value(msm261->bck_gpio, 0);
+                    gpio_set_value(msm261->ws_gpio, 0);
+                    usleep_range(MSM261_RETRY_DELAY_US, MSM261_RETRY_DELAY_US + 500);
+                    break;
+                }
+            } else {
+                msm261->mic_status[i].power_state = MSM261_STATUS_ON;
+                WRITE_ONCE(msm261->mic_status[i].gpio_error, false);
+                WRITE_ONCE(msm261->mic_status[i].error,
+                           !!(READ_ONCE(msm261->dsp.health.bad) & BIT(i)));
+            }
+        }
+    }
+
+    /* Промінь і DOA обходять їх так само, як поганих за монітором */
+    WRITE_ONCE(msm261->dsp.dead, failed);
+    mutex_unlock(&msm261->hw_lock);
+
+    trace_msm261_power_on(msm261->dev, retry, failed, ktime_get_ns() - start);
+
+    if (!all_mics_ok)
+        dev_warn(msm261->dev, "MSM261: Mics 0x%02lx did not power up, running without them\n",
+                 failed);
+
+    return failed;
+}
+
+/*
+ * Параметри обробки публікуються через RCU: писач під params_lock копіює
+ * поточний блок, змінює копію і підміняє покажчик, старий блок звільняється
+ * після грейс-періоду. Гарячий шлях читає блок без замків і не вимикає
+ * переривань; стан фільтра й AGC змінює лише він, писач тільки піднімає
+ * покоління в блоці.
+ */
+static struct msm261_params *msm261_params_begin(struct msm261_priv *msm261)
+{
+    struct msm261_params *p;
+
+    mutex_lock(&msm261->params_lock);
+    p = kmemdup(rcu_dereference_protected(msm261->params,
+                                          lockdep_is_held(&msm261->params_lock)),
+                sizeof(*p), GFP_KERNEL);
+    if (!p)
+        mutex_unlock(&msm261->params_lock);
+    return p;
+}
+
+static void msm261_params_commit(struct msm261_priv *msm261, struct msm261_params *p)
+{
+    struct msm261_params *old;
+
+    old = rcu_replace_pointer(msm261->params, p, lockdep_is_held(&msm261->params_lock));
+    mutex_unlock(&msm261->params_lock);
+    kfree_rcu_mightsleep(old);
+}
+
+static void msm261_params_abort(struct msm261_priv *msm261, struct msm261_params *p)
+{
+    mutex_unlock(&msm261->params_lock);
+    kfree(p);
+}
+
+/* Узгоджена копія для шляхів, що можуть спати (copy_to_iter, hw_params) */
+static void msm261_params_snapshot(struct msm261_priv *msm261, struct msm261_params *p)
+{
+    rcu_read_lock();
+    *p = *rcu_dereference(msm261->params);
+    rcu_read_unlock();
+}
+
+/*
+ * Функція налаштування режиму роботи. Виклики серіалізує hw_lock (або probe
+ * до реєстрації); GPIO може спати, тож без спінлоків.
+ */
+static int msm261_set_mode(struct msm261_priv *msm261, u8 mode)
+{
+    int i;
+
+    /* Встановлюємо CHIPEN у високий рівень для активації */
+    if (!msm261->sim) {
+        gpio_set_value(msm261->ws_gpio, 1);
+        udelay(10);
+    }
+
+    /* Налаштовуємо режим роботи; debugfs читає без замка */
+    WRITE_ONCE(msm261->operation_mode, mode);
+
+    /* Оновлюємо статус для всіх мікрофонів */
+    for (i = 0; i < NUM_MICS; i++) {
+        msm261->mic_status[i].operation_mode = mode;
+    }
+
+    /* Застосовуємо налаштування режиму */
+    if (mode == MSM261_MODE_NORMAL) {
+        /* Нормальний режим: частота 1.0-4.0 МГц */
+        dev_dbg(msm261->dev, "Setting normal mode operation\n");
+    } else {
+        /* Режим низького енергоспоживання: 150-800 кГц */
+        dev_dbg(msm261->dev, "Setting low power mode operation\n");
+    }
+
+    return 0;
+}
+
+/* Функція налаштування тактування, під hw_lock як і msm261_set_mode() */
+static int msm261_setup_clocks(struct msm261_priv *msm261, unsigned int target_bclk)
+{
+    /* Перевіряємо допустимість частоти */
+    if (msm261->operation_mode == MSM261_MODE_NORMAL) {
+        if (target_bclk < MSM261_NORMAL_MODE_MIN_CLK ||
+            target_bclk > MSM261_NORMAL_MODE_MAX_CLK) {
+            dev_err(msm261->dev, "Invalid BCLK frequency for normal mode: %u Hz\n",
+                    target_bclk);
+            return -EINVAL;
+        }
+    } else {
+        if (target_bclk < MSM261_LOW_POWER_MIN_CLK ||
+            target_bclk > MSM261_LOW_POWER_MAX_CLK) {
+            dev_err(msm261->dev, "Invalid BCLK frequency for low power mode: %u Hz\n",
+                    target_bclk);
+            return -EINVAL;
+        }
+    }
+
+    /* Налаштовуємо тактову частоту */
+    /* Тут має бути специфічний код для вашої платформи */
+    WRITE_ONCE(msm261->bclk, target_bclk);
+
+    dev_dbg(msm261->dev, "Clock setup completed, BCLK=%u Hz\n", target_bclk);
+    return 0;
+}
+
+/*
+ * Головна функція ініціалізації. Викликається один раз із probe і зриває
+ * його лише на помилках GPIO, режиму чи тактування: мікрофон, що не
+ * піднявся, лишається в помилці, а масив працює без нього.
+ */
+int msm261_hw_init(struct msm261_priv *msm261)
+{
+    u64 start = ktime_get_ns();
+    struct msm261_params *p;
+    int ret, i;
+
+    /* Ініціалізуємо статуси мікрофонів */
+    for (i = 0; i < NUM_MICS; i++) {
+        msm261->mic_status[i].power_state = MSM261_STATUS_OFF;
+        msm261->mic_status[i].operation_mode = MSM261_MODE_NORMAL;
+        msm261->mic_status[i].initialized = false;
+        msm261->mic_status[i].error = false;
+        msm261->mic_status[i].gpio_error = false;
+    }
+
+    if (msm261->sim) {
+        /* Симулятор: GPIO немає, мікрофони "живі" одразу */
+        for (i = 0; i < NUM_MICS; i++)
+            msm261->mic_status[i].power_state = MSM261_STATUS_ON;
+    } else {
+        /* Базова ініціалізація GPIO */
+        ret = msm261_gpio_init(msm261);
+        if (ret < 0) {
+            dev_err(msm261->dev, "GPIO initialization failed: %d\n", ret);
+            return ret;
+        }
+
+        /* Включення живлення; невдалі мікрофони позначено в mic_status */
+        msm261_power_on(msm261);
+    }
+
+    /* Налаштування режиму роботи */
+    ret = msm261_set_mode(msm261, MSM261_MODE_NORMAL);
+    if (ret < 0) {
+        dev_err(msm261->dev, "Failed to set operation mode: %d\n", ret);
+        return ret;
+    }
+
+    /* Налаштування тактування */
+    ret = msm261_setup_clocks(msm261, MSM261_DEFAULT_BCLK);
+    if (ret < 0) {
+        dev_err(msm261->dev, "Clock setup failed: %d\n", ret);
+        return ret;
+    }
+
+    /* Фіксоване підсилення, поки AGC вимкнено; далі - "Mic Array Gain" */
+    p = msm261_params_begin(msm261);
+    if (!p)
+        return -ENOMEM;
+    p->software_gain = 5;
+    msm261_params_commit(msm261, p);
+
+    /* Позначаємо всі мікрофони як ініціалізовані */
+    for (i = 0; i < NUM_MICS; i++) {
+        msm261->mic_status[i].initialized = true;
+    }
+
+    msm261->hw_init_ns = ktime_get_ns() - start;
+
+    dev_dbg(msm261->dev, "Hardware initialization completed successfully\n");
+    return 0;
+}
+
+/* I2S configuration */
+int msm261_set_i2s_config(struct msm261_priv *msm261, unsigned int bclk, unsigned int rate)
+{
+    unsigned long flags;
+    int mode, ret;
+
+    if (msm261_debug)
+        dev_info(msm261->dev, "MSM261: Configuring I2S: BCLK=%uHz, Rate=%uHz\n", bclk, rate);
+
+    /* Validate clock frequency */
+    mode = msm261_mode_for_bclk(bclk);
+    if (mode < 0) {
+        dev_err(msm261->dev, "Invalid BCLK frequency %uHz (valid: %u-%uHz or %u-%uHz)\n",
+                bclk, MSM261_LOW_POWER_MIN_CLK, MSM261_LOW_POWER_MAX_CLK,
+                MSM261_NORMAL_MODE_MIN_CLK, MSM261_NORMAL_MODE_MAX_CLK);
+        return mode;
+    }
+
+    if (mode != msm261->operation_mode) {
+        ret = msm261_set_mode(msm261, mode);
+        if (ret < 0)
+            return ret;
+    }
+
+    ret = msm261_setup_clocks(msm261, bclk);
+    if (ret < 0)
+        return ret;
+
+    if (msm261->sim)
+        return 0;
+
+    local_irq_save(flags);
+
+    /* Configure I2S timing */
+    gpio_set_value(msm261->bck_gpio, 0);
+    gpio_set_value(msm261->ws_gpio, 0);
+    udelay(1);  /* Setup time */
+
+    local_irq_restore(flags);
+
+    if (msm261_debug)
+        dev_info(msm261->dev, "MSM261: I2S configuration completed\n");
+    return 0;
+}
+
+static int msm261_beam_angle_get(struct snd_kcontrol *kcontrol,
+                                 struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+
+    ucontrol->value.integer.value[0] = msm261_param(msm261, beam_angle);
+    return 0;
+}
+
+static int msm261_beam_angle_put(struct snd_kcontrol *kcontrol,
+                                 struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+    long angle = ucontrol->value.integer.value[0];
+    struct msm261_params *p;
+
+    if (angle < 0 || angle > 359)
+        return -EINVAL;
+
+    p = msm261_params_begin(msm261);
+    if (!p)
+        return -ENOMEM;
+    if (angle == p->beam_angle) {
+        msm261_params_abort(msm261, p);
+        return 0;
+    }
+
+    p->beam_angle = angle;
+    p->beam_dir = DIV_ROUND_CLOSEST(angle, MSM261_BEAM_STEP_DEG) % MSM261_BEAM_DIRECTIONS;
+    msm261_params_commit(msm261, p);
+    return 1;
+}
+
+static int msm261_doa_switch_get(struct snd_kcontrol *kcontrol,
+                                 struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+
+    ucontrol->value.integer.value[0] = msm261_param(msm261, doa_enabled);
+    return 0;
+}
+
+static int msm261_doa_switch_put(struct snd_kcontrol *kcontrol,
+                                 struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+    bool enabled = !!ucontrol->value.integer.value[0];
+    struct msm261_params *p;
+
+    p = msm261_params_begin(msm261);
+    if (!p)
+        return -ENOMEM;
+    if (enabled == p->doa_enabled) {
+        msm261_params_abort(msm261, p);
+        return 0;
+    }
+
+    p->doa_enabled = enabled;
+    msm261_params_commit(msm261, p);
+    return 1;
+}
+
+static int msm261_doa_azimuth_get(struct snd_kcontrol *kcontrol,
+                                  struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+
+    ucontrol->value.integer.value[0] = READ_ONCE(msm261->dsp.doa->azimuth);
+    return 0;
+}
+
+static int msm261_doa_confidence_get(struct snd_kcontrol *kcontrol,
+                                     struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+
+    ucontrol->value.integer.value[0] = READ_ONCE(msm261->dsp.doa->confidence);
+    return 0;
+}
+
+static int msm261_hpf_switch_get(struct snd_kcontrol *kcontrol,
+                                 struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+
+    ucontrol->value.integer.value[0] = msm261_param(msm261, hpf_enabled);
+    return 0;
+}
+
+static int msm261_hpf_switch_put(struct snd_kcontrol *kcontrol,
+                                 struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+    bool enabled = !!ucontrol->value.integer.value[0];
+    struct msm261_params *p;
+
+    p = msm261_params_begin(msm261);
+    if (!p)
+        return -ENOMEM;
+    if (enabled == p->hpf_enabled) {
+        msm261_params_abort(msm261, p);
+        return 0;
+    }
+
+    /* Стан старого фільтра не має сенсу після паузи; скине його обробка */
+    if (enabled)
+        p->hpf_gen++;
+    p->hpf_enabled = enabled;
+    msm261_params_commit(msm261, p);
+    return 1;
+}
+
+static int msm261_vad_switch_get(struct snd_kcontrol *kcontrol,
+                                 struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+
+    ucontrol->value.integer.value[0] = msm261_param(msm261, vad_enabled);
+    return 0;
+}
+
+static int msm261_vad_switch_put(struct snd_kcontrol *kcontrol,
+                                 struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+    bool enabled = !!ucontrol->value.integer.value[0];
+    bool speech = READ_ONCE(msm261->dsp.vad.speech);
+    struct msm261_params *p;
+
+    p = msm261_params_begin(msm261);
+    if (!p)
+        return -ENOMEM;
+    if (enabled == p->vad_enabled) {
+        msm261_params_abort(msm261, p);
+        return 0;
+    }
+
+    p->vad_enabled = enabled;
+    msm261_params_commit(msm261, p);
+    /* Вимкнений детектор не тримає "мову" */
+    if (!enabled) {
+        WRITE_ONCE(msm261->dsp.vad.speech, false);
+        if (speech)
+            msm261_vad_notify(msm261);
+    }
+    return 1;
+}
+
+static int msm261_health_switch_get(struct snd_kcontrol *kcontrol,
+                                    struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+
+    ucontrol->value.integer.value[0] = msm261_param(msm261, health_enabled);
+    return 0;
+}
+
+/* Вердикт вимкненого монітора скидає гарячий шлях, він же й сповіщає */
+static int msm261_health_switch_put(struct snd_kcontrol *kcontrol,
+                                    struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+    bool enabled = !!ucontrol->value.integer.value[0];
+    struct msm261_params *p;
+
+    p = msm261_params_begin(msm261);
+    if (!p)
+        return -ENOMEM;
+    if (enabled == p->health_enabled) {
+        msm261_params_abort(msm261, p);
+        return 0;
+    }
+
+    p->health_enabled = enabled;
+    msm261_params_commit(msm261, p);
+    return 1;
+}
+
+static int msm261_mic_fault_get(struct snd_kcontrol *kcontrol,
+                                struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+    unsigned int mask = 0;
+    int i;
+
+    for (i = 0; i < NUM_MICS; i++)
+        if (READ_ONCE(msm261->mic_status[i].error))
+            mask |= BIT(i);
+
+    ucontrol->value.integer.value[0] = mask;
+    return 0;
+}
+
+static int msm261_vad_speech_get(struct snd_kcontrol *kcontrol,
+                                 struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+
+    ucontrol->value.integer.value[0] = READ_ONCE(msm261->dsp.vad.speech);
+    return 0;
+}
+
+/* Фіксоване підсилення, діє лише з вимкненим AGC */
+static int msm261_gain_get(struct snd_kcontrol *kcontrol,
+                           struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+
+    ucontrol->value.integer.value[0] = msm261_param(msm261, software_gain);
+    return 0;
+}
+
+static int msm261_gain_put(struct snd_kcontrol *kcontrol,
+                           struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+    long gain = ucontrol->value.integer.value[0];
+    struct msm261_params *p;
+
+    if (gain < 0 || gain > MSM261_GAIN_MAX)
+        return -EINVAL;
+
+    p = msm261_params_begin(msm261);
+    if (!p)
+        return -ENOMEM;
+    if (gain == p->software_gain) {
+        msm261_params_abort(msm261, p);
+        return 0;
+    }
+
+    p->software_gain = gain;
+    msm261_params_commit(msm261, p);
+    return 1;
+}
+
+static int msm261_agc_switch_get(struct snd_kcontrol *kcontrol,
+                                 struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+
+    ucontrol->value.integer.value[0] = msm261_param(msm261, agc_enabled);
+    return 0;
+}
+
+static int msm261_agc_switch_put(struct snd_kcontrol *kcontrol,
+                                 struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+    bool enabled = !!ucontrol->value.integer.value[0];
+    struct msm261_params *p;
+
+    p = msm261_params_begin(msm261);
+    if (!p)
+        return -ENOMEM;
+    if (enabled == p->agc_enabled) {
+        msm261_params_abort(msm261, p);
+        return 0;
+    }
+
+    /* Як і для фільтра: стара обвідна після паузи лише заважає */
+    if (enabled)
+        p->agc_gen++;
+    p->agc_enabled = enabled;
+    msm261_params_commit(msm261, p);
+    return 1;
+}
+
+/* Цільовий рівень: значення 0..40 - це -40..0 дБFS, див. TLV */
+static int msm261_agc_target_get(struct snd_kcontrol *kcontrol,
+                                 struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+
+    ucontrol->value.integer.value[0] = msm261_param(msm261, agc_target_db) +
+                                       MSM261_AGC_DB_MAX;
+    return 0;
+}
+
+static int msm261_agc_target_put(struct snd_kcontrol *kcontrol,
+                                 struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+    long val = ucontrol->value.integer.value[0];
+    struct msm261_params *p;
+
+    if (val < 0 || val > MSM261_AGC_DB_MAX)
+        return -EINVAL;
+
+    p = msm261_params_begin(msm261);
+    if (!p)
+        return -ENOMEM;
+    if (val - MSM261_AGC_DB_MAX == p->agc_target_db) {
+        msm261_params_abort(msm261, p);
+        return 0;
+    }
+
+    p->agc_target_db = val - MSM261_AGC_DB_MAX;
+    msm261_params_agc(p);
+    msm261_params_commit(msm261, p);
+    return 1;
+}
+
+static int msm261_agc_max_get(struct snd_kcontrol *kcontrol,
+                              struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+
+    ucontrol->value.integer.value[0] = msm261_param(msm261, agc_max_db);
+    return 0;
+}
+
+static int msm261_agc_max_put(struct snd_kcontrol *kcontrol,
+                              struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+    long val = ucontrol->value.integer.value[0];
+    struct msm261_params *p;
+
+    if (val < 0 || val > MSM261_AGC_DB_MAX)
+        return -EINVAL;
+
+    p = msm261_params_begin(msm261);
+    if (!p)
+        return -ENOMEM;
+    if (val == p->agc_max_db) {
+        msm261_params_abort(msm261, p);
+        return 0;
+    }
+
+    /* Нове підсилення обмежиться вже на наступній межі блоку */
+    p->agc_max_db = val;
+    msm261_params_agc(p);
+    msm261_params_commit(msm261, p);
+    return 1;
+}
+
+/* FFT і пошук напрямку з вікна, яке поклала обробка */
+static void msm261_doa_work(struct work_struct *work)
+{
+    struct msm261_priv *msm261 = container_of(work, struct msm261_priv, doa_work);
+
+    msm261_doa_update(msm261->dsp.doa);
+}
+
+/*
+ * Зміна стану VAD: читачі, що чекають poll() на контролі, прокидаються.
+ * Можна з атомарного контексту (таймер симулятора).
+ */
+void msm261_vad_notify(struct msm261_priv *msm261)
+{
+    if (msm261->vad_kctl)
+        snd_ctl_notify(msm261->component->card->snd_card, SNDRV_CTL_EVENT_MASK_VALUE,
+                       &msm261->vad_kctl->id);
+}
+
+/*
+ * Монітор у потоці змінив вердикт: він доповнює перевірку GPIO з
+ * msm261_power_on(), бо бачить мікрофон і після старту, але не скасовує її -
+ * мікрофон, що не піднявся, лишається в помилці. Атомарний контекст.
+ */
+void msm261_health_notify(struct msm261_priv *msm261)
+{
+    u8 bad = READ_ONCE(msm261->dsp.health.bad);
+    int i;
+
+    for (i = 0; i < NUM_MICS; i++) {
+        WRITE_ONCE(msm261->mic_status[i].error,
+                   msm261->mic_status[i].gpio_error || (bad & BIT(i)));
+        WRITE_ONCE(msm261->mic_status[i].faults, READ_ONCE(msm261->dsp.health.faults[i]));
+    }
+
+    if (msm261->health_kctl)
+        snd_ctl_notify(msm261->component->card->snd_card, SNDRV_CTL_EVENT_MASK_VALUE,
+                       &msm261->health_kctl->id);
+    if (msm261->group_kctl)
+        snd_ctl_notify(msm261->component->card->snd_card, SNDRV_CTL_EVENT_MASK_VALUE,
+                       &msm261->group_kctl->id);
+}
+
+/*
+ * Карта каналів ALSA для кожної кількості каналів: канал c - c-й вибраний
+ * мікрофон. Позиції - за кутом мікрофона на кільці (0 градусів - фронт,
+ * кут зростає за годинниковою стрілкою, якщо дивитися на плату згори),
+ * центральний - TC, канал променя - MONO.
+ */
+static const unsigned char msm261_mic_pos[NUM_MICS] = {
+    SNDRV_CHMAP_FC, SNDRV_CHMAP_FR, SNDRV_CHMAP_RR,
+    SNDRV_CHMAP_RC, SNDRV_CHMAP_RL, SNDRV_CHMAP_FL,
+    SNDRV_CHMAP_TC,
+};
+
+static const struct snd_pcm_chmap_elem msm261_beam_chmap[] = {
+    { .channels = 1, .map = { SNDRV_CHMAP_MONO } },
+    { }
+};
+
+static void msm261_chmap_update(struct msm261_priv *msm261)
+{
+    unsigned int avail = msm261_channels_avail(msm261->mic_mask);
+    unsigned char pos[MSM261_CHANNELS_MAX];
+    unsigned int ch, c, m, n = 0;
+
+    for (m = 0; m < NUM_MICS; m++)
+        if (msm261->mic_mask & BIT(m))
+            pos[n++] = msm261_mic_pos[m];
+    pos[MSM261_BEAM_CHANNEL] = SNDRV_CHMAP_MONO;
+
+    /* Нульовий запис після останньої доступної кількості - кінець таблиці */
+    memset(msm261->chmaps, 0, sizeof(msm261->chmaps));
+    for (ch = 1; ch <= avail; ch++) {
+        msm261->chmaps[ch - 1].channels = ch;
+        for (c = 0; c < ch; c++)
+            msm261->chmaps[ch - 1].map[c] = pos[c];
+    }
+}
+
+static int msm261_mic_mask_get(struct snd_kcontrol *kcontrol,
+                               struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+
+    ucontrol->value.integer.value[0] = msm261->mic_mask;
+    return 0;
+}
+
+static int msm261_mic_mask_put(struct snd_kcontrol *kcontrol,
+                               struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+    long mask = ucontrol->value.integer.value[0];
+    int i;
+
+    if (mask <= 0 || mask > MSM261_MIC_MASK_ALL)
+        return -EINVAL;
+
+    /*
+     * Розкладка спільного кадру фіксується першим hw_params: перевірка,
+     * маска і карти каналів - під тим самим замком, що й msm261_hw_claim()
+     */
+    mutex_lock(&msm261->hw_lock);
+    if (mask == msm261->mic_mask) {
+        mutex_unlock(&msm261->hw_lock);
+        return 0;
+    }
+    if (msm261->hw_users) {
+        mutex_unlock(&msm261->hw_lock);
+        return -EBUSY;
+    }
+    msm261->mic_mask = mask;
+    msm261_chmap_update(msm261);
+    mutex_unlock(&msm261->hw_lock);
+
+    for (i = 0; i < MSM261_STREAMS; i++) {
+        struct snd_pcm_chmap *chmap = msm261->streams[i].chmap;
+
+        if (chmap && i != MSM261_STREAM_BEAM)
+            snd_ctl_notify(component->card->snd_card,
+                           SNDRV_CTL_EVENT_MASK_VALUE | SNDRV_CTL_EVENT_MASK_TLV,
+                           &chmap->kctl->id);
+    }
+    return 1;
+}
+
+/* Коефіцієнти: MSM261_HPF_STAGES x { b0, b1, b2, a1, a2 }, s32 Q30 little-endian */
+#define MSM261_HPF_COEF_BYTES   (MSM261_HPF_STAGES * 5 * 4)
+
+static int msm261_hpf_coef_get(struct snd_kcontrol *kcontrol,
+                               struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+    struct msm261_params params;
+    const s32 *coef = &params.hpf[0].b0;
+    u8 *data = ucontrol->value.bytes.data;
+    int i;
+
+    msm261_params_snapshot(msm261, &params);
+
+    for (i = 0; i < MSM261_HPF_STAGES * 5; i++, data += 4) {
+        u32 v = coef[i];
+
+        data[0] = v;
+        data[1] = v >> 8;
+        data[2] = v >> 16;
+        data[3] = v >> 24;
+    }
+    return 0;
+}
+
+static int msm261_hpf_coef_put(struct snd_kcontrol *kcontrol,
+                               struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+    struct msm261_biquad_coef coef[MSM261_HPF_STAGES];
+    const u8 *data = ucontrol->value.bytes.data;
+    struct msm261_params *p;
+    s32 *c = &coef[0].b0;
+    int i;
+
+    BUILD_BUG_ON(sizeof(coef) != MSM261_HPF_COEF_BYTES);
+
+    for (i = 0; i < MSM261_HPF_STAGES * 5; i++, data += 4)
+        c[i] = data[0] | (data[1] << 8) | (data[2] << 16) | ((u32)data[3] << 24);
+
+    if (!msm261_hpf_valid(coef))
+        return -EINVAL;
+
+    p = msm261_params_begin(msm261);
+    if (!p)
+        return -ENOMEM;
+    if (!memcmp(coef, p->hpf, sizeof(coef))) {
+        msm261_params_abort(msm261, p);
+        return 0;
+    }
+
+    /* Усі ланки змінюються разом: потік бачить або старий каскад, або новий */
+    memcpy(p->hpf, coef, sizeof(coef));
+    msm261_params_commit(msm261, p);
+    return 1;
+}
+
+/* Дрейф у ppb; від'ємний діапазон, тож не snd_soc_info_volsw() */
+static int msm261_drift_info(struct snd_kcontrol *kcontrol, struct snd_ctl_elem_info *uinfo)
+{
+    uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+    uinfo->count = 1;
+    uinfo->value.integer.min = -MSM261_DRIFT_PPB_MAX;
+    uinfo->value.integer.max = MSM261_DRIFT_PPB_MAX;
+    return 0;
+}
+
+static int msm261_drift_get(struct snd_kcontrol *kcontrol,
+                            struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+
+    ucontrol->value.integer.value[0] = READ_ONCE(msm261->drift.ppb);
+    return 0;
+}
+
+/* Стан кожного масиву групи, по елементу на "msm,array-index" */
+static const char * const msm261_health_texts[] = {
+    [MSM261_ARRAY_MISSING] = "Missing",
+    [MSM261_ARRAY_OK] = "OK",
+    [MSM261_ARRAY_MIC_ERROR] = "Mic Error",
+};
+
+static int msm261_health_info(struct snd_kcontrol *kcontrol, struct snd_ctl_elem_info *uinfo)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+
+    return snd_ctl_enum_info(uinfo, msm261->array_count, ARRAY_SIZE(msm261_health_texts),
+                             msm261_health_texts);
+}
+
+static int msm261_health_get(struct snd_kcontrol *kcontrol,
+                             struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+    unsigned int i;
+
+    /* Ведучий входить у групу вже після реєстрації картки */
+    for (i = 0; i < msm261->array_count; i++)
+        ucontrol->value.enumerated.item[i] = msm261->group ?
+            msm261_group_health(msm261->group, i) : MSM261_ARRAY_MISSING;
+    return 0;
+}
+
+/* Лише в ведучого групи, див. msm261_component_probe() */
+static const struct snd_kcontrol_new msm261_health_control = {
+    .iface = SNDRV_CTL_ELEM_IFACE_MIXER, .name = "Array Health",
+    .access = SNDRV_CTL_ELEM_ACCESS_READ | SNDRV_CTL_ELEM_ACCESS_VOLATILE,
+    .info = msm261_health_info, .get = msm261_health_get,
+};
+
+/* Лише для читання; значення змінюється з потоку, тож VOLATILE */
+#define MSM261_SINGLE_RO(xname, xmax, xhandler_get)                         \
+{   .iface = SNDRV_CTL_ELEM_IFACE_MIXER, .name = xname,                     \
+    .access = SNDRV_CTL_ELEM_ACCESS_READ | SNDRV_CTL_ELEM_ACCESS_VOLATILE,  \
+    .info = snd_soc_info_volsw, .get = xhandler_get,                        \
+    .private_value = SOC_SINGLE_VALUE(SND_SOC_NOPM, 0, xmax, 0, 0) }
+
+static const DECLARE_TLV_DB_SCALE(msm261_agc_target_tlv, -4000, 100, 0);
+static const DECLARE_TLV_DB_SCALE(msm261_agc_max_tlv, 0, 100, 0);
+
+static const struct snd_kcontrol_new msm261_controls[] = {
+    SOC_SINGLE_EXT("Mic Array Gain", SND_SOC_NOPM, 0, MSM261_GAIN_MAX, 0,
+                   msm261_gain_get, msm261_gain_put),
+    SOC_SINGLE_EXT("AGC Switch", SND_SOC_NOPM, 0, 1, 0,
+                   msm261_agc_switch_get, msm261_agc_switch_put),
+    SOC_SINGLE_EXT_TLV("AGC Target Level", SND_SOC_NOPM, 0, MSM261_AGC_DB_MAX, 0,
+                       msm261_agc_target_get, msm261_agc_target_put,
+                       msm261_agc_target_tlv),
+    SOC_SINGLE_EXT_TLV("AGC Max Gain", SND_SOC_NOPM, 0, MSM261_AGC_DB_MAX, 0,
+                       msm261_agc_max_get, msm261_agc_max_put,
+                       msm261_agc_max_tlv),
+    SOC_SINGLE_EXT("Beam Steering Angle", SND_SOC_NOPM, 0, 359, 0,
+                   msm261_beam_angle_get, msm261_beam_angle_put),
+    SOC_SINGLE_EXT("DOA Switch", SND_SOC_NOPM, 0, 1, 0,
+                   msm261_doa_switch_get, msm261_doa_switch_put),
+    MSM261_SINGLE_RO("DOA Azimuth", 359, msm261_doa_azimuth_get),
+    MSM261_SINGLE_RO("DOA Confidence", 100, msm261_doa_confidence_get),
+    SOC_SINGLE_EXT("Highpass Switch", SND_SOC_NOPM, 0, 1, 0,
+                   msm261_hpf_switch_get, msm261_hpf_switch_put),
+    SND_SOC_BYTES_EXT("Highpass Coefficients", MSM261_HPF_COEF_BYTES,
+                      msm261_hpf_coef_get, msm261_hpf_coef_put),
+    SOC_SINGLE_EXT("Mic Select Mask", SND_SOC_NOPM, 0, MSM261_MIC_MASK_ALL, 0,
+                   msm261_mic_mask_get, msm261_mic_mask_put),
+    SOC_SINGLE_EXT("VAD Switch", SND_SOC_NOPM, 0, 1, 0,
+                   msm261_vad_switch_get, msm261_vad_switch_put),
+    MSM261_SINGLE_RO("VAD Speech", 1, msm261_vad_speech_get),
+    SOC_SINGLE_EXT("Mic Health Switch", SND_SOC_NOPM, 0, 1, 0,
+                   msm261_health_switch_get, msm261_health_switch_put),
+    MSM261_SINGLE_RO("Mic Fault Mask", MSM261_MIC_MASK_ALL, msm261_mic_fault_get),
+    {   .iface = SNDRV_CTL_ELEM_IFACE_MIXER, .name = "Clock Drift PPB",
+        .access = SNDRV_CTL_ELEM_ACCESS_READ | SNDRV_CTL_ELEM_ACCESS_VOLATILE,
+        .info = msm261_drift_info, .get = msm261_drift_get },
+};
+
+/* DAPM widgets */
+static const struct snd_soc_dapm_widget msm261_dapm_widgets[] = {
+    SND_SOC_DAPM_MIC("MIC1", NULL),
+    SND_SOC_DAPM_MIC("MIC2", NULL),
+    SND_SOC_DAPM_MIC("MIC3", NULL),
+    SND_SOC_DAPM_MIC("MIC4", NULL),
+    SND_SOC_DAPM_MIC("MIC5", NULL),
+    SND_SOC_DAPM_MIC("MIC6", NULL),
+    SND_SOC_DAPM_MIC("MIC7", NULL),
+};
+
+/* DAPM routes */
+#define MSM261_MIC_ROUTES(stream)   \
+    {stream, NULL, "MIC1"},         \
+    {stream, NULL, "MIC2"},         \
+    {stream, NULL, "MIC3"},         \
+    {stream, NULL, "MIC4"},         \
+    {stream, NULL, "MIC5"},         \
+    {stream, NULL, "MIC6"},         \
+    {stream, NULL, "MIC7"}
+
+static const struct snd_soc_dapm_route msm261_dapm_routes[] = {
+    MSM261_MIC_ROUTES("Capture"),
+};
+
+/* У симуляторі зареєстровано всі DAI споживачів */
+static const struct snd_soc_dapm_route msm261_sim_dapm_routes[] = {
+    MSM261_MIC_ROUTES("Capture"),
+    MSM261_MIC_ROUTES("Beam Capture"),
+    MSM261_MIC_ROUTES("Aux Capture"),
+    MSM261_MIC_ROUTES("Group Capture"),
+};
+
+static int msm261_component_probe(struct snd_soc_component *component)
+{
+    struct msm261_priv *msm261;
+    int ret;
+
+    dev_info(component->dev, "MSM261: Platform probe starting with msm261_debug=%d\n", msm261_debug);
+
+    if (msm261_debug)
+        dev_info(component->dev, MSM261_LOG_PREFIX "Component probe starting\n");
+
+    /* Private data is allocated in msm261_platform_probe() */
+    msm261 = snd_soc_component_get_drvdata(component);
+    msm261->component = component;
+
+    /* Add controls */
+    ret = snd_soc_add_component_controls(component, msm261_controls,
+                                       ARRAY_SIZE(msm261_controls));
+    if (ret < 0) {
+        dev_err(component->dev, MSM261_LOG_PREFIX "Failed to add controls\n");
+        return ret;
+    }
+    msm261->vad_kctl = snd_soc_component_get_kcontrol(component, "VAD Speech");
+    msm261->health_kctl = snd_soc_component_get_kcontrol(component, "Mic Fault Mask");
+
+    if (msm261_group_leader(msm261)) {
+        ret = snd_soc_add_component_controls(component, &msm261_health_control, 1);
+        if (ret < 0)
+            return ret;
+        msm261->group_kctl = snd_soc_component_get_kcontrol(component, "Array Health");
+    }
+
+    if (msm261_debug)
+        dev_info(component->dev, MSM261_LOG_PREFIX "Component probe completed\n");
+
+    return 0;
+}
+
+/*
+ * Обробка періоду спеціалізована під (формат, кількість каналів), див.
+ * msm261_dsp.c; вибір робиться один раз у hw_params, а не на кожен copy.
+ */
+int msm261_format_to_dsp(snd_pcm_format_t format)
+{
+    switch (format) {
+    case SNDRV_PCM_FORMAT_S16_LE:
+        return MSM261_FMT_S16;
+    case SNDRV_PCM_FORMAT_S24_LE:
+        return MSM261_FMT_S24;
+    case SNDRV_PCM_FORMAT_S24_3LE:
+        return MSM261_FMT_S24_3;
+    case SNDRV_PCM_FORMAT_S32_LE:
+        return MSM261_FMT_S32;
+    default:
+        return -EINVAL;
+    }
+}
+
+static msm261_process_fn msm261_process_lookup(snd_pcm_format_t format,
+                                               unsigned int channels)
+{
+    int fmt = msm261_format_to_dsp(format);
+
+    if (fmt < 0)
+        return NULL;
+
+    return msm261_dsp_process_lookup(fmt, channels);
+}
+
+/* Розміри в байтах заповнює msm261_parse_geometry() для кожного пристрою */
+static const struct snd_pcm_hardware msm261_pcm_hw = {
+    .info = (SNDRV_PCM_INFO_MMAP |
+             SNDRV_PCM_INFO_INTERLEAVED |
+             SNDRV_PCM_INFO_BLOCK_TRANSFER),
+    .formats = SNDRV_PCM_FMTBIT_S16_LE | SNDRV_PCM_FMTBIT_S24_LE |
+               SNDRV_PCM_FMTBIT_S24_3LE | SNDRV_PCM_FMTBIT_S32_LE,
+    .rates = SNDRV_PCM_RATE_8000_48000,
+    .rate_min = 8000,
+    .rate_max = 48000,
+    .channels_min = 1,
+    .channels_max = MSM261_CHANNELS_MAX,
+    .periods_min = 2,
+    .periods_max = 1024,
+};
+
+/* Децимація лише в симуляторі, див. MSM261_STREAM_* у msm261.h */
+static bool msm261_decimates(struct msm261_priv *msm261)
+{
+    return msm261->sim && decimate;
+}
+
+static unsigned int msm261_decim_ratio(struct msm261_priv *msm261, unsigned int rate)
+{
+    return msm261_decimates(msm261) ? msm261_decim_ratio_for(rate) : 1;
+}
+
+/* Частота масиву rate і ті, що з неї віддаються децимацією */
+static int msm261_rate_constraint(struct msm261_priv *msm261, struct msm261_stream *stream,
+                                  struct snd_pcm_runtime *runtime)
+{
+    stream->rate_list.count = msm261_rate_list(msm261->native_rate,
+                                               msm261_decimates(msm261), stream->rates);
+    stream->rate_list.list = stream->rates;
+    stream->rate_list.mask = 0;
+    return snd_pcm_hw_constraint_list(runtime, 0, SNDRV_PCM_HW_PARAM_RATE,
+                                      &stream->rate_list);
+}
+
+/* PCM ops */
+static int msm261_pcm_open(struct snd_pcm_substream *substream)
+{
+    struct snd_soc_pcm_runtime *rtd = substream->private_data;
+    struct snd_soc_component *component;
+    struct msm261_priv *msm261;
+    struct msm261_stream *stream;
+    unsigned long failed;
+    u64 start;
+    int ret;
+
+    start = ktime_get_ns();
+    component = snd_soc_rtd_to_codec(rtd, 0)->component;
+    msm261 = snd_soc_component_get_drvdata(component);
+    stream = msm261_stream_of(msm261, substream);
+
+    substream->runtime->hw = msm261->pcm_hw;
+
+    /*
+     * Залізо: перестановку слотів, обробку, VAD і монітор робить лише copy
+     * (див. MSM261_STREAM_*), а читач через mmap отримав би сирі слоти. Типова
+     * карта слотів завжди переставляє, а обробку вмикають і посеред потоку,
+     * тож тільки RW-доступ, без винятків.
+     */
+    if (!msm261->sim) {
+        substream->runtime->hw.info &= ~(SNDRV_PCM_INFO_MMAP | SNDRV_PCM_INFO_MMAP_VALID);
+        ret = snd_pcm_hw_constraint_mask(substream->runtime, SNDRV_PCM_HW_PARAM_ACCESS,
+                                         BIT(SNDRV_PCM_ACCESS_RW_INTERLEAVED));
+        if (ret < 0)
+            return ret;
+    }
+
+    ret = snd_pcm_hw_constraint_integer(substream->runtime,
+                                      SNDRV_PCM_HW_PARAM_PERIODS);
+    if (ret < 0)
+        return ret;
+
+    /* Межі в байтах залежать від формату кадру, тож період обмежуємо в кадрах */
+    ret = snd_pcm_hw_constraint_minmax(substream->runtime, SNDRV_PCM_HW_PARAM_PERIOD_SIZE,
+                                       msm261->period_frames_min,
+                                       msm261->period_frames_max);
+    if (ret < 0)
+        return ret;
+
+    if (stream == &msm261->streams[MSM261_STREAM_GROUP]) {
+        /* Кадр групи - усі мікрофони кожного масиву, межі в байтах ширші */
+        substream->runtime->hw.channels_min = msm261_group_channels(msm261);
+        substream->runtime->hw.channels_max = msm261_group_channels(msm261);
+        substream->runtime->hw.buffer_bytes_max =
+            msm261_group_bytes(msm261, msm261->pcm_hw.buffer_bytes_max);
+        substream->runtime->hw.period_bytes_max =
+            msm261_group_bytes(msm261, msm261->pcm_hw.period_bytes_max);
+    } else {
+        /* Кадр несе лише вибрані мікрофони */
+        ret = snd_pcm_hw_constraint_minmax(substream->runtime, SNDRV_PCM_HW_PARAM_CHANNELS,
+                                           1, msm261_channels_avail(msm261->mic_mask));
+        if (ret < 0)
+            return ret;
+    }
+
+    /* Потік масиву вже запущено іншим споживачем: лише його частота і децимації */
+    if (READ_ONCE(msm261->hw_users)) {
+        ret = msm261_rate_constraint(msm261, stream, substream->runtime);
+        if (ret < 0)
+            return ret;
+    }
+    stream->substream = substream;
+
+    /* Залізо піднято в probe; мікрофони, що тоді не піднялися, - ще одна спроба */
+    failed = msm261_power_failed(msm261);
+    if (!msm261->sim && failed && msm261_power_on(msm261) != failed)
+        msm261_health_notify(msm261);
+
+    msm261->open_time = ktime_get_ns();
+    WRITE_ONCE(msm261->open_ns, msm261->open_time - start);
+
+    trace_msm261_pcm_open(msm261->dev, msm261->hw_init_ns, msm261->open_ns, 0);
+    return 0;
+}
+
+static int msm261_pcm_close(struct snd_pcm_substream *substream)
+{
+    struct snd_soc_pcm_runtime *rtd = substream->private_data;
+    struct snd_soc_component *component;
+    struct msm261_priv *msm261;
+
+    component = snd_soc_rtd_to_codec(rtd, 0)->component;
+    msm261 = snd_soc_component_get_drvdata(component);
+
+    msm261_stream_of(msm261, substream)->substream = NULL;
+
+    dev_dbg(msm261->dev, "MSM261: PCM closed\n");
+    return 0;
+}
+
+/* Чи можна віддати дані з DMA-буфера як є */
+bool msm261_needs_processing(const struct msm261_params *p, unsigned int channels)
+{
+    if (p->software_gain != 1 || p->agc_enabled || p->hpf_enabled || p->cal_active)
+        return true;
+    /* Канал променя треба обчислити навіть при одиничному підсиленні */
+    if (channels == MSM261_CHANNELS_MAX)
+        return true;
+    /* DOA бачить лише кадри, що пройшли через обробку */
+    return channels >= NUM_MICS && p->doa_enabled;
+}
+
+/*
+ * Спільний потік масиву: перший споживач задає частоту масиву, BCLK і
+ * обробку (width каналів), решта лише приєднуються. Під hw_lock.
+ */
+static int msm261_hw_claim(struct msm261_priv *msm261, unsigned int id,
+                           unsigned int native_rate, unsigned int period_frames,
+                           unsigned int width)
+{
+    unsigned long others = msm261->hw_users & ~BIT(id);
+    struct msm261_params params;
+    int ret;
+
+    switch (msm261_share_check(id == MSM261_STREAM_GROUP, others,
+                               others & BIT(MSM261_STREAM_GROUP), msm261->mic_mask,
+                               native_rate, msm261->native_rate)) {
+    case MSM261_OPEN_BUSY:
+        dev_err(msm261->dev, "MSM261: Array is busy with %s\n",
+                id == MSM261_STREAM_GROUP ? "another stream" : "its group");
+        return -EBUSY;
+    case MSM261_OPEN_GROUP_MASK:
+        dev_err(msm261->dev, "MSM261: Group capture needs all mics selected\n");
+        return -EINVAL;
+    case MSM261_OPEN_RATE:
+        dev_err(msm261->dev, "MSM261: Array already runs at %u Hz\n",
+                msm261->native_rate);
+        return -EBUSY;
+    default:
+        break;
+    }
+
+    if (others) {
+        WRITE_ONCE(msm261->hw_users, msm261->hw_users | BIT(id));
+        return 0;
+    }
+
+    ret = msm261_set_i2s_config(msm261, msm261_link_bclk(native_rate), native_rate);
+    if (ret < 0)
+        return ret;
+
+    /* Обробка одна на всіх споживачів і йде на частоті масиву */
+    msm261_dsp_select(&msm261->dsp, msm261->mic_mask);
+    msm261_params_snapshot(msm261, &params);
+    if (width == MSM261_CHANNELS_MAX)
+        msm261_beam_build(&msm261->dsp.beam, native_rate, &params);
+    if (width >= NUM_MICS) {
+        /* Споживачів немає, нових вікон теж; стара робота не бачить перебудови */
+        cancel_work_sync(&msm261->doa_work);
+        msm261_doa_build(msm261->dsp.doa, native_rate, &params);
+    }
+    msm261_hpf_reset(&msm261->dsp.hpf);
+    msm261_cal_reset(&msm261->dsp.cal);
+    msm261_agc_reset(&msm261->dsp.agc);
+    msm261_vad_setup(&msm261->dsp.vad, native_rate);
+    msm261_health_setup(&msm261->dsp.health, native_rate);
+    /* Малі періоди не повинні перетворювати DOA на FFT кожні 32 кадри */
+    msm261->dsp.period_frames = max_t(unsigned int, period_frames,
+                                      MSM261_DOA_MIN_INTERVAL);
+    if (msm261->sim)
+        msm261_sim_configure(msm261, width);
+
+    msm261->native_rate = native_rate;
+    WRITE_ONCE(msm261->hw_users, msm261->hw_users | BIT(id));
+    return 0;
+}
+
+/*
+ * Потік групи: кожен масив захоплюється як потік MSM261_STREAM_GROUP на
+ * одній частоті, або жоден. Масиви не зникають, поки тримаємо mutex групи.
+ */
+static int msm261_group_claim(struct msm261_priv *msm261, unsigned int rate,
+                              unsigned int period_frames)
+{
+    struct msm261_group *group = msm261->group;
+    struct msm261_priv *array;
+    int ret = 0, i;
+
+    if (!group)
+        return -ENODEV;
+
+    mutex_lock(&group->mutex);
+    for (i = 0; i < group->count; i++) {
+        array = group->arrays[i];
+        if (!array) {
+            dev_err(msm261->dev, "MSM261: Array %d of group %u is missing\n", i, group->id);
+            ret = -ENODEV;
+            break;
+        }
+        mutex_lock(&array->hw_lock);
+        ret = msm261_hw_claim(array, MSM261_STREAM_GROUP, rate, period_frames, NUM_MICS);
+        mutex_unlock(&array->hw_lock);
+        if (ret < 0)
+            break;
+    }
+    while (ret < 0 && --i >= 0) {
+        array = group->arrays[i];
+        mutex_lock(&array->hw_lock);
+        WRITE_ONCE(array->hw_users, array->hw_users & ~BIT(MSM261_STREAM_GROUP));
+        mutex_unlock(&array->hw_lock);
+    }
+    mutex_unlock(&group->mutex);
+
+    return ret;
+}
+
+static void msm261_group_release(struct msm261_priv *msm261)
+{
+    struct msm261_group *group = msm261->group;
+    struct msm261_priv *array;
+    int i;
+
+    if (!group)
+        return;
+
+    mutex_lock(&group->mutex);
+    for (i = 0; i < group->count; i++) {
+        array = group->arrays[i];
+        if (!array)
+            continue;
+        mutex_lock(&array->hw_lock);
+        WRITE_ONCE(array->hw_users, array->hw_users & ~BIT(MSM261_STREAM_GROUP));
+        mutex_unlock(&array->hw_lock);
+    }
+    mutex_unlock(&group->mutex);
+}
+
+/* Чи можна відкрити споживача id з channels каналами при поточній масці; під hw_lock */
+static int msm261_stream_check(struct msm261_priv *msm261, unsigned int id,
+                               unsigned int channels, bool *reorder)
+{
+    switch (msm261_open_check(&msm261->dsp, msm261->mic_mask, channels,
+                              id == MSM261_STREAM_BEAM, msm261->sim, reorder)) {
+    case MSM261_OPEN_OK:
+        return 0;
+    case MSM261_OPEN_MASK:
+        /* Неповний вибір ущільнює демультиплексор ліній, див. MSM261_STREAM_* */
+        dev_err(msm261->dev, "MSM261: Mic selection needs the line data path\n");
+        break;
+    case MSM261_OPEN_SLOTS:
+        dev_err(msm261->dev, "MSM261: Slot map does not fit a %u-slot I2S frame\n",
+                channels);
+        break;
+    default:
+        break;
+    }
+    return -EINVAL;
+}
+
+/* DAI ops */
+static int msm261_dai_hw_params(struct snd_pcm_substream *substream,
+                               struct snd_pcm_hw_params *params,
+                               struct snd_soc_dai *dai)
+{
+    struct msm261_priv *msm261 = snd_soc_dai_get_drvdata(dai);
+    struct msm261_stream *stream = &msm261->streams[dai->id];
+    snd_pcm_format_t format = params_format(params);
+    unsigned int rate = params_rate(params);
+    unsigned int channels = params_channels(params);
+    /* Масиви групи просто йдуть на частоті потоку, без децимації */
+    unsigned int ratio = dai->id == MSM261_STREAM_GROUP ? 1 : msm261_decim_ratio(msm261, rate);
+    unsigned int avail = NUM_MICS;
+    size_t frame_bytes = snd_pcm_format_physical_width(format) / 8 * channels;
+    size_t scratch_bytes;
+    bool processing, reorder = false;
+    int ret;
+
+    if (dai->id == MSM261_STREAM_GROUP) {
+        if (channels != msm261_group_channels(msm261))
+            return -EINVAL;
+        ret = msm261_group_claim(msm261, rate, params_period_size(params));
+    } else {
+        /* Маска не зміниться між перевіркою і msm261_dsp_select() у claim */
+        mutex_lock(&msm261->hw_lock);
+        avail = msm261_channels_avail(msm261->mic_mask);
+        ret = msm261_stream_check(msm261, dai->id, channels, &reorder);
+        /* Симулятор обробляє всі вибрані мікрофони один раз для всіх споживачів */
+        if (!ret)
+            ret = msm261_hw_claim(msm261, dai->id, rate * ratio,
+                                  params_period_size(params) * ratio,
+                                  msm261->sim ? avail : channels);
+        mutex_unlock(&msm261->hw_lock);
+    }
+    if (ret < 0)
+        return ret;
+
+    stream->fmt = msm261_format_to_dsp(format);
+    stream->channels = channels;
+    stream->first = dai->id == MSM261_STREAM_BEAM ? MSM261_BEAM_CHANNEL : 0;
+    /* Децимація своя в кожного споживача, після спільної обробки */
+    msm261_decim_setup(&stream->decim, ratio);
+    stream->stats_frames = 0;
+
+    /* У залізному режимі обробка йде в copy, на форматі потоку */
+    if (!msm261->sim) {
+        stream->process = msm261_process_lookup(format, channels);
+
+        /*
+         * Scratch buffer for the gain path: one period, but no more than
+         * MSM261_SCRATCH_BYTES so it stays in cache for long batched periods.
+         * The demux buffer of the same size follows it.
+         */
+        scratch_bytes = min_t(size_t, params_period_bytes(params),
+                              rounddown(MSM261_SCRATCH_BYTES, frame_bytes));
+        if (stream->scratch_bytes != scratch_bytes) {
+            kfree(stream->scratch);
+            stream->scratch = kmalloc(2 * scratch_bytes, GFP_KERNEL);
+            if (!stream->scratch) {
+                stream->demux = NULL;
+                stream->scratch_bytes = 0;
+                return -ENOMEM;
+            }
+            stream->demux = stream->scratch + scratch_bytes;
+            stream->scratch_bytes = scratch_bytes;
+        }
+    }
+    stream->reorder = reorder;
+
+    rcu_read_lock();
+    processing = msm261_needs_processing(rcu_dereference(msm261->params),
+                                         msm261->sim ? avail : channels);
+    rcu_read_unlock();
+
+    trace_msm261_hw_params(msm261->dev, format, rate, channels,
+                           params_period_size(params), params_periods(params), processing);
+    return 0;
+}
+
+static int msm261_dai_hw_free(struct snd_pcm_substream *substream,
+                             struct snd_soc_dai *dai)
+{
+    struct msm261_priv *msm261 = snd_soc_dai_get_drvdata(dai);
+    struct msm261_stream *stream = &msm261->streams[dai->id];
+
+    kfree(stream->scratch);
+    stream->scratch = NULL;
+    stream->demux = NULL;
+    stream->scratch_bytes = 0;
+    stream->reorder = false;
+    stream->process = NULL;
+
+    if (dai->id == MSM261_STREAM_GROUP) {
+        msm261_group_release(msm261);
+        return 0;
+    }
+
+    mutex_lock(&msm261->hw_lock);
+    WRITE_ONCE(msm261->hw_users, msm261->hw_users & ~BIT(dai->id));
+    mutex_unlock(&msm261->hw_lock);
+
+    return 0;
+}
+
+/* Після xrun застосунок відновлює потік через prepare; xrun-и свої в кожного */
+static int msm261_dai_prepare(struct snd_pcm_substream *substream,
+                              struct snd_soc_dai *dai)
+{
+    struct msm261_priv *msm261 = snd_soc_dai_get_drvdata(dai);
+    struct msm261_stream *stream = &msm261->streams[dai->id];
+
+    if (substream->runtime->state == SNDRV_PCM_STATE_XRUN) {
+        WRITE_ONCE(stream->xruns, stream->xruns + 1);
+        msm261_stats_xrun(msm261);
+    }
+    stream->stats_frames = 0;
+
+    return 0;
+}
+
+static int msm261_dai_trigger(struct snd_pcm_substream *substream,
+                             int cmd, struct snd_soc_dai *dai)
+{
+    struct snd_soc_component *component = dai->component;
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+    struct snd_pcm_runtime *runtime = substream->runtime;
+    int ret = 0;
+
+    switch (cmd) {
+    case SNDRV_PCM_TRIGGER_START:
+    case SNDRV_PCM_TRIGGER_RESUME:
+        set_bit(dai->id, &msm261->streaming);
+        /* Затримка старту: від open до першого START потоку */
+        if (msm261->open_time) {
+            WRITE_ONCE(msm261->start_ns, ktime_get_ns() - msm261->open_time);
+            msm261->open_time = 0;
+        }
+        break;
+    case SNDRV_PCM_TRIGGER_STOP:
+    case SNDRV_PCM_TRIGGER_SUSPEND:
+        clear_bit(dai->id, &msm261->streaming);
+        break;
+    default:
+        ret = -EINVAL;
+    }
+
+    trace_msm261_trigger(msm261->dev, cmd, runtime->status->hw_ptr,
+                         runtime->control->appl_ptr);
+    return ret;
+}
+
+static const struct snd_soc_dai_ops msm261_dai_ops = {
+    .hw_params = msm261_dai_hw_params,
+    .hw_free = msm261_dai_hw_free,
+    .prepare = msm261_dai_prepare,
+    .trigger = msm261_dai_trigger,
+};
+
+#define MSM261_CAPTURE_FORMATS (SNDRV_PCM_FMTBIT_S16_LE |   \
+                                SNDRV_PCM_FMTBIT_S24_LE |   \
+                                SNDRV_PCM_FMTBIT_S24_3LE |  \
+                                SNDRV_PCM_FMTBIT_S32_LE)
+
+/* Номер DAI - індекс споживача в msm261_priv.streams */
+static struct snd_soc_dai_driver msm261_dai[] = {
+    [MSM261_STREAM_MICS] = {
+        .name = MSM261_DAI_NAME,
+        .id = MSM261_STREAM_MICS,
+        .capture = {
+            .stream_name = "Capture",
+            .channels_min = 1,
+            .channels_max = MSM261_CHANNELS_MAX,
+            .rates = SNDRV_PCM_RATE_8000_48000,
+            .formats = MSM261_CAPTURE_FORMATS,
+        },
+        .ops = &msm261_dai_ops,
+    },
+    [MSM261_STREAM_BEAM] = {
+        .name = MSM261_BEAM_DAI_NAME,
+        .id = MSM261_STREAM_BEAM,
+        .capture = {
+            .stream_name = "Beam Capture",
+            .channels_min = 1,
+            .channels_max = 1,
+            .rates = SNDRV_PCM_RATE_8000_48000,
+            .formats = MSM261_CAPTURE_FORMATS,
+        },
+        .ops = &msm261_dai_ops,
+    },
+    [MSM261_STREAM_AUX] = {
+        .name = MSM261_AUX_DAI_NAME,
+        .id = MSM261_STREAM_AUX,
+        .capture = {
+            .stream_name = "Aux Capture",
+            .channels_min = 1,
+            .channels_max = MSM261_CHANNELS_MAX,
+            .rates = SNDRV_PCM_RATE_8000_48000,
+            .formats = MSM261_CAPTURE_FORMATS,
+        },
+        .ops = &msm261_dai_ops,
+    },
+    /* Точну кількість каналів (NUM_MICS на масив) ставить open */
+    [MSM261_STREAM_GROUP] = {
+        .name = MSM261_GROUP_DAI_NAME,
+        .id = MSM261_STREAM_GROUP,
+        .capture = {
+            .stream_name = "Group Capture",
+            .channels_min = NUM_MICS,
+            .channels_max = MSM261_GROUP_CHANNELS_MAX,
+            .rates = SNDRV_PCM_RATE_8000_48000,
+            .formats = MSM261_CAPTURE_FORMATS,
+        },
+        .ops = &msm261_dai_ops,
+    },
+};
+
+static int msm261_pcm_copy(struct snd_pcm_substream *substream,
+                           int channel,
+                           unsigned long pos,
+                           struct iov_iter *dst,
+                           unsigned long bytes)
+{
+    struct snd_soc_pcm_runtime *rtd = substream->private_data;
+    struct snd_soc_component *component =
+        snd_soc_rtd_to_codec(rtd, 0)->component;
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+    struct msm261_stream *stream = msm261_stream_of(msm261, substream);
+    struct snd_pcm_runtime *runtime = substream->runtime;
+
+    // pos тепер — зміщення в байтах від початку DMA-бфера
+    const char *hwbuf = runtime->dma_area + pos;
+    msm261_process_fn process = stream->process;
+    struct msm261_params params;
+    unsigned long done = 0, chunk;
+    unsigned int frames, periods;
+    u64 start, elapsed;
+    bool processed, vad, vad_changed = false, health, health_changed = false;
+
+    start = ktime_get_ns();
+
+    /* Один знімок параметрів на виклик: copy_to_iter може спати, тож не RCU-покажчик */
+    msm261_params_snapshot(msm261, &params);
+
+    /* Симулятор кладе в буфер уже оброблені кадри, process там NULL */
+    processed = msm261_needs_processing(&params, runtime->channels) &&
+                process && stream->scratch;
+    /* У симуляторі VAD і монітор слухають спільний потік у таймері, тут - лише залізо */
+    vad = params.vad_enabled && !msm261->sim;
+    health = params.health_enabled && !msm261->sim;
+    if (!health && !msm261->sim)
+        health_changed = msm261_health_clear(&msm261->dsp.health);
+
+    /*
+     * Шматками не більше періоду: DMA кладе кадр у порядку слотів, тож
+     * спершу демультиплексор ставить мікрофони на їхні канали (у demux),
+     * далі підсилення пише у scratch, який ще гарячий у кеші під час
+     * copy_to_iter. Без перестановки й обробки копіюємо з DMA-буфера.
+     */
+    while (done < bytes) {
+        const void *in = hwbuf + done;
+        const void *out;
+
+        chunk = stream->scratch ? min_t(unsigned long, bytes - done, stream->scratch_bytes) :
+                                  bytes;
+        frames = bytes_to_frames(runtime, chunk);
+
+        if (stream->reorder) {
+            msm261_demux_dma(&msm261->dsp, stream->demux, in, runtime->channels, frames,
+                             stream->fmt, runtime->channels);
+            in = stream->demux;
+        }
+        /* Стан мікрофонів - по сирих кадрах, до підсилення */
+        if (health)
+            health_changed |= msm261_health_feed(&msm261->dsp.health, msm261->dsp.chan_mic,
+                                                 in, stream->fmt, runtime->channels,
+                                                 min_t(unsigned int, runtime->channels,
+                                                       NUM_MICS),
+                                                 frames);
+        out = in;
+        if (processed) {
+            process(&msm261->dsp, &params, stream->scratch, in, frames);
+            out = stream->scratch;
+        }
+        if (vad)
+            vad_changed |= msm261_vad_feed(&msm261->dsp.vad, out, stream->fmt,
+                                           runtime->channels,
+                                           msm261_vad_channel(runtime->channels), frames);
+        if (copy_to_iter(out, chunk, dst) != chunk)
+            return -EFAULT;
+        done += chunk;
+    }
+    if (processed)
+        msm261_doa_kick(msm261);
+
+    elapsed = ktime_get_ns() - start;
+    periods = msm261_stats_copy(msm261, stream, elapsed, bytes_to_frames(runtime, bytes),
+                                runtime->period_size, bytes);
+    if (vad) {
+        msm261_stats_vad(msm261, periods, vad_changed && msm261->dsp.vad.speech);
+        if (vad_changed)
+            msm261_vad_notify(msm261);
+    }
+    if (health_changed)
+        msm261_health_notify(msm261);
+    trace_msm261_copy(msm261->dev, bytes_to_frames(runtime, pos),
+                      bytes_to_frames(runtime, bytes), runtime->status->hw_ptr,
+                      runtime->control->appl_ptr, processed, elapsed);
+
+    return 0;
+}
+
+/* Карта каналів для захоплення; у симуляторі ще й буфер PCM */
+static int msm261_component_pcm_construct(struct snd_soc_component *component,
+                                          struct snd_soc_pcm_runtime *rtd)
+{
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+    unsigned int id = snd_soc_rtd_to_codec(rtd, 0)->id;
+    int ret;
+
+    /* Карта каналів ALSA описує не більше 15 позицій: для групи її немає */
+    if (id == MSM261_STREAM_GROUP)
+        return msm261_sim_pcm_construct(component, rtd);
+
+    ret = snd_pcm_add_chmap_ctls(rtd->pcm, SNDRV_PCM_STREAM_CAPTURE,
+                                 id == MSM261_STREAM_BEAM ? msm261_beam_chmap :
+                                                            msm261->chmaps,
+                                 MSM261_CHANNELS_MAX, 0, &msm261->streams[id].chmap);
+    if (ret < 0)
+        return ret;
+
+    if (msm261->sim)
+        return msm261_sim_pcm_construct(component, rtd);
+    return 0;
+}
+
+static const struct snd_pcm_ops msm261_pcm_ops = {
+    .open = msm261_pcm_open,
+    .close = msm261_pcm_close,
+    .copy = msm261_pcm_copy,
+};
+
+/* Component PCM callbacks, routed through msm261_pcm_ops */
+static int msm261_component_open(struct snd_soc_component *component,
+                                 struct snd_pcm_substream *substream)
+{
+    return msm261_pcm_ops.open(substream);
+}
+
+static int msm261_component_close(struct snd_soc_component *component,
+                                  struct snd_pcm_substream *substream)
+{
+    return msm261_pcm_ops.close(substream);
+}
+
+static int msm261_component_copy(struct snd_soc_component *component,
+                                 struct snd_pcm_substream *substream,
+                                 int channel, unsigned long pos,
+                                 struct iov_iter *iter, unsigned long bytes)
+{
+    if (substream->stream != SNDRV_PCM_STREAM_CAPTURE)
+        return -EINVAL;
+
+    return msm261_pcm_ops.copy(substream, channel, pos, iter, bytes);
+}
+
+static const struct snd_soc_component_driver soc_component_dev_msm261 = {
+    .probe = msm261_component_probe,
+    .open = msm261_component_open,
+    .close = msm261_component_close,
+    .copy = msm261_component_copy,
+    .pcm_construct = msm261_component_pcm_construct,
+    .dapm_widgets = msm261_dapm_widgets,
+    .num_dapm_widgets = ARRAY_SIZE(msm261_dapm_widgets),
+    .dapm_routes = msm261_dapm_routes,
+    .num_dapm_routes = ARRAY_SIZE(msm261_dapm_routes),
+    .idle_bias_on = 1,
+    .use_pmdown_time = 1,
+    .endianness = 1,
+    .legacy_dai_naming = 0,
+};
+
+/* Те саме плюс роль платформи: буфер PCM заповнює msm261_sim.c */
+static const struct snd_soc_component_driver soc_component_dev_msm261_sim = {
+    .probe = msm261_component_probe,
+    .open = msm261_component_open,
+    .close = msm261_component_close,
+    .copy = msm261_component_copy,
+    .pcm_construct = msm261_component_pcm_construct,
+    .prepare = msm261_sim_prepare,
+    .trigger = msm261_sim_trigger,
+    .sync_stop = msm261_sim_sync_stop,
+    .pointer = msm261_sim_pointer,
+    .get_time_info = msm261_sim_get_time_info,
+    .dapm_widgets = msm261_dapm_widgets,
+    .num_dapm_widgets = ARRAY_SIZE(msm261_dapm_widgets),
+    .dapm_routes = msm261_sim_dapm_routes,
+    .num_dapm_routes = ARRAY_SIZE(msm261_sim_dapm_routes),
+    .idle_bias_on = 1,
+    .use_pmdown_time = 1,
+    .endianness = 1,
+    .legacy_dai_naming = 0,
+};
+
+/*
+ * Геометрія буфера: параметри модуля мають пріоритет над DT, далі типові
+ * значення. Байтові межі рахуються для найширшого кадру (8 каналів S32 на
+ * 48 кГц), щоб buffer_ms справді вміщався в будь-якій конфігурації.
+ */
+static int msm261_parse_geometry(struct msm261_priv *msm261, struct device_node *np)
+{
+    u32 pmin = MSM261_PERIOD_FRAMES_MIN, pmax = MSM261_PERIOD_FRAMES_MAX;
+    u32 ms = MSM261_BUFFER_MS_DEFAULT;
+    size_t frame_max = MSM261_CHANNELS_MAX * sizeof(s32);
+    size_t buffer_frames;
+
+    of_property_read_u32(np, "msm,period-frames-min", &pmin);
+    of_property_read_u32(np, "msm,period-frames-max", &pmax);
+    of_property_read_u32(np, "msm,buffer-ms", &ms);
+    if (period_frames_min)
+        pmin = period_frames_min;
+    if (period_frames_max)
+        pmax = period_frames_max;
+    if (buffer_ms)
+        ms = buffer_ms;
+
+    buffer_frames = (size_t)ms * msm261_pcm_hw.rate_max / MSEC_PER_SEC;
+    if (pmin < MSM261_PERIOD_FRAMES_MIN || pmin > pmax || ms > MSM261_BUFFER_MS_MAX ||
+        buffer_frames < 2 * pmin) {
+        dev_err(msm261->dev, "MSM261: Invalid geometry: period %u-%u frames, buffer %u ms\n",
+                pmin, pmax, ms);
+        return -EINVAL;
+    }
+    pmax = min_t(size_t, pmax, buffer_frames / 2);
+
+    msm261->pcm_hw = msm261_pcm_hw;
+    /* Межі періодів бачить лише симулятор, див. MSM261_STREAM_* */
+    if (msm261->sim)
+        msm261->pcm_hw.info |= SNDRV_PCM_INFO_HAS_LINK_ATIME |
+                               SNDRV_PCM_INFO_HAS_LINK_ABSOLUTE_ATIME;
+    msm261->pcm_hw.buffer_bytes_max = buffer_frames * frame_max;
+    /* Найвужчий кадр - моно S16; точні межі в кадрах ставить open */
+    msm261->pcm_hw.period_bytes_min = pmin * sizeof(s16);
+    msm261->pcm_hw.period_bytes_max = pmax * frame_max;
+    msm261->period_frames_min = pmin;
+    msm261->period_frames_max = pmax;
+
+    dev_info(msm261->dev, "MSM261: Period %u-%u frames, buffer up to %u ms (%zu bytes)\n",
+             pmin, pmax, ms, msm261->pcm_hw.buffer_bytes_max);
+    return 0;
+}
+
+/*
+ * Необов'язкова властивість "msm,slot-map": для кожного мікрофона номер слоту
+ * (лінія * 2 + 0/1 для L/R). Без неї - розкладка плати MSM261_DEFAULT_SLOT().
+ */
+static int msm261_parse_slot_map(struct msm261_priv *msm261, struct device_node *np)
+{
+    u32 map[NUM_MICS];
+    unsigned int used = 0;
+    int ret, i;
+
+    if (!of_property_present(np, "msm,slot-map"))
+        return 0;
+
+    ret = of_property_read_u32_array(np, "msm,slot-map", map, NUM_MICS);
+    if (ret < 0) {
+        dev_err(msm261->dev, "MSM261: msm,slot-map needs %d entries: %d\n",
+                NUM_MICS, ret);
+        return ret;
+    }
+
+    for (i = 0; i < NUM_MICS; i++) {
+        if (map[i] >= NUM_SLOTS || (used & BIT(map[i]))) {
+            dev_err(msm261->dev, "MSM261: Invalid slot %u for mic %d\n", map[i], i);
+            return -EINVAL;
+        }
+        used |= BIT(map[i]);
+    }
+
+    for (i = 0; i < NUM_MICS; i++)
+        msm261->dsp.slot_map[i] = map[i];
+    return 0;
+}
+
+static int msm261_cal_from_fw(struct msm261_params *p, const struct firmware *fw)
+{
+    const struct msm261_cal_fw *blob = (const void *)fw->data;
+    int i;
+
+    if (fw->size < sizeof(*blob) || memcmp(blob->magic, MSM261_CAL_MAGIC, 4) ||
+        blob->version != MSM261_CAL_VERSION || blob->mics != NUM_MICS)
+        return -EINVAL;
+
+    for (i = 0; i < NUM_MICS; i++) {
+        p->cal_gain[i] = le16_to_cpu(blob->mic[i].gain);
+        p->cal_delay[i] = blob->mic[i].delay;
+    }
+    return 0;
+}
+
+/*
+ * Калібрування мікрофонів: "msm,mic-gain-q12" і "msm,mic-delay-samples" з DT
+ * (по значенню на мікрофон), потім файл прошивки, якщо він є. Без жодного
+ * з них поправки одиничні, і підсилення йде векторними ядрами.
+ */
+static int msm261_load_calibration(struct msm261_priv *msm261, struct device_node *np)
+{
+    const char *name = MSM261_CAL_FIRMWARE;
+    const char *source = "none";
+    const struct firmware *fw;
+    struct msm261_params *p;
+    u32 val[NUM_MICS];
+    int ret, i;
+
+    p = msm261_params_begin(msm261);
+    if (!p)
+        return -ENOMEM;
+
+    if (!of_property_read_u32_array(np, "msm,mic-gain-q12", val, NUM_MICS)) {
+        for (i = 0; i < NUM_MICS; i++)
+            p->cal_gain[i] = min_t(u32, val[i], U16_MAX);
+        source = "device tree";
+    }
+    if (!of_property_read_u32_array(np, "msm,mic-delay-samples", val, NUM_MICS)) {
+        for (i = 0; i < NUM_MICS; i++)
+            p->cal_delay[i] = min_t(u32, val[i], U8_MAX);
+        source = "device tree";
+    }
+
+    of_property_read_string(np, "firmware-name", &name);
+    if (!firmware_request_nowarn(&fw, name, msm261->dev)) {
+        ret = msm261_cal_from_fw(p, fw);
+        release_firmware(fw);
+        if (ret < 0) {
+            dev_err(msm261->dev, "MSM261: Malformed calibration file %s\n", name);
+            msm261_params_abort(msm261, p);
+            return ret;
+        }
+        source = name;
+    }
+
+    if (!msm261_params_cal_check(p)) {
+        dev_err(msm261->dev, "MSM261: Calibration delay exceeds %d samples\n",
+                MSM261_CAL_DELAY_MAX);
+        msm261_params_abort(msm261, p);
+        return -EINVAL;
+    }
+
+    dev_info(msm261->dev, "MSM261: Calibration: %s\n", source);
+    if (msm261_debug)
+        for (i = 0; i < NUM_MICS; i++)
+            dev_info(msm261->dev, "MSM261: MIC%d gain %u/%u delay %u\n", i + 1,
+                     p->cal_gain[i], MSM261_CAL_ONE, p->cal_delay[i]);
+    msm261_params_commit(msm261, p);
+    return 0;
+}
+
+static void msm261_params_free(void *data)
+{
+    struct msm261_priv *msm261 = data;
+
+    kfree(rcu_dereference_protected(msm261->params, true));
+}
+
+/* Перший блок параметрів - типові значення, далі DT, калібрування і hw_init */
+static int msm261_params_alloc(struct msm261_priv *msm261)
+{
+    struct msm261_params *p;
+
+    p = kzalloc(sizeof(*p), GFP_KERNEL);
+    if (!p)
+        return -ENOMEM;
+
+    msm261_params_init(p);
+    RCU_INIT_POINTER(msm261->params, p);
+    return devm_add_action_or_reset(msm261->dev, msm261_params_free, msm261);
+}
+
+/*
+ * Runtime PM: ASoC бере посилання на пристрій компоненти на час відкритого
+ * потоку, тож після закриття масив засинає через MSM261_AUTOSUSPEND_MS.
+ * Без BCLK мікрофони самі переходять у сон; на виході лише повертаємо
+ * тактування й режим - перевірку ліній даних зроблено в probe.
+ */
+static int msm261_runtime_suspend(struct device *dev)
+{
+    struct msm261_priv *msm261 = dev_get_drvdata(dev);
+    int i;
+
+    mutex_lock(&msm261->hw_lock);
+
+    if (!msm261->sim) {
+        gpio_set_value(msm261->bck_gpio, 0);
+        gpio_set_value(msm261->ws_gpio, 0);
+    }
+    for (i = 0; i < NUM_MICS; i++)
+        msm261->mic_status[i].power_state = MSM261_STATUS_OFF;
+
+    mutex_unlock(&msm261->hw_lock);
+
+    dev_dbg(dev, "MSM261: Suspended\n");
+    return 0;
+}
+
+static int msm261_runtime_resume(struct device *dev)
+{
+    struct msm261_priv *msm261 = dev_get_drvdata(dev);
+    u64 start = ktime_get_ns();
+    int ret, i;
+
+    mutex_lock(&msm261->hw_lock);
+
+    ret = msm261_set_mode(msm261, msm261->operation_mode);
+    if (!ret)
+        ret = msm261_setup_clocks(msm261, msm261->bclk);
+    if (!ret)
+        for (i = 0; i < NUM_MICS; i++)
+            if (!msm261->mic_status[i].gpio_error)
+                msm261->mic_status[i].power_state = MSM261_STATUS_ON;
+
+    mutex_unlock(&msm261->hw_lock);
+
+    WRITE_ONCE(msm261->resume_ns, ktime_get_ns() - start);
+    dev_dbg(dev, "MSM261: Resumed in %llu ns\n", msm261->resume_ns);
+    return ret;
+}
+
+static DEFINE_RUNTIME_DEV_PM_OPS(msm261_pm_ops, msm261_runtime_suspend,
+                                 msm261_runtime_resume, NULL);
+
+static int msm261_platform_probe(struct platform_device *pdev)
+{
+    struct device *dev = &pdev->dev;
+    struct device_node *np = dev->of_node;
+    struct msm261_priv *msm261;
+    const char *compatible;
+    bool sim = msm261_sim_requested(np);
+    int ret, i;
+
+    dev_info(dev, "MSM261: Platform probe starting\n");
+
+    if (!np && !sim) {
+        dev_err(dev, "MSM261: No device tree node found\n");
+        return -EINVAL;
+    }
+
+    msm261 = devm_kzalloc(dev, sizeof(*msm261), GFP_KERNEL);
+    if (!msm261) {
+        dev_err(dev, "MSM261: Failed to allocate private data\n");
+        return -ENOMEM;
+    }
+    msm261->sim = sim;
+
+    if (np) {
+        compatible = of_get_property(np, "compatible", NULL);
+        if (compatible)
+            dev_info(dev, "MSM261: Compatible: %s\n", compatible);
+
+        // Print device tree information
+        dev_info(dev, "MSM261: Node name: %s\n", np->full_name);
+    }
+
+    if (!sim) {
+        // Get GPIOs from device tree
+        msm261->bck_gpio = of_get_named_gpio(np, "bck-gpios", 0);
+        msm261->ws_gpio = of_get_named_gpio(np, "ws-gpios", 0);
+
+        for (i = 0; i < NUM_DATA_LINES; i++) {
+            msm261->data_gpio[i] = of_get_named_gpio(np, "data-gpios", i);
+            if (!gpio_is_valid(msm261->data_gpio[i])) {
+                dev_err(dev, "Invalid data GPIO %d\n", i);
+                return -EINVAL;
+            }
+        }
+    }
+
+    msm261->dev = dev;
+    mutex_init(&msm261->hw_lock);
+    mutex_init(&msm261->params_lock);
+    msm261_dsp_init(&msm261->dsp);
+    ret = msm261_params_alloc(msm261);
+    if (ret < 0)
+        return ret;
+    msm261->mic_mask = MSM261_MIC_MASK_ALL;
+    msm261_chmap_update(msm261);
+
+    ret = msm261_parse_slot_map(msm261, np);
+    if (ret < 0)
+        return ret;
+
+    ret = msm261_load_calibration(msm261, np);
+    if (ret < 0)
+        return ret;
+
+    ret = msm261_parse_geometry(msm261, np);
+    if (ret < 0)
+        return ret;
+
+    ret = msm261_group_parse(msm261, np);
+    if (ret < 0)
+        return ret;
+
+    msm261->dsp.doa = devm_kzalloc(dev, sizeof(*msm261->dsp.doa), GFP_KERNEL);
+    if (!msm261->dsp.doa)
+        return -ENOMEM;
+    /* Скасовується після таймера симулятора і виходу з групи, що її ставлять */
+    ret = devm_work_autocancel(dev, &msm261->doa_work, msm261_doa_work);
+    if (ret < 0)
+        return ret;
+
+    /* Одноразове піднімання заліза: GPIO, живлення, режим, тактування */
+    ret = msm261_hw_init(msm261);
+    if (ret < 0)
+        return dev_err_probe(dev, ret, "MSM261: Hardware initialization failed\n");
+    dev_info(dev, "MSM261: Hardware up in %llu us\n", div_u64(msm261->hw_init_ns, 1000));
+
+    ret = msm261_debugfs_init(msm261);
+    if (ret < 0)
+        return ret;
+
+    /* Залізо щойно піднято: стартуємо активними, засинаємо за простою */
+    pm_runtime_set_active(dev);
+    pm_runtime_set_autosuspend_delay(dev, MSM261_AUTOSUSPEND_MS);
+    pm_runtime_use_autosuspend(dev);
+    pm_runtime_mark_last_busy(dev);
+    ret = devm_pm_runtime_enable(dev);
+    if (ret < 0)
+        return ret;
+
+    // Store private data
+    platform_set_drvdata(pdev, msm261);
+
+    // Register component and DAI
+    ret = devm_snd_soc_register_component(dev, sim ? &soc_component_dev_msm261_sim :
+                                                     &soc_component_dev_msm261,
+                                          msm261_dai, sim ? ARRAY_SIZE(msm261_dai) : 1);
+    if (ret < 0) {
+        dev_err(dev, "MSM261: Failed to register component: %d\n", ret);
+        return ret;
+    }
+
+    if (sim) {
+        ret = msm261_sim_probe(msm261);
+        if (ret < 0)
+            return ret;
+    }
+
+    ret = msm261_group_join(msm261);
+    if (ret < 0)
+        return ret;
+
+    if (!sim) {
+        dev_info(dev, "MSM261: BCK GPIO: %d\n", msm261->bck_gpio);
+        dev_info(dev, "MSM261: WS GPIO: %d\n", msm261->ws_gpio);
+        for (i = 0; i < NUM_DATA_LINES; i++) {
+            dev_info(dev, "MSM261: DATA%d GPIO: %d\n", i, msm261->data_gpio[i]);
+        }
+    }
+
+    dev_info(dev, "MSM261: Platform probe completed\n");
+
+    return 0;
+}
+
+static const struct of_device_id msm261_of_match[] = {
+    { .compatible = "msm,msm261s4030h0" },
+    { .compatible = "msm,msm261-sim" },
+    { }
+};
+MODULE_DEVICE_TABLE(of, msm261_of_match);
+
+static struct platform_driver msm261_platform_driver = {
+    .probe = msm261_platform_probe,
+    .driver = {
+        .name = DRIVER_NAME,
+        .owner = THIS_MODULE,
+        .of_match_table = msm261_of_match,
+        /* Піднімання живлення мікрофонів займає мілісекунди - не гальмуємо завантаження */
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
+        .pm = pm_ptr(&msm261_pm_ops),
+    },
+};
+
+static int __init msm261_init(void)
+{
+    int ret;
+
+    pr_info("MSM261: Initializing driver\n");
+    BUILD_BUG_ON(MSM261_CHANNELS_MAX > NUM_SLOTS);
+    msm261_gain_select();
+
+    ret = platform_driver_register(&msm261_platform_driver);
+    if (ret < 0)
+        return ret;
+
+    ret = msm261_sim_init();
+    if (ret < 0)
+        platform_driver_unregister(&msm261_platform_driver);
+    return ret;
+}
+
+static void __exit msm261_exit(void)
+{
+    pr_info("MSM261: Cleaning up driver\n");
+    msm261_sim_exit();
+    platform_driver_unregister(&msm261_platform_driver);
+    msm261_group_exit();
+}
+
+module_init(msm261_init);
+module_exit(msm261_exit);
+
+MODULE_DESCRIPTION("MSM261S4030H0 7-mic array ALSA SoC driver");
+MODULE_AUTHOR("Your Name");
+MODULE_LICENSE("GPL");
+MODULE_VERSION(DRIVER_VERSION);
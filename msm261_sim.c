@@ -0,0 +1,935 @@
+/*
+ * Симульований бекенд захоплення: та сама компонента і DAI, але замість
+ * I2S буфер PCM заповнює hrtimer синтетичним сигналом масиву.
+ *
+ * Вмикається параметром модуля sim=1 (без DT створюється власний пристрій)
+ * або сумісністю "msm,msm261-sim" у DT. Сигнал - тон і/або шум з напрямку
+ * sim_angle з затримками за геометрією плати, плюс некорельований шум
+ * кожного мікрофона. Семпли генеруються по лініях даних, як їх дає залізо,
+ * і проходять через msm261_demux(), тож шлях потоку той самий.
+ *
+ * Таймер - це один потік масиву на його частоті для всіх споживачів
+ * (msm261_priv.streams): кадри демультиплексуються і обробляються один раз,
+ * а далі кожен запущений споживач бере свої канали, за потреби децимує і
+ * пише у свій буфер зі своїм покажчиком.
+ *
+ * sim_arrays=2..3 створює стільки масивів однієї групи (msm261_group.c).
+ * Картку реєструє лише ведучий; його таймер для потоку групи синтезує й
+ * обробляє кадри кожного масиву його власним станом і зводить їх у буфер.
+ */
+#include <linux/module.h>
+#include <linux/hrtimer.h>
+#include <linux/platform_device.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <sound/core.h>
+#include <sound/pcm.h>
+#include <sound/soc.h>
+#include "msm261.h"
+
+static bool msm261_sim;
+module_param_named(sim, msm261_sim, bool, 0444);
+MODULE_PARM_DESC(sim, "Use the simulated capture backend instead of the GPIO hardware");
+
+static char *sim_signal = "mix";
+module_param(sim_signal, charp, 0644);
+MODULE_PARM_DESC(sim_signal, "Simulated source: tone, noise or mix");
+
+static int sim_angle = 60;
+module_param(sim_angle, int, 0644);
+MODULE_PARM_DESC(sim_angle, "Direction of the simulated source, degrees");
+
+static int sim_freq = 1000;
+module_param(sim_freq, int, 0644);
+MODULE_PARM_DESC(sim_freq, "Frequency of the simulated tone, Hz");
+
+static int sim_ppm;
+module_param(sim_ppm, int, 0644);
+MODULE_PARM_DESC(sim_ppm, "Offset of the simulated array clock from CLOCK_MONOTONIC_RAW, ppm");
+#define MSM261_SIM_PPM_MAX          1000
+
+static unsigned int sim_arrays = 1;
+module_param(sim_arrays, uint, 0444);
+MODULE_PARM_DESC(sim_arrays, "Number of simulated arrays in one group (1-3)");
+
+/* Зіпсований мікрофон для перевірки монітора стану, з наступного старту */
+static char *sim_fault = "dead";
+module_param(sim_fault, charp, 0644);
+MODULE_PARM_DESC(sim_fault, "Fault of sim_fault_mic: dead, stuck, dc or clip");
+
+static int sim_fault_mic;
+module_param(sim_fault_mic, int, 0644);
+MODULE_PARM_DESC(sim_fault_mic, "Faulty mic, 1-7 (8-21 for the next arrays), 0 for none");
+
+enum {
+    MSM261_SIM_FAULT_DEAD,
+    MSM261_SIM_FAULT_STUCK,
+    MSM261_SIM_FAULT_DC,
+    MSM261_SIM_FAULT_CLIP,
+};
+
+static const char * const msm261_sim_faults[] = {
+    [MSM261_SIM_FAULT_DEAD] = "dead",
+    [MSM261_SIM_FAULT_STUCK] = "stuck",
+    [MSM261_SIM_FAULT_DC] = "dc",
+    [MSM261_SIM_FAULT_CLIP] = "clip",
+};
+
+#define MSM261_SIM_STUCK_VALUE      0x00123400
+#define MSM261_SIM_DC_OFFSET        (1 << 28)   /* -18 дБFS */
+
+/* Шум з напрямку береться з історії з базовим лагом, щоб затримки були >= 0 */
+#define MSM261_SIM_NOISE_HISTORY    32
+#define MSM261_SIM_NOISE_LAG        12
+
+/* Кадрів частоти масиву на прохід лінії -> обробка -> споживачі */
+#define MSM261_SIM_CHUNK            (MSM261_DEMUX_BLOCK * MSM261_DECIM_RATIO_MAX)
+#define MSM261_SIM_FRAME_BUF        (MSM261_SIM_CHUNK * MSM261_CHANNELS_MAX)
+
+struct msm261_sim {
+    struct msm261_priv *msm261;
+    struct hrtimer timer;
+    /*
+     * Облік, спільний з trigger/prepare/get_time_info: running, такт,
+     * годинник масиву і межі періодів. Прохід обробки йде без нього.
+     */
+    spinlock_t lock;
+    unsigned long running;          /* біти MSM261_STREAM_* */
+    bool restart;                   /* перший прохід після старту: сигнал заново */
+    unsigned int tick_frames;       /* кадрів частоти масиву на спрацювання */
+    ktime_t tick_time;
+    /* Годинник масиву: кадри від старту за CLOCK_MONOTONIC_RAW і sim_ppm */
+    u64 start_raw_ns;
+    u64 produced;
+    int ppm;
+
+    /* Спільна обробка: width каналів S32 на частоті масиву */
+    msm261_process_fn process;
+    unsigned int width;
+    bool vad_changed;               /* стан VAD змінився за прохід */
+    bool health_changed;            /* вердикт монітора стану змінився */
+
+    bool tone, noise;
+    u32 phase, phase_inc;           /* 2^32 = 2*pi */
+    u32 phase_offset[NUM_MICS];
+    int noise_delay[NUM_MICS];
+    s32 noise_hist[MSM261_SIM_NOISE_HISTORY];
+    unsigned int noise_pos;
+    u32 seed;
+    int fault_mic;                  /* -1 - усі справні */
+    int fault;
+
+    s32 *lines[NUM_DATA_LINES];     /* MSM261_SIM_CHUNK пар L/R */
+    s32 *raw;                       /* MSM261_SIM_FRAME_BUF кожен */
+    s32 *proc;
+    s32 *pick;
+    s32 *out;
+
+    struct platform_device *card_pdev;
+    struct snd_soc_card card;
+    struct snd_soc_dai_link links[MSM261_STREAMS];
+    struct snd_soc_dai_link_component comp[MSM261_STREAMS][3];
+};
+
+bool msm261_sim_requested(struct device_node *np)
+{
+    return msm261_sim || (np && of_device_is_compatible(np, "msm,msm261-sim"));
+}
+
+/* Власні пристрої sim=1: один або по одному на масив групи з id 0.. */
+static struct platform_device *msm261_sim_pdevs[MSM261_GROUP_MAX];
+static unsigned int msm261_sim_count;
+
+/* Місце власного пристрою в групі; probe може йти ще до кінця init */
+bool msm261_sim_array(struct device *dev, unsigned int *index, unsigned int *count)
+{
+    struct platform_device *pdev = to_platform_device(dev);
+
+    if (msm261_sim_count < 2 || pdev->id < 0 || pdev->id >= msm261_sim_count)
+        return false;
+
+    *index = pdev->id;
+    *count = msm261_sim_count;
+    return true;
+}
+
+static struct msm261_sim *msm261_sim_of(struct snd_soc_component *component)
+{
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+
+    return msm261->sim_state;
+}
+
+static u32 msm261_sim_rand(struct msm261_sim *sim)
+{
+    sim->seed ^= sim->seed << 13;
+    sim->seed ^= sim->seed >> 17;
+    sim->seed ^= sim->seed << 5;
+    return sim->seed;
+}
+
+static s32 msm261_sim_fault(struct msm261_sim *sim, s32 v)
+{
+    switch (sim->fault) {
+    case MSM261_SIM_FAULT_STUCK:
+        return MSM261_SIM_STUCK_VALUE;
+    case MSM261_SIM_FAULT_DC:
+        return v / 2 + MSM261_SIM_DC_OFFSET;
+    case MSM261_SIM_FAULT_CLIP:
+        return v < 0 ? S32_MIN : S32_MAX;
+    }
+    return 0;
+}
+
+/* Синтез frames кадрів по лініях даних, S32 */
+static void msm261_sim_lines(struct msm261_sim *sim, unsigned int frames)
+{
+    const u8 *slot_map = sim->msm261->dsp.slot_map;
+    unsigned int n, m;
+
+    for (n = 0; n < frames; n++) {
+        s32 noise = (s32)msm261_sim_rand(sim) >> 3;
+
+        sim->noise_pos = (sim->noise_pos + 1) & (MSM261_SIM_NOISE_HISTORY - 1);
+        sim->noise_hist[sim->noise_pos] = noise;
+
+        for (m = 0; m < NUM_MICS; m++) {
+            unsigned int slot = slot_map[m];
+            s32 v = (s32)msm261_sim_rand(sim) >> 8;
+
+            if (sim->tone)
+                v += fixp_sin32_rad((sim->phase - sim->phase_offset[m]) >> 16,
+                                    1 << 16) >> 2;
+            if (sim->noise)
+                v += sim->noise_hist[(sim->noise_pos - sim->noise_delay[m]) &
+                                     (MSM261_SIM_NOISE_HISTORY - 1)];
+            if (unlikely((int)m == sim->fault_mic))
+                v = msm261_sim_fault(sim, v);
+
+            sim->lines[slot / MSM261_SLOTS_PER_LINE]
+                      [n * MSM261_SLOTS_PER_LINE + slot % MSM261_SLOTS_PER_LINE] = v;
+        }
+        sim->phase += sim->phase_inc;
+    }
+}
+
+/* Оброблені кадри -> буфер споживача: його канали, децимація і формат */
+static void msm261_sim_emit(struct msm261_sim *sim, struct msm261_stream *st,
+                            const s32 *src, unsigned int frames)
+{
+    struct snd_pcm_runtime *runtime = st->substream->runtime;
+    unsigned int stride = sim->width, first = st->first, n;
+
+    if (st->decim.ratio > 1) {
+        msm261_pick(sim->pick, MSM261_FMT_S32, st->channels, src, stride, first, frames);
+        frames = msm261_decim(&st->decim, sim->out, sim->pick, frames, MSM261_FMT_S32,
+                              st->channels);
+        src = sim->out;
+        stride = st->channels;
+        first = 0;
+    }
+
+    /* Кільцевий буфер: щонайбільше два шматки через кінець */
+    while (frames) {
+        n = min_t(unsigned int, frames, runtime->buffer_size - st->hw_ptr);
+        msm261_pick(runtime->dma_area + frames_to_bytes(runtime, st->hw_ptr), st->fmt,
+                    st->channels, src, stride, first, n);
+        src += n * stride;
+        frames -= n;
+        st->frames += n;
+        st->period_pos += n;
+        WRITE_ONCE(st->hw_ptr, (st->hw_ptr + n) % runtime->buffer_size);
+    }
+}
+
+/*
+ * chunk кадрів одного масиву групи, NUM_MICS каналів S32 після його власної
+ * обробки; NULL - масиву немає або він не захоплений потоком групи.
+ */
+static const s32 *msm261_sim_array_frames(struct msm261_priv *array, unsigned int frames)
+{
+    struct msm261_sim *sim = array ? array->sim_state : NULL;
+    const struct msm261_params *p;
+    const void *lines[NUM_DATA_LINES];
+    const s32 *src;
+    unsigned int l;
+
+    if (!sim || !(READ_ONCE(array->hw_users) & BIT(MSM261_STREAM_GROUP)))
+        return NULL;
+
+    for (l = 0; l < NUM_DATA_LINES; l++)
+        lines[l] = sim->lines[l];
+
+    msm261_sim_lines(sim, frames);
+    msm261_demux(&array->dsp, sim->raw, lines, MSM261_SLOTS_PER_LINE, frames,
+                 MSM261_FMT_S32, NUM_MICS);
+
+    src = sim->raw;
+    rcu_read_lock();
+    p = rcu_dereference(array->params);
+    if (p->health_enabled)
+        sim->health_changed |= msm261_health_feed(&array->dsp.health, array->dsp.chan_mic,
+                                                  sim->raw, MSM261_FMT_S32, NUM_MICS,
+                                                  NUM_MICS, frames);
+    else
+        sim->health_changed |= msm261_health_clear(&array->dsp.health);
+    if (sim->process && msm261_needs_processing(p, NUM_MICS)) {
+        sim->process(&array->dsp, p, sim->proc, sim->raw, frames);
+        src = sim->proc;
+    }
+    rcu_read_unlock();
+    msm261_doa_kick(array);
+    return src;
+}
+
+/* Кадри масивів групи -> буфер потоку групи, масив за масивом у кадрі */
+static void msm261_sim_emit_group(struct msm261_stream *st, const s32 **src,
+                                  unsigned int arrays, unsigned int frames)
+{
+    struct snd_pcm_runtime *runtime = st->substream->runtime;
+    unsigned int n, a;
+
+    while (frames) {
+        n = min_t(unsigned int, frames, runtime->buffer_size - st->hw_ptr);
+        msm261_interleave(runtime->dma_area + frames_to_bytes(runtime, st->hw_ptr), st->fmt,
+                          src, arrays, NUM_MICS, n);
+        for (a = 0; a < arrays; a++)
+            if (src[a])
+                src[a] += n * NUM_MICS;
+        frames -= n;
+        st->frames += n;
+        st->period_pos += n;
+        WRITE_ONCE(st->hw_ptr, (st->hw_ptr + n) % runtime->buffer_size);
+    }
+}
+
+/*
+ * Масиви групи на один прохід: під group->lock лише знімок arrays[] і
+ * позначка проходу, обробка - поза замком. msm261_group_leave() чекає
+ * кінця проходу, тож знятий масив не звільнять посеред нього.
+ */
+static void msm261_sim_group_pin(struct msm261_group *group, struct msm261_priv **arrays)
+{
+    spin_lock(&group->lock);
+    memcpy(arrays, group->arrays, group->count * sizeof(*arrays));
+    group->running = true;
+    spin_unlock(&group->lock);
+}
+
+static void msm261_sim_group_unpin(struct msm261_group *group)
+{
+    struct completion *leaving;
+
+    spin_lock(&group->lock);
+    group->running = false;
+    leaving = group->leaving;
+    group->leaving = NULL;
+    spin_unlock(&group->lock);
+
+    if (leaving)
+        complete(leaving);
+}
+
+/*
+ * Потік групи: усі масиви з одного такту ведучого, тож кадр n кожного
+ * масиву - той самий момент. Зниклий масив дає тишу на своєму місці.
+ */
+static unsigned long msm261_sim_group_run(struct msm261_sim *sim, unsigned int frames)
+{
+    struct msm261_priv *msm261 = sim->msm261;
+    struct msm261_group *group = msm261->group;
+    struct msm261_stream *st = &msm261->streams[MSM261_STREAM_GROUP];
+    struct msm261_priv *arrays[MSM261_GROUP_MAX];
+    const s32 *src[MSM261_GROUP_MAX];
+    struct msm261_priv *array;
+    unsigned int done, chunk, a;
+
+    msm261_sim_group_pin(group, arrays);
+    for (done = 0; done < frames; done += chunk) {
+        chunk = min_t(unsigned int, frames - done, MSM261_SIM_CHUNK);
+
+        for (a = 0; a < group->count; a++)
+            src[a] = msm261_sim_array_frames(arrays[a], chunk);
+        msm261_sim_emit_group(st, src, group->count, chunk);
+    }
+    /*
+     * Картки в інших масивів немає: їхній стан оновлюємо тут, поки масив
+     * закріплено за проходом, а сповіщення ("Array Health") - від ведучого.
+     */
+    for (a = 0; a < group->count; a++) {
+        array = arrays[a];
+        if (array && array != msm261 && array->sim_state &&
+            array->sim_state->health_changed) {
+            array->sim_state->health_changed = false;
+            msm261_health_notify(array);
+            sim->health_changed = true;
+        }
+    }
+    msm261_sim_group_unpin(group);
+
+    if (st->period_pos < st->substream->runtime->period_size)
+        return 0;
+    st->period_pos %= st->substream->runtime->period_size;
+    return BIT(MSM261_STREAM_GROUP);
+}
+
+/*
+ * frames кадрів потоку масиву з параметрами p для споживачів running;
+ * повертає біти споживачів із завершеним періодом.
+ */
+static unsigned long msm261_sim_run(struct msm261_sim *sim, unsigned long running,
+                                    const struct msm261_params *p, unsigned int frames)
+{
+    struct msm261_priv *msm261 = sim->msm261;
+    const void *lines[NUM_DATA_LINES];
+    unsigned long elapsed = 0;
+    unsigned int done, chunk, l;
+    const s32 *src;
+    int id;
+
+    /* Масив з потоком групи інших споживачів не має, див. msm261_hw_claim() */
+    if (running & BIT(MSM261_STREAM_GROUP))
+        return msm261_sim_group_run(sim, frames);
+
+    for (l = 0; l < NUM_DATA_LINES; l++)
+        lines[l] = sim->lines[l];
+
+    if (!p->health_enabled)
+        sim->health_changed |= msm261_health_clear(&msm261->dsp.health);
+
+    /* Шматками, що лишаються в кеші від ліній до буферів споживачів */
+    for (done = 0; done < frames; done += chunk) {
+        chunk = min_t(unsigned int, frames - done, MSM261_SIM_CHUNK);
+
+        msm261_sim_lines(sim, chunk);
+        msm261_demux(&msm261->dsp, sim->raw, lines, MSM261_SLOTS_PER_LINE, chunk,
+                     MSM261_FMT_S32, sim->width);
+        if (p->health_enabled)
+            sim->health_changed |= msm261_health_feed(&msm261->dsp.health,
+                                                      msm261->dsp.chan_mic, sim->raw,
+                                                      MSM261_FMT_S32, sim->width,
+                                                      min_t(unsigned int, sim->width,
+                                                            NUM_MICS),
+                                                      chunk);
+
+        /* Підсилення, калібрування, промінь, фільтр і DOA - один раз на всіх */
+        src = sim->raw;
+        if (sim->process && msm261_needs_processing(p, sim->width)) {
+            sim->process(&msm261->dsp, p, sim->proc, sim->raw, chunk);
+            src = sim->proc;
+        }
+        if (p->vad_enabled)
+            sim->vad_changed |= msm261_vad_feed(&msm261->dsp.vad, src, MSM261_FMT_S32,
+                                                sim->width, msm261_vad_channel(sim->width),
+                                                chunk);
+
+        for_each_set_bit(id, &running, MSM261_STREAMS)
+            msm261_sim_emit(sim, &msm261->streams[id], src, chunk);
+    }
+    msm261_doa_kick(msm261);
+
+    for_each_set_bit(id, &running, MSM261_STREAMS) {
+        struct msm261_stream *st = &msm261->streams[id];
+        snd_pcm_uframes_t period = st->substream->runtime->period_size;
+
+        if (st->period_pos >= period) {
+            st->period_pos %= period;
+            elapsed |= BIT(id);
+        }
+    }
+
+    return elapsed;
+}
+
+/* Сигнал і геометрія - на частоті масиву, до децимації */
+static void msm261_sim_signal(struct msm261_sim *sim, unsigned int rate)
+{
+    u64 r_q16;
+    int m;
+
+    sim->tone = !sysfs_streq(sim_signal, "noise");
+    sim->noise = !sysfs_streq(sim_signal, "tone");
+    sim->phase = 0;
+    sim->phase_inc = div_u64((u64)clamp(sim_freq, 0, (int)rate / 2) << 32, rate);
+
+    /*
+     * Мікрофон кільця під кутом phi чує джерело з напрямку theta раніше за
+     * центр на r/c * cos(theta - phi), див. msm261_beam_build().
+     */
+    r_q16 = div_u64((u64)MSM261_ARRAY_RADIUS_UM * rate << 16, MSM261_SPEED_OF_SOUND_UM);
+    for (m = 0; m < NUM_MICS; m++) {
+        s64 lead_q16 = 0;
+
+        if (m != MSM261_CENTER_MIC)
+            lead_q16 = ((s64)r_q16 * fixp_cos32(sim_angle - m * MSM261_RING_STEP_DEG)) >> 31;
+
+        sim->phase_offset[m] = -(u32)(((s64)sim->phase_inc * lead_q16) >> 16);
+        sim->noise_delay[m] = MSM261_SIM_NOISE_LAG - (int)((lead_q16 + (1 << 15)) >> 16);
+    }
+
+    memset(sim->noise_hist, 0, sizeof(sim->noise_hist));
+    sim->noise_pos = 0;
+    /* Свій некорельований шум у кожного масиву групи */
+    sim->seed = 0x2545f491 ^ (sim->msm261->array_index * 0x9e3779b9);
+
+    /* Номери мікрофонів - як канали потоку групи */
+    m = sim_fault_mic - 1 - (int)sim->msm261->array_index * NUM_MICS;
+    sim->fault_mic = m >= 0 && m < NUM_MICS ? m : -1;
+    sim->fault = sysfs_match_string(msm261_sim_faults, sim_fault);
+    if (sim->fault < 0)
+        sim->fault = MSM261_SIM_FAULT_DEAD;
+}
+
+/* Усі масиви групи починають разом; ведучий серед них */
+static void msm261_sim_group_signal(struct msm261_group *group)
+{
+    struct msm261_priv *array;
+    unsigned int a;
+
+    spin_lock(&group->lock);
+    for (a = 0; a < group->count; a++) {
+        array = group->arrays[a];
+        if (array && array->sim_state)
+            msm261_sim_signal(array->sim_state, array->native_rate);
+    }
+    spin_unlock(&group->lock);
+}
+
+/* Кадрів, які масив захопив від старту: його годинник відходить на ppm */
+static u64 msm261_sim_due(struct msm261_sim *sim, u64 raw_ns)
+{
+    u64 ns = raw_ns - sim->start_raw_ns;
+
+    ns += div_s64((s64)ns * sim->ppm, 1000000);
+    return mul_u64_u32_div(ns, sim->msm261->native_rate, NSEC_PER_SEC);
+}
+
+/*
+ * Межа періоду: period_pos кадрів після неї вже в буфері, і останній з них
+ * захоплено щойно, тож час межі - на стільки кадрів раніше.
+ */
+static void msm261_sim_stamp(struct msm261_stream *st, u64 raw_ns, u64 mono_ns)
+{
+    u64 back = div_u64((u64)st->period_pos * NSEC_PER_SEC, st->substream->runtime->rate);
+
+    st->period_frames = st->frames - st->period_pos;
+    st->period_raw_ns = raw_ns - back;
+    st->period_mono_ns = mono_ns - back;
+}
+
+/*
+ * Під sim->lock - лише облік: знімок running, такт і годинник масиву, а в
+ * кінці межі періодів. Синтез, обробка і запис у буфери йдуть без замка і з
+ * увімкненими перериваннями: буфер і покажчик споживача пише лише таймер, а
+ * зупинений споживач чекає кінця проходу в sync_stop.
+ */
+static enum hrtimer_restart msm261_sim_timer(struct hrtimer *timer)
+{
+    struct msm261_sim *sim = container_of(timer, struct msm261_sim, timer);
+    struct msm261_priv *msm261 = sim->msm261;
+    unsigned long running, elapsed;
+    const struct msm261_params *params;
+    u64 frames, limit = U64_MAX, raw_ns, mono_ns;
+    bool restart, vad, vad_changed, health_changed;
+    int id;
+
+    spin_lock(&sim->lock);
+
+    running = sim->running;
+    if (!running) {
+        spin_unlock(&sim->lock);
+        return HRTIMER_NORESTART;
+    }
+    restart = sim->restart;
+    sim->restart = false;
+
+    /*
+     * Кадри рахує годинник масиву, не кількість спрацювань: затримку таймера
+     * наздоганяємо, а що не влазить у буфер, губиться, як при переповненні
+     * DMA, але лічильник лінії їх усе одно бачить.
+     */
+    hrtimer_forward_now(timer, sim->tick_time);
+    raw_ns = ktime_get_raw_ns();
+    mono_ns = ktime_get_ns();
+    frames = msm261_sim_due(sim, raw_ns) - sim->produced;
+    sim->produced += frames;
+    msm261_drift_feed(&msm261->drift, sim->produced, raw_ns);
+
+    spin_unlock(&sim->lock);
+
+    /* Сигнал починається разом із потоком масиву, не з кожним споживачем */
+    if (restart && (running & BIT(MSM261_STREAM_GROUP)))
+        msm261_sim_group_signal(msm261->group);
+    else if (restart)
+        msm261_sim_signal(sim, msm261->native_rate);
+
+    for_each_set_bit(id, &running, MSM261_STREAMS) {
+        struct msm261_stream *st = &msm261->streams[id];
+
+        limit = min_t(u64, limit, st->substream->runtime->buffer_size * st->decim.ratio);
+    }
+    if (frames > limit) {
+        for_each_set_bit(id, &running, MSM261_STREAMS)
+            msm261->streams[id].frames += div_u64(frames - limit,
+                                                  msm261->streams[id].decim.ratio);
+    }
+
+    /* Параметри - RCU-покажчиком на весь прохід, softirq його не покидає */
+    rcu_read_lock();
+    params = rcu_dereference(msm261->params);
+    elapsed = msm261_sim_run(sim, running, params, min(frames, limit));
+    vad = params->vad_enabled;
+    rcu_read_unlock();
+    vad_changed = sim->vad_changed;
+    sim->vad_changed = false;
+    health_changed = sim->health_changed;
+    sim->health_changed = false;
+
+    /* Зупинені за прохід споживачі не отримують ні межі, ні period_elapsed */
+    spin_lock(&sim->lock);
+    elapsed &= sim->running;
+    for_each_set_bit(id, &elapsed, MSM261_STREAMS)
+        msm261_sim_stamp(&msm261->streams[id], raw_ns, mono_ns);
+    spin_unlock(&sim->lock);
+
+    /* Кожен період споживача - пробудження читача, що читає безперервно */
+    if (vad)
+        msm261_stats_vad(msm261, hweight_long(elapsed),
+                         vad_changed && READ_ONCE(msm261->dsp.vad.speech));
+    if (vad_changed)
+        msm261_vad_notify(msm261);
+    if (health_changed)
+        msm261_health_notify(msm261);
+
+    /* Через xrun period_elapsed викликає trigger, тож поза замком */
+    for_each_set_bit(id, &elapsed, MSM261_STREAMS)
+        snd_pcm_period_elapsed(msm261->streams[id].substream);
+
+    return HRTIMER_RESTART;
+}
+
+/* Сторінки буфера виділяються одразу під максимальну геометрію */
+int msm261_sim_pcm_construct(struct snd_soc_component *component,
+                             struct snd_soc_pcm_runtime *rtd)
+{
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+    size_t size = msm261->pcm_hw.buffer_bytes_max;
+
+    if (snd_soc_rtd_to_codec(rtd, 0)->id == MSM261_STREAM_GROUP)
+        size = msm261_group_bytes(msm261, size);
+
+    snd_pcm_set_managed_buffer_all(rtd->pcm, SNDRV_DMA_TYPE_VMALLOC, NULL, size, size);
+    return 0;
+}
+
+/* Обробка спільного потоку; перший hw_params, таймер ще не запущено */
+void msm261_sim_configure(struct msm261_priv *msm261, unsigned int width)
+{
+    struct msm261_sim *sim = msm261->sim_state;
+
+    spin_lock_bh(&sim->lock);
+    sim->width = width;
+    sim->process = msm261_dsp_process_lookup(MSM261_FMT_S32, width);
+    spin_unlock_bh(&sim->lock);
+}
+
+int msm261_sim_prepare(struct snd_soc_component *component,
+                       struct snd_pcm_substream *substream)
+{
+    struct msm261_sim *sim = msm261_sim_of(component);
+    struct msm261_priv *msm261 = sim->msm261;
+    struct msm261_stream *st = msm261_stream_of(msm261, substream);
+
+    if (st->fmt < 0)
+        return -EINVAL;
+
+    /* Сигнал масиву скидає перший прохід таймера після старту */
+    spin_lock_bh(&sim->lock);
+    st->hw_ptr = 0;
+    st->period_pos = 0;
+    st->frames = 0;
+    st->period_frames = 0;
+    st->period_raw_ns = 0;
+    st->period_mono_ns = 0;
+    spin_unlock_bh(&sim->lock);
+
+    dev_dbg(msm261->dev, "MSM261: Simulating %s from %d deg for %s\n",
+            sim_signal, sim_angle, substream->pcm->id);
+    return 0;
+}
+
+int msm261_sim_trigger(struct snd_soc_component *component,
+                       struct snd_pcm_substream *substream, int cmd)
+{
+    struct msm261_sim *sim = msm261_sim_of(component);
+    struct msm261_priv *msm261 = sim->msm261;
+    struct msm261_stream *st = msm261_stream_of(msm261, substream);
+    unsigned int id = st - msm261->streams;
+    unsigned int period = substream->runtime->period_size * st->decim.ratio;
+    unsigned long flags;
+    int ret = 0;
+
+    spin_lock_irqsave(&sim->lock, flags);
+
+    switch (cmd) {
+    case SNDRV_PCM_TRIGGER_START:
+    case SNDRV_PCM_TRIGGER_RESUME:
+        /* Таймер іде з найкоротшим періодом серед запущених споживачів */
+        if (!sim->running || period < sim->tick_frames) {
+            sim->tick_frames = period;
+            sim->tick_time = ns_to_ktime(div_u64((u64)period * NSEC_PER_SEC,
+                                                 msm261->native_rate));
+        }
+        if (!sim->running) {
+            /* Годинник масиву стартує разом із першим споживачем */
+            sim->ppm = clamp(sim_ppm, -MSM261_SIM_PPM_MAX, MSM261_SIM_PPM_MAX);
+            sim->start_raw_ns = ktime_get_raw_ns();
+            sim->produced = 0;
+            sim->restart = true;
+            msm261_drift_reset(&msm261->drift, msm261->native_rate);
+            hrtimer_start(&sim->timer, sim->tick_time, HRTIMER_MODE_REL_SOFT);
+        }
+        __set_bit(id, &sim->running);
+        break;
+    case SNDRV_PCM_TRIGGER_STOP:
+    case SNDRV_PCM_TRIGGER_SUSPEND:
+        /* Тут атомарний контекст; дочекаємося таймера в sync_stop */
+        __clear_bit(id, &sim->running);
+        if (!sim->running)
+            hrtimer_try_to_cancel(&sim->timer);
+        break;
+    default:
+        ret = -EINVAL;
+    }
+
+    spin_unlock_irqrestore(&sim->lock, flags);
+    return ret;
+}
+
+/*
+ * Таймер міг ще писати в буфер зупиненого споживача: чекаємо його і, якщо
+ * інші споживачі працюють, запускаємо знову.
+ */
+int msm261_sim_sync_stop(struct snd_soc_component *component,
+                         struct snd_pcm_substream *substream)
+{
+    struct msm261_sim *sim = msm261_sim_of(component);
+
+    hrtimer_cancel(&sim->timer);
+
+    spin_lock_bh(&sim->lock);
+    if (sim->running)
+        hrtimer_start(&sim->timer, sim->tick_time, HRTIMER_MODE_REL_SOFT);
+    spin_unlock_bh(&sim->lock);
+    return 0;
+}
+
+snd_pcm_uframes_t msm261_sim_pointer(struct snd_soc_component *component,
+                                     struct snd_pcm_substream *substream)
+{
+    struct msm261_priv *msm261 = snd_soc_component_get_drvdata(component);
+
+    return READ_ONCE(msm261_stream_of(msm261, substream)->hw_ptr);
+}
+
+/*
+ * Позначка часу ALSA (SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK*): останній межі
+ * періоду - її позиція в лічильнику лінії, переведена в час за номінальною
+ * частотою, і системний час захоплення її кадру в годиннику, який вибрав
+ * застосунок. Різниця між ними зі зростанням позиції - дрейф лінії.
+ */
+int msm261_sim_get_time_info(struct snd_soc_component *component,
+                             struct snd_pcm_substream *substream,
+                             struct timespec64 *system_ts, struct timespec64 *audio_ts,
+                             struct snd_pcm_audio_tstamp_config *audio_tstamp_config,
+                             struct snd_pcm_audio_tstamp_report *audio_tstamp_report)
+{
+    struct msm261_sim *sim = msm261_sim_of(component);
+    struct msm261_stream *st = msm261_stream_of(sim->msm261, substream);
+    struct snd_pcm_runtime *runtime = substream->runtime;
+    u64 frames, raw_ns, mono_ns;
+    unsigned long flags;
+
+    switch (audio_tstamp_config->type_requested) {
+    case SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK:
+    case SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK_ABSOLUTE:
+        break;
+    default:
+        audio_tstamp_report->actual_type = SNDRV_PCM_AUDIO_TSTAMP_TYPE_DEFAULT;
+        return 0;
+    }
+
+    spin_lock_irqsave(&sim->lock, flags);
+    frames = st->period_frames;
+    raw_ns = st->period_raw_ns;
+    mono_ns = st->period_mono_ns;
+    spin_unlock_irqrestore(&sim->lock, flags);
+
+    /* До першої межі порівнювати нічого: ALSA візьме звичайну позначку */
+    if (!raw_ns) {
+        audio_tstamp_report->actual_type = SNDRV_PCM_AUDIO_TSTAMP_TYPE_DEFAULT;
+        return 0;
+    }
+
+    switch (runtime->tstamp_type) {
+    case SNDRV_PCM_TSTAMP_TYPE_MONOTONIC_RAW:
+        *system_ts = ns_to_timespec64(raw_ns);
+        break;
+    case SNDRV_PCM_TSTAMP_TYPE_MONOTONIC:
+        *system_ts = ns_to_timespec64(mono_ns);
+        break;
+    default:
+        *system_ts = ktime_to_timespec64(ktime_mono_to_real(ns_to_ktime(mono_ns)));
+        break;
+    }
+    *audio_ts = ns_to_timespec64(mul_u64_u32_div(frames, NSEC_PER_SEC, runtime->rate));
+
+    audio_tstamp_report->actual_type = audio_tstamp_config->type_requested;
+    /* Останній кадр спрацювання захоплено десь за останній період кадру */
+    audio_tstamp_report->accuracy_report = 1;
+    audio_tstamp_report->accuracy = div_u64(NSEC_PER_SEC, runtime->rate);
+    return 0;
+}
+
+static void msm261_sim_release(void *data)
+{
+    struct msm261_sim *sim = data;
+
+    snd_soc_unregister_card(&sim->card);
+    platform_device_unregister(sim->card_pdev);
+    hrtimer_cancel(&sim->timer);
+}
+
+/* Зв'язок на кожного споживача: свій пристрій PCM, hw:<картка>,<номер> */
+static const struct {
+    const char *name;
+    const char *stream_name;
+    const char *dai_name;
+} msm261_sim_links[MSM261_STREAMS] = {
+    [MSM261_STREAM_MICS] = { "MSM261 Sim", "Capture", MSM261_DAI_NAME },
+    [MSM261_STREAM_BEAM] = { "MSM261 Sim Beam", "Beam Capture", MSM261_BEAM_DAI_NAME },
+    [MSM261_STREAM_AUX]  = { "MSM261 Sim Aux", "Aux Capture", MSM261_AUX_DAI_NAME },
+    [MSM261_STREAM_GROUP] = { "MSM261 Sim Group", "Group Capture", MSM261_GROUP_DAI_NAME },
+};
+
+/*
+ * Картка зі зв'язком на кожного споживача: фіктивний CPU DAI ASoC, наш DAI
+ * як кодек і наша компонента як платформа (буфер, pointer, trigger). Картка
+ * живе на окремому пристрої, бо snd_soc_register_card() займає drvdata.
+ */
+int msm261_sim_probe(struct msm261_priv *msm261)
+{
+    struct device *dev = msm261->dev;
+    struct msm261_sim *sim;
+    s32 *buf;
+    int ret, i;
+
+    sim = devm_kzalloc(dev, sizeof(*sim), GFP_KERNEL);
+    if (!sim)
+        return -ENOMEM;
+
+    sim->msm261 = msm261;
+    sim->fault_mic = -1;
+    for (i = 0; i < NUM_DATA_LINES; i++) {
+        sim->lines[i] = devm_kcalloc(dev, MSM261_SIM_CHUNK * MSM261_SLOTS_PER_LINE,
+                                     sizeof(s32), GFP_KERNEL);
+        if (!sim->lines[i])
+            return -ENOMEM;
+    }
+    buf = devm_kcalloc(dev, 4 * MSM261_SIM_FRAME_BUF, sizeof(s32), GFP_KERNEL);
+    if (!buf)
+        return -ENOMEM;
+    sim->raw = buf;
+    sim->proc = buf + MSM261_SIM_FRAME_BUF;
+    sim->pick = buf + 2 * MSM261_SIM_FRAME_BUF;
+    sim->out = buf + 3 * MSM261_SIM_FRAME_BUF;
+
+    spin_lock_init(&sim->lock);
+    hrtimer_init(&sim->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT);
+    sim->timer.function = msm261_sim_timer;
+    msm261->sim_state = sim;
+
+    /* Ведені масиви читаються лише таймером ведучого */
+    if (msm261->array_index) {
+        dev_info(dev, "MSM261: Simulated array %u, captured through the group leader\n",
+                 msm261->array_index);
+        return 0;
+    }
+
+    sim->card_pdev = platform_device_register_simple("msm261-sim-card",
+                                                     PLATFORM_DEVID_AUTO, NULL, 0);
+    if (IS_ERR(sim->card_pdev))
+        return PTR_ERR(sim->card_pdev);
+
+    for (i = 0; i < MSM261_STREAMS; i++) {
+        struct snd_soc_dai_link_component *comp = sim->comp[i];
+        struct snd_soc_dai_link *link = &sim->links[i];
+
+        comp[0].name = "snd-soc-dummy";
+        comp[0].dai_name = "snd-soc-dummy-dai";
+        comp[1].name = dev_name(dev);
+        comp[1].dai_name = msm261_sim_links[i].dai_name;
+        comp[2].name = dev_name(dev);
+
+        link->name = msm261_sim_links[i].name;
+        link->stream_name = msm261_sim_links[i].stream_name;
+        link->id = i;
+        link->cpus = &comp[0];
+        link->num_cpus = 1;
+        link->codecs = &comp[1];
+        link->num_codecs = 1;
+        link->platforms = &comp[2];
+        link->num_platforms = 1;
+        link->capture_only = 1;
+    }
+
+    sim->card.name = "MSM261 Simulated Array";
+    sim->card.owner = THIS_MODULE;
+    sim->card.dev = &sim->card_pdev->dev;
+    sim->card.dai_link = sim->links;
+    /* Потік групи - останній зв'язок, лише коли є що зводити */
+    sim->card.num_links = msm261_group_leader(msm261) ? MSM261_STREAMS : MSM261_STREAM_GROUP;
+
+    ret = snd_soc_register_card(&sim->card);
+    if (ret < 0) {
+        platform_device_unregister(sim->card_pdev);
+        return dev_err_probe(dev, ret, "MSM261: Failed to register sim card\n");
+    }
+
+    dev_info(dev, "MSM261: Simulated capture backend registered\n");
+    return devm_add_action_or_reset(dev, msm261_sim_release, sim);
+}
+
+/* Власні пристрої для sim=1 на машинах без вузла DT */
+int msm261_sim_init(void)
+{
+    struct platform_device *pdev;
+    unsigned int i;
+
+    if (!msm261_sim)
+        return 0;
+
+    msm261_sim_count = clamp_t(unsigned int, sim_arrays, 1, MSM261_GROUP_MAX);
+    for (i = 0; i < msm261_sim_count; i++) {
+        pdev = platform_device_register_simple(DRIVER_NAME, msm261_sim_count > 1 ? i :
+                                               PLATFORM_DEVID_NONE, NULL, 0);
+        if (IS_ERR(pdev)) {
+            msm261_sim_exit();
+            return PTR_ERR(pdev);
+        }
+        msm261_sim_pdevs[i] = pdev;
+    }
+    return 0;
+}
+
+/* Ведений зникає раніше за ведучого, як при видаленні плати */
+void msm261_sim_exit(void)
+{
+    unsigned int i = MSM261_GROUP_MAX;
+
+    while (i--) {
+        if (msm261_sim_pdevs[i])
+            platform_device_unregister(msm261_sim_pdevs[i]);
+        msm261_sim_pdevs[i] = NULL;
+    }
+}
@@ -0,0 +1,189 @@
+/*
+ * Векторні ядра підсилення з насиченням.
+ *
+ * Файл збирається з $(CC_FLAGS_FPU), тому викликати його функції можна лише
+ * між kernel_fpu_begin() і kernel_fpu_end(). Результат має збігатися біт у біт
+ * зі скалярними msm261_gain_sample_*() з msm261_dsp.h; це перевіряється при
+ * завантаженні модуля перед тим, як ядра будуть вибрані.
+ */
+#include "msm261_dsp.h"
+
+#ifdef MSM261_DSP_NEON
+#ifdef __KERNEL__
+#include <asm/neon-intrinsics.h>
+#else
+#include <arm_neon.h>
+#endif
+
+/* ARM: розширююче множення + vqmovn дає те саме насичення, що й скалярний код */
+static void msm261_neon_gain_s16(int16_t *dst, const int16_t *src,
+                                 unsigned int n, int gain)
+{
+    int16x4_t g = vdup_n_s16(gain);
+    unsigned int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        int16x8_t x = vld1q_s16(src + i);
+        int32x4_t lo = vmull_s16(vget_low_s16(x), g);
+        int32x4_t hi = vmull_s16(vget_high_s16(x), g);
+
+        vst1q_s16(dst + i, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+    }
+    for (; i < n; i++)
+        dst[i] = msm261_gain_sample_s16(src[i], gain);
+}
+
+static void msm261_neon_gain_s24(int32_t *dst, const int32_t *src,
+                                 unsigned int n, int gain)
+{
+    int32x2_t g = vdup_n_s32(gain);
+    unsigned int i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        /* Розширюємо знак 24-бітного семпла */
+        int32x4_t x = vshrq_n_s32(vshlq_n_s32(vld1q_s32(src + i), 8), 8);
+        /* Зсув на 8 переносить межі S24 на межі vqmovn_s64 */
+        int64x2_t lo = vshlq_n_s64(vmull_s32(vget_low_s32(x), g), 8);
+        int64x2_t hi = vshlq_n_s64(vmull_s32(vget_high_s32(x), g), 8);
+        int32x4_t y = vcombine_s32(vqmovn_s64(lo), vqmovn_s64(hi));
+
+        vst1q_s32(dst + i, vshrq_n_s32(y, 8));
+    }
+    for (; i < n; i++)
+        dst[i] = msm261_gain_sample_s24(src[i], gain);
+}
+
+static void msm261_neon_gain_s32(int32_t *dst, const int32_t *src,
+                                 unsigned int n, int gain)
+{
+    int32x2_t g = vdup_n_s32(gain);
+    unsigned int i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        int32x4_t x = vld1q_s32(src + i);
+        int64x2_t lo = vmull_s32(vget_low_s32(x), g);
+        int64x2_t hi = vmull_s32(vget_high_s32(x), g);
+
+        vst1q_s32(dst + i, vcombine_s32(vqmovn_s64(lo), vqmovn_s64(hi)));
+    }
+    for (; i < n; i++)
+        dst[i] = msm261_gain_sample_s32(src[i], gain);
+}
+
+const struct msm261_gain_ops msm261_gain_simd = {
+    .name = "neon",
+    .needs_fpu = true,
+    .s16 = msm261_neon_gain_s16,
+    .s24 = msm261_neon_gain_s24,
+    .s32 = msm261_neon_gain_s32,
+};
+
+#else /* !MSM261_DSP_NEON */
+
+/*
+ * x86 та інші: векторні розширення GCC. Заголовки <emmintrin.h> недоступні
+ * при збиранні ядра (-nostdinc), а з -msse2 GCC генерує з цього SSE2-код.
+ *
+ * Насичення робимо порівнянням з порогами: для 0 < gain і x у межах
+ * [min / gain, max / gain] добуток не виходить за межі формату, інакше
+ * результат - відповідна межа.
+ */
+typedef int16_t v8hi __attribute__((vector_size(16)));
+typedef uint16_t v8hu __attribute__((vector_size(16)));
+typedef int32_t v4si __attribute__((vector_size(16)));
+typedef uint32_t v4su __attribute__((vector_size(16)));
+
+static void msm261_vec_gain_s16(int16_t *dst, const int16_t *src,
+                                unsigned int n, int gain)
+{
+    const v8hi max = (v8hi){} + (int16_t)32767;
+    const v8hi min = (v8hi){} + (int16_t)-32768;
+    v8hi hi, lo;
+    unsigned int i;
+
+    if (gain == 0) {
+        for (i = 0; i < n; i++)
+            dst[i] = 0;
+        return;
+    }
+
+    hi = (v8hi){} + (int16_t)(32767 / gain);
+    lo = (v8hi){} + (int16_t)(-32768 / gain);
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        v8hi x, y, over, under;
+
+        __builtin_memcpy(&x, src + i, sizeof(x));
+        over = x > hi;
+        under = x < lo;
+        y = (v8hi)((v8hu)x * (uint16_t)gain);
+        y = (y & ~(over | under)) | (max & over) | (min & under);
+        __builtin_memcpy(dst + i, &y, sizeof(y));
+    }
+    for (; i < n; i++)
+        dst[i] = msm261_gain_sample_s16(src[i], gain);
+}
+
+static inline v4si msm261_vec_gain_v4si(v4si x, int gain, int32_t max, int32_t min)
+{
+    v4si over = x > max / gain;
+    v4si under = x < min / gain;
+    v4si y = (v4si)((v4su)x * (uint32_t)gain);
+
+    return (y & ~(over | under)) | (max & over) | (min & under);
+}
+
+static void msm261_vec_gain_s24(int32_t *dst, const int32_t *src,
+                                unsigned int n, int gain)
+{
+    unsigned int i;
+
+    if (gain == 0) {
+        for (i = 0; i < n; i++)
+            dst[i] = 0;
+        return;
+    }
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        v4si x;
+
+        __builtin_memcpy(&x, src + i, sizeof(x));
+        x = (v4si)((v4su)x << 8) >> 8;
+        x = msm261_vec_gain_v4si(x, gain, MSM261_S24_MAX, MSM261_S24_MIN);
+        __builtin_memcpy(dst + i, &x, sizeof(x));
+    }
+    for (; i < n; i++)
+        dst[i] = msm261_gain_sample_s24(src[i], gain);
+}
+
+static void msm261_vec_gain_s32(int32_t *dst, const int32_t *src,
+                                unsigned int n, int gain)
+{
+    unsigned int i;
+
+    if (gain == 0) {
+        for (i = 0; i < n; i++)
+            dst[i] = 0;
+        return;
+    }
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        v4si x;
+
+        __builtin_memcpy(&x, src + i, sizeof(x));
+        x = msm261_vec_gain_v4si(x, gain, 2147483647, -2147483647 - 1);
+        __builtin_memcpy(dst + i, &x, sizeof(x));
+    }
+    for (; i < n; i++)
+        dst[i] = msm261_gain_sample_s32(src[i], gain);
+}
+
+const struct msm261_gain_ops msm261_gain_simd = {
+    .name = "vector",
+    .needs_fpu = true,
+    .s16 = msm261_vec_gain_s16,
+    .s24 = msm261_vec_gain_s24,
+    .s32 = msm261_vec_gain_s32,
+};
+
+#endif /* MSM261_DSP_NEON */
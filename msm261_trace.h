@@ -0,0 +1,142 @@
+/*
+ * Точки трасування шляху захоплення для ftrace/perf/trace-cmd:
+ *
+ *   trace-cmd record -e msm261 arecord ...
+ *
+ * Позиції - у кадрах (hw_ptr/appl_ptr ALSA), час - у наносекундах.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM msm261
+
+#if !defined(_MSM261_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _MSM261_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <sound/pcm.h>
+
+TRACE_EVENT(msm261_power_on,
+    TP_PROTO(struct device *dev, int retries, unsigned long failed_mask, u64 ns),
+    TP_ARGS(dev, retries, failed_mask, ns),
+    TP_STRUCT__entry(
+        __string(dev, dev_name(dev))
+        __field(int, retries)
+        __field(unsigned long, failed_mask)
+        __field(u64, ns)
+    ),
+    TP_fast_assign(
+        __assign_str(dev, dev_name(dev));
+        __entry->retries = retries;
+        __entry->failed_mask = failed_mask;
+        __entry->ns = ns;
+    ),
+    TP_printk("%s retries=%d failed=0x%lx ns=%llu", __get_str(dev),
+              __entry->retries, __entry->failed_mask, __entry->ns)
+);
+
+TRACE_EVENT(msm261_pcm_open,
+    TP_PROTO(struct device *dev, u64 hw_init_ns, u64 open_ns, int ret),
+    TP_ARGS(dev, hw_init_ns, open_ns, ret),
+    TP_STRUCT__entry(
+        __string(dev, dev_name(dev))
+        __field(u64, hw_init_ns)
+        __field(u64, open_ns)
+        __field(int, ret)
+    ),
+    TP_fast_assign(
+        __assign_str(dev, dev_name(dev));
+        __entry->hw_init_ns = hw_init_ns;
+        __entry->open_ns = open_ns;
+        __entry->ret = ret;
+    ),
+    TP_printk("%s hw_init_ns=%llu open_ns=%llu ret=%d", __get_str(dev),
+              __entry->hw_init_ns, __entry->open_ns, __entry->ret)
+);
+
+TRACE_EVENT(msm261_hw_params,
+    TP_PROTO(struct device *dev, snd_pcm_format_t format, unsigned int rate,
+             unsigned int channels, unsigned int period_frames, unsigned int periods,
+             bool processed),
+    TP_ARGS(dev, format, rate, channels, period_frames, periods, processed),
+    TP_STRUCT__entry(
+        __string(dev, dev_name(dev))
+        __string(format, snd_pcm_format_name(format))
+        __field(unsigned int, rate)
+        __field(unsigned int, channels)
+        __field(unsigned int, period_frames)
+        __field(unsigned int, periods)
+        __field(bool, processed)
+    ),
+    TP_fast_assign(
+        __assign_str(dev, dev_name(dev));
+        __assign_str(format, snd_pcm_format_name(format));
+        __entry->rate = rate;
+        __entry->channels = channels;
+        __entry->period_frames = period_frames;
+        __entry->periods = periods;
+        __entry->processed = processed;
+    ),
+    TP_printk("%s %s rate=%u channels=%u period=%u periods=%u dsp=%d",
+              __get_str(dev), __get_str(format), __entry->rate, __entry->channels,
+              __entry->period_frames, __entry->periods, __entry->processed)
+);
+
+TRACE_EVENT(msm261_trigger,
+    TP_PROTO(struct device *dev, int cmd, snd_pcm_uframes_t hw_ptr,
+             snd_pcm_uframes_t appl_ptr),
+    TP_ARGS(dev, cmd, hw_ptr, appl_ptr),
+    TP_STRUCT__entry(
+        __string(dev, dev_name(dev))
+        __field(int, cmd)
+        __field(unsigned long, hw_ptr)
+        __field(unsigned long, appl_ptr)
+    ),
+    TP_fast_assign(
+        __assign_str(dev, dev_name(dev));
+        __entry->cmd = cmd;
+        __entry->hw_ptr = hw_ptr;
+        __entry->appl_ptr = appl_ptr;
+    ),
+    TP_printk("%s %s hw_ptr=%lu appl_ptr=%lu", __get_str(dev),
+              __print_symbolic(__entry->cmd,
+                               { SNDRV_PCM_TRIGGER_STOP, "stop" },
+                               { SNDRV_PCM_TRIGGER_START, "start" },
+                               { SNDRV_PCM_TRIGGER_SUSPEND, "suspend" },
+                               { SNDRV_PCM_TRIGGER_RESUME, "resume" }),
+              __entry->hw_ptr, __entry->appl_ptr)
+);
+
+TRACE_EVENT(msm261_copy,
+    TP_PROTO(struct device *dev, snd_pcm_uframes_t pos, unsigned int frames,
+             snd_pcm_uframes_t hw_ptr, snd_pcm_uframes_t appl_ptr, bool processed,
+             u64 ns),
+    TP_ARGS(dev, pos, frames, hw_ptr, appl_ptr, processed, ns),
+    TP_STRUCT__entry(
+        __string(dev, dev_name(dev))
+        __field(unsigned long, pos)
+        __field(unsigned int, frames)
+        __field(unsigned long, hw_ptr)
+        __field(unsigned long, appl_ptr)
+        __field(bool, processed)
+        __field(u64, ns)
+    ),
+    TP_fast_assign(
+        __assign_str(dev, dev_name(dev));
+        __entry->pos = pos;
+        __entry->frames = frames;
+        __entry->hw_ptr = hw_ptr;
+        __entry->appl_ptr = appl_ptr;
+        __entry->processed = processed;
+        __entry->ns = ns;
+    ),
+    TP_printk("%s pos=%lu frames=%u hw_ptr=%lu appl_ptr=%lu dsp=%d ns=%llu",
+              __get_str(dev), __entry->pos, __entry->frames, __entry->hw_ptr,
+              __entry->appl_ptr, __entry->processed, __entry->ns)
+);
+
+#endif /* _MSM261_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE msm261_trace
+#include <trace/define_trace.h>